@@ -0,0 +1,1142 @@
+/*  bench.c - throughput and latency benchmark over pseudo-terminal pairs.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+#include "usbserial_linux.h"
+#include "usbserial.h"
+#include "rbuff.h"
+#include "stats.h"
+#include "scan.h"
+#include "shmring.h"
+
+#define BENCH_MIN_SIZE      18          /* 16 hex digits of timestamp + filler + '\n' */
+#define BENCH_RING_SIZE     (1 << 16)
+#define BENCH_DRAIN_MS      5000
+#define BENCH_READ_SIZE     65536
+#define BENCH_SCAN_NS       20000000    /* per kernel, implementation and size */
+#define BENCH_SCAN_MAX      (1 << 20)
+#define BENCH_MAX_CLIENTS   128
+#define BENCH_CSV_HEADER    "version,test,msg_size,rate,msgs,bytes,secs,mb_s,p50_us,p99_us,p999_us,max_us," \
+                            "user_s,sys_s,syscalls,syscalls_per_mb,ctxsw,cpu_ms_per_port,status\n"
+
+struct bench_result {
+    unsigned long long msgs;
+    unsigned long long bytes;
+    double secs;
+    struct stats_hist lat;
+    double utime;
+    double stime;
+    unsigned long long syscalls;
+    long ctxsw;
+    unsigned long long rx_reads;
+    unsigned long long rx_wakeups;
+};
+
+struct bench_case {
+    const char *name;
+    int (*run)(const struct bench_case *bc, struct bench_result *res);
+    size_t size;                        /* message size */
+    long rate;                          /* messages per second, 0 flat out */
+    int clients;                        /* fanout: socket readers, multi: ports */
+    const char *variant;                /* extra usbserial option, without the -- */
+};
+
+/* reads fixed size stamped messages back and records their latency */
+struct bench_sink {
+    int fd;
+    size_t size;
+    int stop;
+    unsigned long long got;
+    uint64_t last_ns;
+    struct stats_hist *lat;             /* NULL: count bytes only */
+    struct shmring *ring;               /* bench_shm: read this instead of fd */
+    size_t have;
+    char *msg;
+};
+
+static const char *bench_bin = "./usbserial";
+static double bench_secs = 1.0;
+
+static int bench_ring(const struct bench_case *bc, struct bench_result *res);
+static int bench_rx(const struct bench_case *bc, struct bench_result *res);
+static int bench_rxpath(const struct bench_case *bc, struct bench_result *res);
+static int bench_tx(const struct bench_case *bc, struct bench_result *res);
+static int bench_fanout(const struct bench_case *bc, struct bench_result *res);
+static int bench_rtt(const struct bench_case *bc, struct bench_result *res);
+static int bench_shm(const struct bench_case *bc, struct bench_result *res);
+static int bench_multi(const struct bench_case *bc, struct bench_result *res);
+static int bench_sim(const struct bench_case *bc, struct bench_result *res);
+
+static const struct bench_case cases[] = {
+    { "ring",   bench_ring,     64,     0 },
+    { "ring",   bench_ring,     4096,   0 },
+    { "ring",   bench_ring,     64,     0,  0,  "byte" },
+    { "ring",   bench_ring,     4096,   0,  0,  "byte" },
+    { "rx",     bench_rx,       32,     1000 },
+    { "rx",     bench_rx,       32,     0 },
+    { "rx",     bench_rx,       1024,   0 },
+    { "rx",     bench_rx,       4096,   0 },
+    { "rxpath", bench_rxpath,   1024,   0,  0,  "byte" },
+    { "rxpath", bench_rxpath,   1024,   0,  0,  "block" },
+    { "sim",    bench_sim,      80,     10000 },
+    { "sim",    bench_sim,      80,     0 },
+    { "shm",    bench_shm,      32,     1000 },
+    { "shm",    bench_shm,      32,     0 },
+    { "shm",    bench_shm,      1024,   0 },
+    { "shm",    bench_shm,      4096,   0 },
+    { "tx",     bench_tx,       32,     1000 },
+    { "tx",     bench_tx,       200,    0 },
+    { "fanout", bench_fanout,   1024,   0,  1 },
+    { "fanout", bench_fanout,   1024,   0,  2 },
+    { "fanout", bench_fanout,   1024,   0,  4 },
+    { "fanout", bench_fanout,   1024,   0,  8 },
+    { "fanout", bench_fanout,   1024,   0,  16 },
+    { "multi",  bench_multi,    1024,   0,  1,  "io=epoll" },
+    { "multi",  bench_multi,    1024,   0,  2,  "io=epoll" },
+    { "multi",  bench_multi,    1024,   0,  4,  "io=epoll" },
+    { "multi",  bench_multi,    1024,   0,  8,  "io=epoll" },
+    { "multi",  bench_multi,    1024,   0,  16, "io=epoll" },
+    { "multi",  bench_multi,    1024,   0,  32, "io=epoll" },
+    { "multi",  bench_multi,    1024,   0,  64, "io=epoll" },
+    { "multi",  bench_multi,    1024,   0,  128, "io=epoll" },
+    { "multi",  bench_multi,    1024,   0,  1,  "io=uring" },
+    { "multi",  bench_multi,    1024,   0,  2,  "io=uring" },
+    { "multi",  bench_multi,    1024,   0,  4,  "io=uring" },
+    { "multi",  bench_multi,    1024,   0,  8,  "io=uring" },
+    { "multi",  bench_multi,    1024,   0,  16, "io=uring" },
+    { "multi",  bench_multi,    1024,   0,  32, "io=uring" },
+    { "multi",  bench_multi,    1024,   0,  64, "io=uring" },
+    { "multi",  bench_multi,    1024,   0,  128, "io=uring" },
+    { "rtt",    bench_rtt,      32,     1000, 0, NULL },
+    { "rtt",    bench_rtt,      32,     1000, 0, "low-latency" },
+};
+
+static void bench_stamp(char *msg, size_t size)
+{
+    char hex[17];
+
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)stats_now());
+    memcpy(msg, hex, 16);
+    msg[size - 1] = '\n';
+}
+
+static void bench_account(struct stats_hist *lat, const char *msg)
+{
+    char hex[17];
+
+    memcpy(hex, msg, 16);
+    hex[16] = '\0';
+    stats_hist_add(lat, stats_now() - strtoull(hex, NULL, 16));
+}
+
+static double bench_tv(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static int bench_write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* writes stamped messages to each of the n fds in turn for bench_secs,
+ * paced when rate is set; returns the messages per fd */
+static unsigned long long bench_generate_n(const int *fds, int n, size_t size, long rate)
+{
+    char *msg = malloc(size);
+    unsigned long long sent = 0;
+    uint64_t end = stats_now() + (uint64_t)(bench_secs * 1e9), next = stats_now();
+    struct timespec ts;
+    int i;
+
+    if (!msg) {
+        return 0;
+    }
+    memset(msg, 'x', size);
+    while (stats_now() < end) {
+        if (rate) {
+            ts.tv_sec = next / 1000000000ULL;
+            ts.tv_nsec = next % 1000000000ULL;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            next += 1000000000ULL / rate;
+        }
+        for (i = 0; i < n; i++) {
+            bench_stamp(msg, size);
+            if (bench_write_all(fds[i], msg, size) == -1) {
+                free(msg);
+                return sent;
+            }
+        }
+        sent++;
+    }
+    free(msg);
+    return sent;
+}
+
+static unsigned long long bench_generate(int fd, size_t size, long rate)
+{
+    return bench_generate_n(&fd, 1, size, rate);
+}
+
+/* splits n received bytes into messages, whole ones are stamped in place */
+static void bench_consume(struct bench_sink *s, const char *buf, size_t n)
+{
+    size_t i, take;
+
+    for (i = 0; i < n; i += take) {
+        if (!s->lat) {
+            take = n - i;
+            continue;
+        }
+        if (!s->have && n - i >= s->size) {
+            take = s->size;
+            bench_account(s->lat, buf + i);
+            continue;
+        }
+        take = s->size - s->have < n - i ? s->size - s->have : n - i;
+        memcpy(s->msg + s->have, buf + i, take);
+        s->have += take;
+        if (s->have == s->size) {
+            bench_account(s->lat, s->msg);
+            s->have = 0;
+        }
+    }
+    __atomic_store_n(&s->last_ns, stats_now(), __ATOMIC_RELAXED);
+    __atomic_store_n(&s->got, s->got + n, __ATOMIC_RELEASE);
+}
+
+static void *bench_sink_thread(void *p)
+{
+    struct bench_sink *s = p;
+    char *buf = malloc(BENCH_READ_SIZE);
+    struct pollfd pfd = { s->fd, POLLIN, 0 };
+    ssize_t n;
+
+    s->msg = malloc(s->size);
+    while (buf && s->msg && !__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE)) {
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        if ((n = read(s->fd, buf, BENCH_READ_SIZE)) <= 0) {
+            if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            break;
+        }
+        bench_consume(s, buf, n);
+    }
+    free(buf);
+    free(s->msg);
+    return NULL;
+}
+
+/* the same from the shared ring: no read(), spans are used in place */
+static void *bench_shm_thread(void *p)
+{
+    struct bench_sink *s = p;
+    const char *span;
+    size_t n;
+
+    s->msg = malloc(s->size);
+    while (s->msg && !__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE)) {
+        if (!(span = shmring_read_span(s->ring, &n))) {
+            if (shmring_wait(s->ring, 100) == -1) {
+                break;
+            }
+            continue;
+        }
+        bench_consume(s, span, n);
+        if (shmring_read_commit(s->ring, n) == -1) {
+            break;
+        }
+    }
+    free(s->msg);
+    return NULL;
+}
+
+/* waits until the sink has seen want bytes, gives up after BENCH_DRAIN_MS */
+static void bench_drain(struct bench_sink *s, unsigned long long want)
+{
+    uint64_t end = stats_now() + BENCH_DRAIN_MS * 1000000ULL;
+
+    while (__atomic_load_n(&s->got, __ATOMIC_ACQUIRE) < want && stats_now() < end) {
+        usleep(1000);
+    }
+}
+
+struct bench_ring_arg {
+    rbuf_t ring;
+    size_t size;
+    int bytes;                          /* rbuf_put/rbuf_get baseline */
+    int done;
+    unsigned long long msgs;
+    unsigned long long yields;
+    struct stats_hist *lat;
+};
+
+static void *bench_ring_consumer(void *p)
+{
+    struct bench_ring_arg *a = p;
+    char *msg = malloc(a->size);
+
+    while (msg) {
+        if (rbuf_len(&a->ring) < a->size) {
+            if (__atomic_load_n(&a->done, __ATOMIC_ACQUIRE) && rbuf_len(&a->ring) < a->size) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        if (a->bytes) {
+            size_t i;
+
+            for (i = 0; i < a->size; i++) {
+                rbuf_get(&a->ring, &msg[i]);
+            }
+        } else {
+            rbuf_read(&a->ring, msg, a->size);
+        }
+        bench_account(a->lat, msg);
+        a->msgs++;
+    }
+    free(msg);
+    return NULL;
+}
+
+/* the SPSC ring alone: one producer and one consumer thread, moving
+ * whole messages or, for the byte variant, a byte per call */
+static int bench_ring(const struct bench_case *bc, struct bench_result *res)
+{
+    struct bench_ring_arg a;
+    pthread_t consumer;
+    char *msg;
+    uint64_t start, end;
+    unsigned long long sent = 0;
+    struct rusage ru0, ru1;
+
+    memset(&a, 0, sizeof(a));
+    a.size = bc->size;
+    a.bytes = bc->variant && !strcmp(bc->variant, "byte");
+    a.lat = &res->lat;
+    if (rbuf_init(&a.ring, BENCH_RING_SIZE) == -1 || !(msg = malloc(bc->size))) {
+        return -1;
+    }
+    memset(msg, 'x', bc->size);
+    getrusage(RUSAGE_SELF, &ru0);
+    pthread_create(&consumer, NULL, bench_ring_consumer, &a);
+
+    start = stats_now();
+    end = start + (uint64_t)(bench_secs * 1e9);
+    while (stats_now() < end) {
+        if (rbuf_space(&a.ring) < bc->size) {
+            a.yields++;
+            sched_yield();
+            continue;
+        }
+        bench_stamp(msg, bc->size);
+        if (a.bytes) {
+            size_t i;
+
+            for (i = 0; i < bc->size; i++) {
+                rbuf_put(&a.ring, msg[i]);
+            }
+        } else {
+            rbuf_write(&a.ring, msg, bc->size);
+        }
+        sent++;
+    }
+    __atomic_store_n(&a.done, 1, __ATOMIC_RELEASE);
+    pthread_join(consumer, NULL);
+    getrusage(RUSAGE_SELF, &ru1);
+
+    res->secs = (stats_now() - start) / 1e9;
+    res->utime = bench_tv(&ru1.ru_utime) - bench_tv(&ru0.ru_utime);
+    res->stime = bench_tv(&ru1.ru_stime) - bench_tv(&ru0.ru_stime);
+    res->ctxsw = (ru1.ru_nvcsw + ru1.ru_nivcsw) - (ru0.ru_nvcsw + ru0.ru_nivcsw);
+    res->msgs = a.msgs;
+    res->bytes = a.msgs * bc->size;
+    res->syscalls = a.yields;
+    free(msg);
+    rbuf_free(&a.ring);
+    return sent == a.msgs ? 0 : -1;
+}
+
+static int bench_openpt(char *name, size_t len)
+{
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (fd == -1 || grantpt(fd) == -1 || unlockpt(fd) == -1 ||
+        ptsname_r(fd, name, len) != 0) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+struct bench_child {
+    pid_t pid;
+    int in;                             /* its stdin, -1 for /dev/null */
+    int out;
+    int err;
+    char stats[64];
+};
+
+/* waits for text on the child's stderr */
+static int bench_expect(struct bench_child *c, const char *text)
+{
+    char banner[4096];
+    size_t have = 0;
+    ssize_t n;
+    struct pollfd pfd;
+
+    pfd.fd = c->err;
+    pfd.events = POLLIN;
+    while (have < sizeof(banner) - 1 && poll(&pfd, 1, BENCH_DRAIN_MS) > 0) {
+        if ((n = read(c->err, banner + have, sizeof(banner) - 1 - have)) <= 0) {
+            break;
+        }
+        have += n;
+        banner[have] = '\0';
+        if (strstr(banner, text)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* runs usbserial on the pty slave with the extra args (NULL terminated)
+ * and waits for its banner */
+static int bench_spawn(struct bench_child *c, const char *tty, int with_stdin, const char **args)
+{
+    int in[2] = { -1, -1 }, out[2], err[2];
+    const char *argv[16] = { bench_bin, "-d", tty, "--stats-file", c->stats };
+    int i;
+
+    snprintf(c->stats, sizeof(c->stats), "/tmp/usbserial_bench.%d.json", (int)getpid());
+    for (i = 0; args[i] && i < 10; i++) {
+        argv[5 + i] = args[i];
+    }
+    if ((with_stdin && pipe(in) == -1) || pipe(out) == -1 || pipe(err) == -1) {
+        return -1;
+    }
+    if ((c->pid = fork()) == 0) {
+        int null = open("/dev/null", O_RDONLY);
+
+        dup2(with_stdin ? in[0] : null, 0);
+        dup2(out[1], 1);
+        dup2(err[1], 2);
+        execv(bench_bin, (char **)argv);
+        _exit(127);
+    }
+    if (with_stdin) {
+        close(in[0]);
+    }
+    close(out[1]);
+    close(err[1]);
+    c->in = in[1];
+    c->out = out[0];
+    c->err = err[0];
+
+    if (bench_expect(c, "to exit.") == 0) {
+        return 0;
+    }
+    fprintf(stderr, "bench: %s did not start\n", bench_bin);
+    kill(c->pid, SIGKILL);
+    waitpid(c->pid, NULL, 0);
+    return -1;
+}
+
+static unsigned long long bench_counter(const char *json, const char *name)
+{
+    char key[64];
+    const char *p;
+
+    snprintf(key, sizeof(key), "\"%s\": ", name);
+    p = strstr(json, key);
+    return p ? strtoull(p + strlen(key), NULL, 10) : 0;
+}
+
+/* stops the terminal, takes its CPU time and the hot path syscall count
+ * from its --stats-file: epoll waits, port reads/writes, stdout writes */
+static void bench_reap(struct bench_child *c, struct bench_result *res)
+{
+    struct rusage ru;
+    char json[8192];
+    ssize_t n = 0;
+    int fd, status;
+
+    kill(c->pid, SIGINT);
+    if (wait4(c->pid, &status, 0, &ru) == c->pid) {
+        res->utime = bench_tv(&ru.ru_utime);
+        res->stime = bench_tv(&ru.ru_stime);
+        res->ctxsw = ru.ru_nvcsw + ru.ru_nivcsw;
+    }
+    if ((fd = open(c->stats, O_RDONLY)) != -1) {
+        n = read(fd, json, sizeof(json) - 1);
+        close(fd);
+    }
+    json[n > 0 ? n : 0] = '\0';
+    res->rx_reads = bench_counter(json, "rx_reads");
+    res->rx_wakeups = bench_counter(json, "rx_wakeups");
+    res->syscalls = res->rx_wakeups + res->rx_reads +
+                    bench_counter(json, "out_writes") + bench_counter(json, "tx_writes");
+    unlink(c->stats);
+    if (c->in != -1) {
+        close(c->in);
+    }
+    close(c->out);
+    close(c->err);
+}
+
+struct bench_rxpath_arg {
+    int fd;
+    int bytes;                          /* the per-byte path */
+    rbuf_t ring;
+    struct bench_sink s;
+    unsigned long long syscalls;
+    struct rusage ru;
+};
+
+/* serial_port_read_rbuff before and after the block reads, in process:
+ * FIONREAD and a read() per byte, or one read() into the free span */
+static void *bench_rxpath_thread(void *p)
+{
+    struct bench_rxpath_arg *a = p;
+    struct pollfd pfd = { a->fd, POLLIN, 0 };
+    struct rusage ru0;
+    char *span, c;
+    size_t len;
+    ssize_t n;
+    int avail;
+
+    getrusage(RUSAGE_THREAD, &ru0);
+    a->s.msg = malloc(a->s.size);
+    while (a->s.msg && !__atomic_load_n(&a->s.stop, __ATOMIC_ACQUIRE)) {
+        a->syscalls++;
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        if (a->bytes) {
+            a->syscalls++;
+            if (ioctl(a->fd, FIONREAD, &avail) == -1) {
+                break;
+            }
+            for (; avail > 0 && !rbuf_is_full(&a->ring); avail--) {
+                a->syscalls++;
+                if (read(a->fd, &c, 1) != 1) {
+                    break;
+                }
+                rbuf_put(&a->ring, c);
+            }
+        } else if ((span = rbuf_write_span(&a->ring, &len)) != NULL) {
+            a->syscalls++;
+            if ((n = read(a->fd, span, len)) > 0) {
+                rbuf_write_commit(&a->ring, n);
+            }
+        }
+        while ((span = rbuf_read_span(&a->ring, &len)) != NULL) {
+            bench_consume(&a->s, span, len);
+            rbuf_read_commit(&a->ring, len);
+        }
+    }
+    getrusage(RUSAGE_THREAD, &a->ru);
+    a->ru.ru_utime.tv_sec -= ru0.ru_utime.tv_sec;
+    a->ru.ru_utime.tv_usec -= ru0.ru_utime.tv_usec;
+    a->ru.ru_stime.tv_sec -= ru0.ru_stime.tv_sec;
+    a->ru.ru_stime.tv_usec -= ru0.ru_stime.tv_usec;
+    a->ru.ru_nvcsw -= ru0.ru_nvcsw;
+    a->ru.ru_nivcsw -= ru0.ru_nivcsw;
+    free(a->s.msg);
+    return NULL;
+}
+
+/* the RX read step alone on a raw pty slave, syscalls counted as made */
+static int bench_rxpath(const struct bench_case *bc, struct bench_result *res)
+{
+    struct bench_rxpath_arg a;
+    struct termios tio;
+    pthread_t reader;
+    char tty[64];
+    int master = bench_openpt(tty, sizeof(tty));
+    uint64_t start;
+
+    memset(&a, 0, sizeof(a));
+    if (master == -1) {
+        return -1;
+    }
+    a.fd = open(tty, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (a.fd == -1 || tcgetattr(a.fd, &tio) == -1 || rbuf_init(&a.ring, BENCH_RING_SIZE) == -1) {
+        close(master);
+        if (a.fd != -1) {
+            close(a.fd);
+        }
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(a.fd, TCSANOW, &tio);
+    a.bytes = !strcmp(bc->variant, "byte");
+    a.s.size = bc->size;
+    a.s.lat = &res->lat;
+    pthread_create(&reader, NULL, bench_rxpath_thread, &a);
+
+    start = stats_now();
+    res->msgs = bench_generate(master, bc->size, bc->rate);
+    res->bytes = res->msgs * bc->size;
+    bench_drain(&a.s, res->bytes);
+    res->secs = (a.s.last_ns > start ? a.s.last_ns - start : 0) / 1e9;
+    __atomic_store_n(&a.s.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+
+    res->utime = bench_tv(&a.ru.ru_utime);
+    res->stime = bench_tv(&a.ru.ru_stime);
+    res->ctxsw = a.ru.ru_nvcsw + a.ru.ru_nivcsw;
+    res->syscalls = a.syscalls;
+    close(master);
+    close(a.fd);
+    rbuf_free(&a.ring);
+    return a.s.got == res->bytes ? 0 : -1;
+}
+
+/* port -> ring -> stdout: generator on the pty master, sink on stdout */
+static int bench_rx(const struct bench_case *bc, struct bench_result *res)
+{
+    const char *args[] = { "-n", NULL };
+    struct bench_child c;
+    struct bench_sink s;
+    pthread_t sink;
+    char tty[64];
+    int master = bench_openpt(tty, sizeof(tty));
+    uint64_t start;
+
+    if (master == -1 || bench_spawn(&c, tty, 0, args) == -1) {
+        return -1;
+    }
+    memset(&s, 0, sizeof(s));
+    s.fd = c.out;
+    s.size = bc->size;
+    s.lat = &res->lat;
+    pthread_create(&sink, NULL, bench_sink_thread, &s);
+
+    start = stats_now();
+    res->msgs = bench_generate(master, bc->size, bc->rate);
+    res->bytes = res->msgs * bc->size;
+    bench_drain(&s, res->bytes);
+    res->secs = (s.last_ns > start ? s.last_ns - start : 0) / 1e9;
+
+    bench_reap(&c, res);
+    __atomic_store_n(&s.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(sink, NULL);
+    close(master);
+    return s.got == res->bytes ? 0 : -1;
+}
+
+/* sim:// device -> ring -> stdout, no pty generator in this process: the
+ * same load on every machine; the device hangs up after its bytes, the
+ * lines carry no stamp so there is no latency */
+static int bench_sim(const struct bench_case *bc, struct bench_result *res)
+{
+    const char *args[] = { "-n", NULL };
+    unsigned long long bytes = bc->rate ? bc->rate * bc->size * bench_secs : 64000000ULL;
+    char spec[128];
+    struct bench_child c;
+    struct bench_sink s;
+    pthread_t sink;
+    uint64_t start;
+
+    snprintf(spec, sizeof(spec), "sim://rate=%lu,len=%lu,bytes=%llu",
+             (unsigned long)(bc->rate * bc->size), (unsigned long)bc->size, bytes);
+    memset(&s, 0, sizeof(s));
+    start = stats_now();
+    if (bench_spawn(&c, spec, 0, args) == -1) {
+        return -1;
+    }
+    s.fd = c.out;
+    s.size = bc->size;
+    pthread_create(&sink, NULL, bench_sink_thread, &s);
+
+    bench_drain(&s, bytes);
+    res->bytes = s.got;
+    res->msgs = s.got / bc->size;
+    res->secs = (s.last_ns > start ? s.last_ns - start : 0) / 1e9;
+
+    bench_reap(&c, res);
+    __atomic_store_n(&s.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(sink, NULL);
+    return s.got == bytes ? 0 : -1;
+}
+
+/* port -> shared memory ring -> reader: bench_rx without the stdout pipe */
+static int bench_shm(const struct bench_case *bc, struct bench_result *res)
+{
+    char name[64], spec[80], tty[64];
+    const char *args[] = { "--shm", spec, NULL };
+    struct bench_child c;
+    struct bench_sink s;
+    pthread_t sink;
+    int master = bench_openpt(tty, sizeof(tty));
+    uint64_t start;
+
+    snprintf(name, sizeof(name), "usbserial_bench.%d", (int)getpid());
+    snprintf(spec, sizeof(spec), "%s,%d", name, BENCH_RING_SIZE * 16);
+    if (master == -1 || bench_spawn(&c, tty, 0, args) == -1) {
+        return -1;
+    }
+    memset(&s, 0, sizeof(s));
+    s.size = bc->size;
+    s.lat = &res->lat;
+    if (!(s.ring = shmring_open(name))) {
+        fprintf(stderr, "bench: unable to map %s : %s\n", name, strerror(errno));
+        bench_reap(&c, res);
+        close(master);
+        return -1;
+    }
+    pthread_create(&sink, NULL, bench_shm_thread, &s);
+
+    start = stats_now();
+    res->msgs = bench_generate(master, bc->size, bc->rate);
+    res->bytes = res->msgs * bc->size;
+    bench_drain(&s, res->bytes);
+    res->secs = (s.last_ns > start ? s.last_ns - start : 0) / 1e9;
+
+    bench_reap(&c, res);
+    __atomic_store_n(&s.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(sink, NULL);
+    shmring_close(s.ring);
+    close(master);
+    return s.got == res->bytes ? 0 : -1;
+}
+
+/* stdin -> TX queue -> port: generator on stdin, sink on the pty master */
+static int bench_tx(const struct bench_case *bc, struct bench_result *res)
+{
+    const char *args[] = { "-n", NULL };
+    struct bench_child c;
+    struct bench_sink s;
+    pthread_t sink;
+    char tty[64];
+    int master = bench_openpt(tty, sizeof(tty));
+    uint64_t start;
+
+    if (master == -1 || bench_spawn(&c, tty, 1, args) == -1) {
+        return -1;
+    }
+    memset(&s, 0, sizeof(s));
+    s.fd = master;
+    s.size = bc->size;
+    s.lat = &res->lat;
+    pthread_create(&sink, NULL, bench_sink_thread, &s);
+
+    start = stats_now();
+    res->msgs = bench_generate(c.in, bc->size, bc->rate);
+    res->bytes = res->msgs * bc->size;
+    bench_drain(&s, res->bytes);
+    res->secs = (s.last_ns > start ? s.last_ns - start : 0) / 1e9;
+
+    __atomic_store_n(&s.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(sink, NULL);
+    bench_reap(&c, res);
+    close(master);
+    return s.got == res->bytes ? 0 : -1;
+}
+
+/* port -> shared ring -> N unix socket clients: what each extra client
+ * costs shows in the server's user_s/sys_s at the same byte count */
+static int bench_fanout(const struct bench_case *bc, struct bench_result *res)
+{
+    struct bench_child c;
+    struct bench_sink s[BENCH_MAX_CLIENTS];
+    struct stats_hist *lat = calloc(bc->clients, sizeof(*lat));
+    pthread_t sink[BENCH_MAX_CLIENTS];
+    struct sockaddr_un sun;
+    char tty[64], path[64], expect[32];
+    const char *args[] = { "--serve", path, NULL };
+    int master = bench_openpt(tty, sizeof(tty)), i, n = 0, ok = 0;
+    uint64_t start, last = 0;
+
+    snprintf(path, sizeof(path), "/tmp/usbserial_bench.%d.sock", (int)getpid());
+    if (master == -1 || !lat || bench_spawn(&c, tty, 0, args) == -1) {
+        free(lat);
+        return -1;
+    }
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+    memset(s, 0, sizeof(s));
+    for (n = 0; n < bc->clients; n++) {
+        s[n].fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        s[n].size = bc->size;
+        s[n].lat = &lat[n];
+        if (s[n].fd == -1 || connect(s[n].fd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+            break;
+        }
+        pthread_create(&sink[n], NULL, bench_sink_thread, &s[n]);
+    }
+    snprintf(expect, sizeof(expect), " %d client(s)", bc->clients);
+    if (n == bc->clients && bench_expect(&c, expect) == 0) {
+        start = stats_now();
+        res->msgs = bench_generate(master, bc->size, bc->rate);
+        res->bytes = res->msgs * bc->size;
+        for (i = 0, ok = 1; i < n; i++) {
+            bench_drain(&s[i], res->bytes);
+            ok &= s[i].got == res->bytes;
+            last = s[i].last_ns > last ? s[i].last_ns : last;
+        }
+        res->secs = (last > start ? last - start : 0) / 1e9;
+        /* the slowest client's view: the one served last */
+        res->lat = lat[n - 1];
+    }
+
+    bench_reap(&c, res);
+    for (i = 0; i < n; i++) {
+        __atomic_store_n(&s[i].stop, 1, __ATOMIC_RELEASE);
+        pthread_join(sink[i], NULL);
+    }
+    for (i = 0; i <= n && i < bc->clients; i++) {
+        if (s[i].fd != -1) {
+            close(s[i].fd);
+        }
+    }
+    close(master);
+    free(lat);
+    return ok ? 0 : -1;
+}
+
+/* -M over several ptys into per-port FIFOs made by -O: the epoll loop
+ * makes a wakeup, a read() and a write() per chunk, io_uring one enter per
+ * batch; syscalls is counted that way for each */
+static int bench_multi(const struct bench_case *bc, struct bench_result *res)
+{
+    char dir[64], list[BENCH_MAX_CLIENTS * 64] = "", tty[64], path[128], variant[32];
+    const char *args[] = { "-M", list, "-O", dir, variant, NULL };
+    struct bench_child c;
+    struct bench_sink s[BENCH_MAX_CLIENTS];
+    struct stats_hist *lat = calloc(bc->clients, sizeof(*lat));
+    pthread_t sink[BENCH_MAX_CLIENTS];
+    int master[BENCH_MAX_CLIENTS], i, n, ok = 0;
+    uint64_t start, last = 0;
+
+    snprintf(dir, sizeof(dir), "/tmp/usbserial_bench.%d.d", (int)getpid());
+    snprintf(variant, sizeof(variant), "--%s", bc->variant);
+    memset(s, 0, sizeof(s));
+    if (!lat || mkdir(dir, 0700) == -1) {
+        free(lat);
+        return -1;
+    }
+    for (n = 0; n < bc->clients; n++) {
+        if ((master[n] = bench_openpt(tty, sizeof(tty))) == -1) {
+            break;
+        }
+        snprintf(path, sizeof(path), "%s/%s.log", dir, strrchr(tty, '/') + 1);
+        snprintf(list + strlen(list), sizeof(list) - strlen(list), "%s%s", n ? "," : "", tty);
+        s[n].size = bc->size;
+        s[n].lat = &lat[n];
+        /* the read ends first, so usbserial's open for writing won't block */
+        if (mkfifo(path, 0600) == -1 || (s[n].fd = open(path, O_RDONLY | O_NONBLOCK)) == -1) {
+            close(master[n]);
+            break;
+        }
+    }
+    if (n == bc->clients && bench_spawn(&c, tty, 0, args) == 0) {
+        for (i = 0; i < n; i++) {
+            pthread_create(&sink[i], NULL, bench_sink_thread, &s[i]);
+        }
+        start = stats_now();
+        res->msgs = bench_generate_n(master, n, bc->size, bc->rate) * n;
+        res->bytes = res->msgs * bc->size;
+        for (i = 0, ok = 1; i < n; i++) {
+            bench_drain(&s[i], res->bytes / n);
+            ok &= s[i].got == res->bytes / n;
+            last = s[i].last_ns > last ? s[i].last_ns : last;
+        }
+        res->secs = (last > start ? last - start : 0) / 1e9;
+        res->lat = lat[n - 1];
+
+        bench_reap(&c, res);
+        res->syscalls = strstr(bc->variant, "uring") ? res->rx_wakeups :
+                        res->rx_wakeups + 2 * res->rx_reads;
+        for (i = 0; i < n; i++) {
+            __atomic_store_n(&s[i].stop, 1, __ATOMIC_RELEASE);
+            pthread_join(sink[i], NULL);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        close(master[i]);
+        close(s[i].fd);
+    }
+    snprintf(path, sizeof(path), "rm -rf %s", dir);
+    if (system(path) != 0) {
+        fprintf(stderr, "bench: unable to remove %s\n", dir);
+    }
+    free(lat);
+    return ok ? 0 : -1;
+}
+
+/* the device side of bench_rtt: sends every byte straight back */
+static void *bench_echo_thread(void *p)
+{
+    struct bench_sink *s = p;
+    struct pollfd pfd = { s->fd, POLLIN, 0 };
+    char buf[4096];
+    ssize_t n;
+
+    while (!__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE)) {
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        if ((n = read(s->fd, buf, sizeof(buf))) <= 0 || bench_write_all(s->fd, buf, n) == -1) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* request/response: stdin -> TX -> pty echo -> RX -> stdout, the sink's
+ * latency is the whole round trip */
+static int bench_rtt(const struct bench_case *bc, struct bench_result *res)
+{
+    char variant[32], tty[64];
+    const char *args[] = { "-n", bc->variant ? variant : NULL, NULL };
+    struct bench_child c;
+    struct bench_sink s, echo;
+    pthread_t sink, echoer;
+    int master = bench_openpt(tty, sizeof(tty));
+    uint64_t start;
+
+    snprintf(variant, sizeof(variant), "--%s", bc->variant ? bc->variant : "");
+    if (master == -1 || bench_spawn(&c, tty, 1, args) == -1) {
+        return -1;
+    }
+    memset(&echo, 0, sizeof(echo));
+    echo.fd = master;
+    pthread_create(&echoer, NULL, bench_echo_thread, &echo);
+    memset(&s, 0, sizeof(s));
+    s.fd = c.out;
+    s.size = bc->size;
+    s.lat = &res->lat;
+    pthread_create(&sink, NULL, bench_sink_thread, &s);
+
+    start = stats_now();
+    res->msgs = bench_generate(c.in, bc->size, bc->rate);
+    res->bytes = res->msgs * bc->size;
+    bench_drain(&s, res->bytes);
+    res->secs = (s.last_ns > start ? s.last_ns - start : 0) / 1e9;
+
+    __atomic_store_n(&s.stop, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&echo.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(sink, NULL);
+    pthread_join(echoer, NULL);
+    bench_reap(&c, res);
+    close(master);
+    return s.got == res->bytes ? 0 : -1;
+}
+
+static void bench_row(FILE *f, const struct bench_case *bc, struct bench_result *r, int ok)
+{
+    double mb = r->bytes / 1e6;
+    double cpu_ms = (r->utime + r->stime) * 1e3 / (bc->clients ? bc->clients : 1);
+    char name[32], *p;
+
+    if (bc->clients && bc->variant) {
+        snprintf(name, sizeof(name), "%s_%d_%s", bc->name, bc->clients, bc->variant);
+    } else if (bc->clients) {
+        snprintf(name, sizeof(name), "%s_%d", bc->name, bc->clients);
+    } else if (bc->variant) {
+        snprintf(name, sizeof(name), "%s_%s", bc->name, bc->variant);
+    } else {
+        snprintf(name, sizeof(name), "%s", bc->name);
+    }
+    /* io=uring -> io_uring */
+    while ((p = strchr(name, '=')) != NULL) {
+        *p = '_';
+    }
+    fprintf(f, "%s,%s,%lu,%ld,%llu,%llu,%.3f,%.2f,%.1f,%.1f,%.1f,%.1f,%.3f,%.3f,%llu,%.1f,%ld,%.2f,%s\n",
+            VERSION, name, (unsigned long)bc->size, bc->rate, r->msgs, r->bytes, r->secs,
+            r->secs > 0 ? mb / r->secs : 0.0,
+            stats_hist_pct(&r->lat, 0.5) / 1e3, stats_hist_pct(&r->lat, 0.99) / 1e3,
+            stats_hist_pct(&r->lat, 0.999) / 1e3, r->lat.max / 1e3,
+            r->utime, r->stime, r->syscalls, mb > 0 ? r->syscalls / mb : 0.0, r->ctxsw, cpu_ms,
+            ok ? "ok" : "short");
+}
+
+static const char *scan_kernels[] = { "find", "count", "find_set", "crc32c", "crc16" };
+static const size_t scan_sizes[] = { 64, 1024, 4096, 65536, BENCH_SCAN_MAX };
+
+static size_t bench_kernel(const struct scan_impl *s, int k, const char *buf, size_t len)
+{
+    switch (k) {
+    case 0:
+        return s->find(buf, len, '\n');
+    case 1:
+        return s->count(buf, len, '\n');
+    case 2:
+        return s->find_set(buf, len, "\xC0\xDB", 2);
+    case 3:
+        return s->crc32c(0, buf, len);
+    }
+    return s->crc16(0xFFFF, buf, len);
+}
+
+/* every scan kernel of every implementation the CPU runs, over buffers
+ * without a match so the whole buffer is inspected */
+static void bench_scan(FILE *f)
+{
+    struct bench_result *r = calloc(1, sizeof(*r));
+    char *buf = malloc(BENCH_SCAN_MAX), name[64];
+    volatile size_t sink = 0;
+    const struct scan_impl *s;
+    struct bench_case bc;
+    size_t i, z;
+    uint64_t start;
+    int k;
+
+    if (!r || !buf) {
+        free(r);
+        free(buf);
+        return;
+    }
+    for (z = 0; z < BENCH_SCAN_MAX; z++) {
+        buf[z] = 'a' + z % 26;
+    }
+    for (i = 0; (s = scan_impl_at(i)) != NULL; i++) {
+        if (!s->supported()) {
+            continue;
+        }
+        for (k = 0; k < (int)(sizeof(scan_kernels) / sizeof(scan_kernels[0])); k++) {
+            for (z = 0; z < sizeof(scan_sizes) / sizeof(scan_sizes[0]); z++) {
+                memset(r, 0, sizeof(*r));
+                start = stats_now();
+                do {
+                    sink += bench_kernel(s, k, buf, scan_sizes[z]);
+                    r->msgs++;
+                } while (stats_now() - start < BENCH_SCAN_NS);
+                r->secs = (stats_now() - start) / 1e9;
+                r->bytes = r->msgs * scan_sizes[z];
+
+                snprintf(name, sizeof(name), "scan_%s_%s", scan_kernels[k], s->name);
+                bc.name = name;
+                bc.size = scan_sizes[z];
+                bc.rate = 0;
+                bench_row(f, &bc, r, 1);
+                bench_row(stdout, &bc, r, 1);
+            }
+        }
+    }
+    free(buf);
+    free(r);
+}
+
+int main(int argc, char **argv)
+{
+    const char *csv = "bench.csv", *only = NULL;
+    struct bench_result *r;
+    FILE *f;
+    size_t i;
+    int opt, fails = 0, fresh;
+
+    while ((opt = getopt(argc, argv, "u:o:s:t:")) != -1) {
+        switch (opt) {
+        case 'u':
+            bench_bin = optarg;
+            break;
+        case 'o':
+            csv = optarg;
+            break;
+        case 's':
+            bench_secs = atof(optarg);
+            break;
+        case 't':
+            only = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-u usbserial] [-o csv] [-s sec] per case [-t ring|rx|rxpath|sim|shm|tx|fanout|multi|rtt|scan] only\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    scan_init();
+    fresh = access(csv, F_OK) != 0;
+    if (!(f = fopen(csv, "a")) || !(r = malloc(sizeof(*r)))) {
+        fprintf(stderr, "Unable to open %s : %s\n", csv, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (fresh) {
+        fputs(BENCH_CSV_HEADER, f);
+    }
+    fputs(BENCH_CSV_HEADER, stdout);
+
+    /* results are appended, one row per case and run */
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        int ok;
+
+        if (only && strcmp(only, cases[i].name)) {
+            continue;
+        }
+        if (cases[i].size < BENCH_MIN_SIZE) {
+            continue;
+        }
+        memset(r, 0, sizeof(*r));
+        ok = cases[i].run(&cases[i], r) == 0;
+        fails += !ok;
+        bench_row(f, &cases[i], r, ok);
+        bench_row(stdout, &cases[i], r, ok);
+        fflush(stdout);
+    }
+    if (!only || !strcmp(only, "scan")) {
+        bench_scan(f);
+    }
+
+    fclose(f);
+    free(r);
+    return fails ? EXIT_FAILURE : 0;
+}
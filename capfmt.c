@@ -0,0 +1,271 @@
+/*  capfmt.c - timestamped capture file reader and text export.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "usbserial_linux.h"
+#include "usbserial.h"
+#include "capfmt.h"
+
+#define DUMP_BUF_SIZE   65536
+
+uint64_t capfmt_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int capfmt_pread(int fd, void *buf, size_t len, uint64_t off)
+{
+    return pread(fd, buf, len, off) == (ssize_t)len ? 0 : -1;
+}
+
+/* no trailer (the writer never closed the file): gather the inline
+ * INDX blocks, stepping over DATA payloads by their headers alone */
+static void capfmt_scan_index(struct capfmt_reader *r, uint64_t size)
+{
+    struct capfmt_rec rec;
+    struct capfmt_ent *p;
+    uint64_t pos = sizeof(r->hdr);
+    size_t n, room = 0;
+
+    while (pos + sizeof(rec) <= size &&
+           capfmt_pread(r->fd, &rec, sizeof(rec), pos) == 0 &&
+           pos + sizeof(rec) + rec.len <= size) {
+        n = rec.len / sizeof(struct capfmt_ent);
+        if (rec.type == CAPFMT_INDX && n) {
+            if (r->nindex + n > room) {
+                room = (r->nindex + n) * 2;
+                p = realloc(r->index, room * sizeof(*p));
+                if (!p) {
+                    break;
+                }
+                r->index = p;
+            }
+            if (capfmt_pread(r->fd, r->index + r->nindex, n * sizeof(*p), pos + sizeof(rec)) == -1) {
+                break;
+            }
+            /* a closing index whose trailer got cut off repeats them all */
+            if (r->nindex && r->index[r->nindex].ts_ns < r->index[r->nindex - 1].ts_ns) {
+                memmove(r->index, r->index + r->nindex, n * sizeof(*p));
+                r->nindex = 0;
+            }
+            r->nindex += n;
+        }
+        pos += sizeof(rec) + rec.len;
+    }
+}
+
+/* loads the closing index if the file was closed cleanly, else the
+ * inline blocks */
+static void capfmt_load_index(struct capfmt_reader *r, uint64_t size)
+{
+    struct capfmt_trailer tr;
+    struct capfmt_rec rec;
+
+    if (size < sizeof(r->hdr) + sizeof(tr) ||
+        capfmt_pread(r->fd, &tr, sizeof(tr), size - sizeof(tr)) == -1 ||
+        memcmp(tr.magic, CAPFMT_TRAILER, sizeof(tr.magic)) ||
+        capfmt_pread(r->fd, &rec, sizeof(rec), tr.index_offset) == -1 ||
+        rec.type != CAPFMT_INDX) {
+        capfmt_scan_index(r, size);
+        return;
+    }
+
+    r->index = malloc(rec.len ? rec.len : 1);
+    if (!r->index || capfmt_pread(r->fd, r->index, rec.len, tr.index_offset + sizeof(rec)) == -1) {
+        free(r->index);
+        r->index = NULL;
+        return;
+    }
+    r->nindex = rec.len / sizeof(struct capfmt_ent);
+    r->end = tr.index_offset;
+}
+
+int capfmt_open(struct capfmt_reader *r, const char *path)
+{
+    struct stat st;
+
+    memset(r, 0, sizeof(*r));
+    r->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (r->fd == -1) {
+        return -1;
+    }
+    if (fstat(r->fd, &st) == -1 ||
+        capfmt_pread(r->fd, &r->hdr, sizeof(r->hdr), 0) == -1 ||
+        memcmp(r->hdr.magic, CAPFMT_MAGIC, sizeof(r->hdr.magic))) {
+        close(r->fd);
+        errno = EINVAL;
+        return -1;
+    }
+    r->pos = sizeof(r->hdr);
+    r->end = st.st_size;
+    capfmt_load_index(r, st.st_size);
+    return 0;
+}
+
+/* binary search the index for the last sample at or before ts_ns */
+int capfmt_seek(struct capfmt_reader *r, uint64_t ts_ns)
+{
+    size_t lo = 0, hi = r->nindex;
+
+    r->pos = sizeof(r->hdr);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (r->index[mid].ts_ns <= ts_ns) {
+            r->pos = r->index[mid].offset;
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return 0;
+}
+
+/* next DATA record, payload in *buf (grown as needed); 0 at the end */
+int capfmt_next(struct capfmt_reader *r, struct capfmt_rec *rec, char **buf, size_t *bufsize)
+{
+    while (r->pos + sizeof(*rec) <= r->end) {
+        if (capfmt_pread(r->fd, rec, sizeof(*rec), r->pos) == -1 ||
+            r->pos + sizeof(*rec) + rec->len > r->end) {
+            return 0;   /* truncated tail */
+        }
+        r->pos += sizeof(*rec);
+
+        if (rec->type != CAPFMT_DATA) {
+            r->pos += rec->len;
+            continue;
+        }
+        if (rec->len > *bufsize) {
+            char *p = realloc(*buf, rec->len);
+
+            if (!p) {
+                return -1;
+            }
+            *buf = p;
+            *bufsize = rec->len;
+        }
+        if (capfmt_pread(r->fd, *buf, rec->len, r->pos) == -1) {
+            return -1;
+        }
+        r->pos += rec->len;
+        return 1;
+    }
+    return 0;
+}
+
+void capfmt_close(struct capfmt_reader *r)
+{
+    free(r->index);
+    r->index = NULL;
+    close(r->fd);
+}
+
+/* exports the records between from and to (seconds since the capture
+ * started, to < 0 for no limit) as text, each line prefixed with the
+ * time of the chunk it arrived in */
+int capfmt_dump(const char *path, double from, double to, int out_fd)
+{
+    struct capfmt_reader r;
+    struct capfmt_rec rec;
+    char *buf = NULL, *out, prefix[48];
+    size_t bufsize = 0, fill = 0;
+    uint64_t from_ns, to_ns;
+    int res, line_start = 1, plen = 0;
+    const char *p, *end, *nl;
+
+    if (capfmt_open(&r, path) == -1) {
+        return -1;
+    }
+    from_ns = r.hdr.start_ns + (uint64_t)(from * 1e9);
+    to_ns = (to < 0) ? UINT64_MAX : r.hdr.start_ns + (uint64_t)(to * 1e9);
+    capfmt_seek(&r, from_ns);
+
+    if (!(out = malloc(DUMP_BUF_SIZE))) {
+        capfmt_close(&r);
+        return -1;
+    }
+
+    while ((res = capfmt_next(&r, &rec, &buf, &bufsize)) > 0) {
+        if (rec.ts_ns < from_ns) {
+            continue;
+        }
+        if (rec.ts_ns > to_ns) {
+            break;
+        }
+
+        if (rec.port) {
+            plen = snprintf(prefix, sizeof(prefix), "[%12.6f #%u] ",
+                            (rec.ts_ns - r.hdr.start_ns) / 1e9, rec.port);
+        } else {
+            plen = snprintf(prefix, sizeof(prefix), "[%12.6f] ",
+                            (rec.ts_ns - r.hdr.start_ns) / 1e9);
+        }
+
+        for (p = buf, end = buf + rec.len; p < end; p = nl ? nl + 1 : end) {
+            size_t len;
+
+            nl = memchr(p, '\n', end - p);
+            len = nl ? (size_t)(nl + 1 - p) : (size_t)(end - p);
+
+            if (fill + plen + len > DUMP_BUF_SIZE) {
+                if (serial_write_out(out_fd, out, fill) == -1) {
+                    res = -1;
+                    goto done;
+                }
+                fill = 0;
+            }
+            if (line_start) {
+                memcpy(out + fill, prefix, plen);
+                fill += plen;
+            }
+            if (len > DUMP_BUF_SIZE - fill) {
+                /* longer than the staging buffer, write it through */
+                if (serial_write_out(out_fd, out, fill) == -1 ||
+                    serial_write_out(out_fd, p, len) == -1) {
+                    res = -1;
+                    goto done;
+                }
+                fill = 0;
+            } else {
+                memcpy(out + fill, p, len);
+                fill += len;
+            }
+            line_start = (nl != NULL);
+        }
+    }
+
+    if (res >= 0 && serial_write_out(out_fd, out, fill) == -1) {
+        res = -1;
+    }
+done:
+    free(out);
+    free(buf);
+    capfmt_close(&r);
+    return res < 0 ? -1 : 0;
+}
@@ -0,0 +1,71 @@
+#ifndef _CAPFMT_H
+#define _CAPFMT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Timestamped capture file, host byte order:
+ *
+ *   capfmt_hdr
+ *   { capfmt_rec DATA + payload | capfmt_rec INDX + capfmt_ent[] } ...
+ *   capfmt_rec INDX + capfmt_ent[]     full index, written on close
+ *   capfmt_trailer                     points at the full index
+ *
+ * DATA records carry one read() worth of bytes stamped with
+ * CLOCK_MONOTONIC_RAW right after the read returned. Every
+ * CAPFMT_INDEX_STEP bytes the writer samples an index entry; each
+ * CAPFMT_INDEX_BLOCK samples are also written inline as an INDX record
+ * so a file that was never closed still has a sparse index. */
+
+#define CAPFMT_MAGIC        "USBCAP\0\1"
+#define CAPFMT_TRAILER      "USBCIDX\0"
+#define CAPFMT_VERSION      1
+#define CAPFMT_DATA         0x41544144  /* "DATA" */
+#define CAPFMT_INDX         0x58444e49  /* "INDX" */
+#define CAPFMT_INDEX_STEP   (64 * 1024)
+#define CAPFMT_INDEX_BLOCK  256
+
+struct capfmt_hdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t start_ns;
+};
+
+struct capfmt_rec {
+    uint32_t type;
+    uint32_t len;
+    uint64_t ts_ns;
+    uint16_t port;
+    uint16_t flags;
+    uint32_t reserved;
+};
+
+struct capfmt_ent {
+    uint64_t ts_ns;
+    uint64_t offset;
+};
+
+struct capfmt_trailer {
+    uint64_t index_offset;
+    char magic[8];
+};
+
+/* sequential reader, starts at the first record at or before from_ns */
+struct capfmt_reader {
+    int fd;
+    struct capfmt_hdr hdr;
+    uint64_t pos;
+    uint64_t end;               /* offset of the closing index, or file size */
+    struct capfmt_ent *index;
+    size_t nindex;
+};
+
+uint64_t capfmt_now(void);
+int capfmt_open(struct capfmt_reader *r, const char *path);
+int capfmt_seek(struct capfmt_reader *r, uint64_t ts_ns);
+int capfmt_next(struct capfmt_reader *r, struct capfmt_rec *rec, char **buf, size_t *bufsize);
+void capfmt_close(struct capfmt_reader *r);
+int capfmt_dump(const char *path, double from, double to, int out_fd);
+
+#endif
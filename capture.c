@@ -0,0 +1,624 @@
+/*  capture.c - record a serial port straight to a (rotating) file.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "usbserial_linux.h"
+#include "usbserial.h"
+#include "evloop.h"
+#include "capture.h"
+
+#define CAPTURE_SPLICE_LEN  (1 << 16)
+#define CAPTURE_MIN_READ    4096
+
+static int capture_put(struct capture *c, const void *buf, size_t len);
+static int capture_account(struct capture *c, size_t n);
+
+static int capture_open_file(struct capture *c)
+{
+    /* every file starts empty: a record file is only valid from its own
+     * header on and O_DIRECT needs the offset aligned (no O_APPEND either,
+     * splice() refuses append-mode targets) */
+    int oflags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    if (c->flags & CAPTURE_DIRECT) {
+        oflags |= O_DIRECT;
+    }
+    c->fd = open(c->path, oflags, 0644);
+    if (c->fd == -1 && (c->flags & CAPTURE_DIRECT) && errno == EINVAL) {
+        /* filesystem without O_DIRECT, keep the aligned batching */
+        c->flags &= ~CAPTURE_DIRECT;
+        c->fd = open(c->path, oflags & ~O_DIRECT, 0644);
+    }
+    c->opened = time(NULL);
+    c->written = 0;
+    c->offset = 0;
+    c->tail = 0;
+
+    if (c->fd != -1 && (c->flags & CAPTURE_RECORDS)) {
+        struct capfmt_hdr hdr;
+
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, CAPFMT_MAGIC, sizeof(hdr.magic));
+        hdr.version = CAPFMT_VERSION;
+        hdr.start_ns = capfmt_now();
+        c->nindex = c->nflushed = 0;
+        c->next_index = 0;
+        capture_put(c, &hdr, sizeof(hdr));
+    }
+    return c->fd;
+}
+
+/* highest N of an existing path.N, so rotation doesn't overwrite an earlier run */
+static int capture_last_seq(const char *path)
+{
+    const char *base = strrchr(path, '/');
+    char dir[PATH_MAX];
+    struct dirent *de;
+    size_t blen;
+    DIR *d;
+    int seq = 0;
+
+    if (base) {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(base - path), path);
+        base++;
+    } else {
+        strcpy(dir, ".");
+        base = path;
+    }
+    if (!(d = opendir(*dir ? dir : "/"))) {
+        return 0;
+    }
+    blen = strlen(base);
+    while ((de = readdir(d)) != NULL) {
+        const char *p = de->d_name + blen;
+        char *end;
+        long n;
+
+        if (strncmp(de->d_name, base, blen) || *p != '.' || p[1] < '0' || p[1] > '9') {
+            continue;
+        }
+        n = strtol(p + 1, &end, 10);
+        if (!*end && n > seq && n < INT_MAX) {
+            seq = (int)n;
+        }
+    }
+    closedir(d);
+    return seq;
+}
+
+int capture_open(struct capture *c, const char *path, int flags,
+                 unsigned long long rotate_size, long rotate_secs)
+{
+    memset(c, 0, sizeof(*c));
+    c->path = path;
+    c->flags = flags;
+    c->rotate_size = rotate_size;
+    c->rotate_secs = rotate_secs;
+    c->pipefd[0] = c->pipefd[1] = -1;
+    if (rotate_size || rotate_secs) {
+        c->seq = capture_last_seq(path);
+    }
+
+    if (posix_memalign((void **)&c->buf, CAPTURE_ALIGN, CAPTURE_BUF_SIZE) != 0) {
+        return -1;
+    }
+    /* O_DIRECT needs aligned user buffers, records need their headers,
+     * splice would bypass both */
+    if (!(flags & (CAPTURE_DIRECT | CAPTURE_RECORDS)) &&
+        pipe2(c->pipefd, O_NONBLOCK | O_CLOEXEC) == -1) {
+        c->pipefd[0] = c->pipefd[1] = -1;
+    }
+    return capture_open_file(c);
+}
+
+static void capture_drop_direct(struct capture *c)
+{
+    if (c->flags & CAPTURE_DIRECT) {
+        fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) & ~O_DIRECT);
+    }
+}
+
+/* writes out the buffer; unless all, only whole aligned blocks in direct mode */
+int capture_flush(struct capture *c, int all)
+{
+    size_t len = c->fill;
+
+    if ((c->flags & CAPTURE_DIRECT) && !all) {
+        len &= ~(size_t)(CAPTURE_ALIGN - 1);
+    } else if (all) {
+        capture_drop_direct(c);
+    }
+    if (!len) {
+        return 0;
+    }
+
+    if (c->z) {
+        /* the thread writes and syncs the frames */
+        if (capz_write(c->z, c->buf, len) == -1) {
+            return -1;
+        }
+    } else if (serial_write_out(c->fd, c->buf, len) == -1) {
+        return -1;
+    } else if (c->flags & CAPTURE_SYNC) {
+        fdatasync(c->fd);
+    }
+    memmove(c->buf, c->buf + len, c->fill - len);
+    c->fill -= len;
+    c->tail = 0;
+    return 0;
+}
+
+/* direct mode holds a partial block back for the next aligned write; put
+ * it in the file through the page cache at the offset that write will
+ * cover, so a quiet port doesn't keep it only in memory */
+static int capture_flush_tail(struct capture *c)
+{
+    int fl = fcntl(c->fd, F_GETFL);
+    off_t pos = lseek(c->fd, 0, SEEK_CUR);
+    size_t done = 0;
+    ssize_t n;
+
+    if (fl == -1 || pos == -1 || fcntl(c->fd, F_SETFL, fl & ~O_DIRECT) == -1) {
+        return -1;
+    }
+    while (done < c->fill) {
+        n = pwrite(c->fd, c->buf + done, c->fill - done, pos + done);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    fcntl(c->fd, F_SETFL, fl);
+    if (done < c->fill) {
+        return -1;
+    }
+    if (c->flags & CAPTURE_SYNC) {
+        fdatasync(c->fd);
+    }
+    c->tail = c->fill;
+    return 0;
+}
+
+/* copies into the block buffer, flushing whole blocks as it fills */
+static int capture_put(struct capture *c, const void *buf, size_t len)
+{
+    const char *p = buf;
+    size_t room;
+
+    while (len) {
+        room = CAPTURE_BUF_SIZE - c->fill;
+        if (room > len) {
+            room = len;
+        }
+        memcpy(c->buf + c->fill, p, room);
+        c->fill += room;
+        c->offset += room;
+        p += room;
+        len -= room;
+        if (c->fill == CAPTURE_BUF_SIZE && capture_flush(c, 0) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int capture_put_index(struct capture *c, const struct capfmt_ent *ent, size_t n)
+{
+    struct capfmt_rec rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = CAPFMT_INDX;
+    rec.len = n * sizeof(*ent);
+    rec.ts_ns = capfmt_now();
+    if (capture_put(c, &rec, sizeof(rec)) == -1) {
+        return -1;
+    }
+    return capture_put(c, ent, rec.len);
+}
+
+/* samples (ts, offset) of a DATA record every CAPFMT_INDEX_STEP bytes */
+static int capture_index(struct capture *c, uint64_t ts_ns, uint64_t offset)
+{
+    if (offset < c->next_index) {
+        return 0;
+    }
+    c->next_index = offset + CAPFMT_INDEX_STEP;
+
+    if (c->nindex == c->maxindex) {
+        size_t max = c->maxindex ? c->maxindex * 2 : CAPFMT_INDEX_BLOCK;
+        struct capfmt_ent *index = realloc(c->index, max * sizeof(*index));
+
+        if (!index) {
+            return -1;
+        }
+        c->index = index;
+        c->maxindex = max;
+    }
+    c->index[c->nindex].ts_ns = ts_ns;
+    c->index[c->nindex++].offset = offset;
+
+    if (c->nindex - c->nflushed == CAPFMT_INDEX_BLOCK) {
+        size_t from = c->nflushed;
+
+        c->nflushed = c->nindex;
+        return capture_put_index(c, &c->index[from], CAPFMT_INDEX_BLOCK);
+    }
+    return 0;
+}
+
+/* closing full index and trailer of a record file */
+static int capture_finish_file(struct capture *c)
+{
+    struct capfmt_trailer tr;
+
+    if (!(c->flags & CAPTURE_RECORDS)) {
+        return 0;
+    }
+    memset(&tr, 0, sizeof(tr));
+    tr.index_offset = c->offset;
+    memcpy(tr.magic, CAPFMT_TRAILER, sizeof(tr.magic));
+    if (capture_put_index(c, c->index, c->nindex) == -1) {
+        return -1;
+    }
+    return capture_put(c, &tr, sizeof(tr));
+}
+
+int capture_record(struct capture *c, unsigned int port, uint64_t ts_ns,
+                   const char *buf, size_t len)
+{
+    struct capfmt_rec rec;
+    uint64_t offset = c->offset;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = CAPFMT_DATA;
+    rec.len = len;
+    rec.ts_ns = ts_ns;
+    rec.port = port;
+    if (capture_put(c, &rec, sizeof(rec)) == -1 ||
+        capture_put(c, buf, len) == -1 ||
+        capture_index(c, ts_ns, offset) == -1) {
+        return -1;
+    }
+    return capture_account(c, sizeof(rec) + len);
+}
+
+static int capture_rotate(struct capture *c)
+{
+    char path[PATH_MAX];
+
+    if (capture_finish_file(c) == -1 || capture_flush(c, 1) == -1 ||
+        (c->z && capz_flush(c->z) == -1)) {
+        return -1;
+    }
+    close(c->fd);
+
+    snprintf(path, sizeof(path), "%s.%d", c->path, ++c->seq);
+    if (rename(c->path, path) == -1) {
+        perror("rename()");
+    }
+    c->rotations++;
+    if (capture_open_file(c) == -1) {
+        return -1;
+    }
+    if (c->z) {
+        capz_set_fd(c->z, c->fd);
+    }
+    return c->fd;
+}
+
+static int capture_account(struct capture *c, size_t n)
+{
+    c->written += n;
+    c->total += n;
+
+    /* -r is the size on disk, compressed frames lag a little behind */
+    if ((c->rotate_size && (c->z ? capz_written(c->z) : c->written) >= c->rotate_size) ||
+        (c->rotate_secs && time(NULL) - c->opened >= c->rotate_secs)) {
+        return capture_rotate(c);
+    }
+    return 0;
+}
+
+static void capture_drop_splice(struct capture *c)
+{
+    close(c->pipefd[0]);
+    close(c->pipefd[1]);
+    c->pipefd[0] = c->pipefd[1] = -1;
+}
+
+/* kernel to kernel: port -> pipe -> file, returns bytes moved */
+static ssize_t capture_splice(struct capture *c, int fd)
+{
+    ssize_t n, out, left;
+
+    n = splice(fd, NULL, c->pipefd[1], NULL, CAPTURE_SPLICE_LEN,
+               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n <= 0) {
+        return n;
+    }
+
+    for (left = n; left > 0; left -= out) {
+        out = splice(c->pipefd[0], NULL, c->fd, NULL, left, SPLICE_F_MOVE);
+        if (out == -1 && errno == EINTR) {
+            out = 0;
+        } else if (out <= 0) {
+            /* the file side can't splice, copy out what is in the pipe */
+            out = read(c->pipefd[0], c->buf + c->fill, left);
+            if (out <= 0 || serial_write_out(c->fd, c->buf + c->fill, out) == -1) {
+                return -1;
+            }
+            if (out == left) {
+                capture_drop_splice(c);
+            }
+        }
+    }
+    return n;
+}
+
+/* reads right behind a reserved record header and stamps it on return */
+static int capture_read_record(struct capture *c, int fd)
+{
+    struct capfmt_rec rec;
+    uint64_t offset = c->offset;
+    ssize_t n;
+
+    if (CAPTURE_BUF_SIZE - c->fill < sizeof(rec) + CAPTURE_MIN_READ &&
+        capture_flush(c, 0) == -1) {
+        return -1;
+    }
+
+    n = read(fd, c->buf + c->fill + sizeof(rec), CAPTURE_BUF_SIZE - c->fill - sizeof(rec));
+    if (n <= 0) {
+        return (n == -1 && errno == EAGAIN) ? 0 : (int)n;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = CAPFMT_DATA;
+    rec.len = n;
+    rec.ts_ns = capfmt_now();
+    memcpy(c->buf + c->fill, &rec, sizeof(rec));
+    c->fill += sizeof(rec) + n;
+    c->offset += sizeof(rec) + n;
+
+    if (capture_index(c, rec.ts_ns, offset) == -1) {
+        return -1;
+    }
+    return capture_account(c, sizeof(rec) + n) == -1 ? -1 : n;
+}
+
+/* moves whatever the port has into the file, 0 when nothing was ready */
+int capture_from_fd(struct capture *c, int fd)
+{
+    ssize_t n;
+
+    if (c->pipefd[0] != -1) {
+        n = capture_splice(c, fd);
+        if (n == -1 && errno == EINVAL) {
+            /* the tty driver can't splice, go through the buffer */
+            capture_drop_splice(c);
+        } else if (n > 0) {
+            return capture_account(c, n) == -1 ? -1 : n;
+        } else {
+            return (n == -1 && errno == EAGAIN) ? 0 : (int)n;
+        }
+    }
+
+    if (c->flags & CAPTURE_RECORDS) {
+        return capture_read_record(c, fd);
+    }
+
+    n = read(fd, c->buf + c->fill, CAPTURE_BUF_SIZE - c->fill);
+    if (n <= 0) {
+        return (n == -1 && errno == EAGAIN) ? 0 : (int)n;
+    }
+    c->fill += n;
+    c->offset += n;
+    if (c->fill == CAPTURE_BUF_SIZE && capture_flush(c, 0) == -1) {
+        return -1;
+    }
+    return capture_account(c, n) == -1 ? -1 : n;
+}
+
+/* frames the file on a thread of its own from here on; O_DIRECT and
+ * splice only apply to the raw bytes so both are dropped */
+int capture_compress(struct capture *c, int method, int level)
+{
+    capture_drop_direct(c);
+    c->flags &= ~CAPTURE_DIRECT;
+    if (c->pipefd[0] != -1) {
+        capture_drop_splice(c);
+    }
+    c->z = capz_start(method, level, c->fd, c->flags & CAPTURE_SYNC);
+    return c->z ? 0 : -1;
+}
+
+/* for data that is already in memory (rendered or framed output) */
+int capture_write(struct capture *c, const char *buf, size_t len)
+{
+    if (capture_put(c, buf, len) == -1) {
+        return -1;
+    }
+    return capture_account(c, len);
+}
+
+/* -1 when the last of the data didn't make it to the file */
+int capture_close(struct capture *c)
+{
+    int res = 0;
+
+    if (c->fd != -1) {
+        if (capture_finish_file(c) == -1 || capture_flush(c, 1) == -1 ||
+            (c->z && capz_flush(c->z) == -1)) {
+            fprintf(stderr, "%s: %s\n", c->path, strerror(errno));
+            res = -1;
+        }
+        if (c->z) {
+            capz_report(c->z, stderr);
+        }
+        if (close(c->fd) == -1) {
+            res = -1;
+        }
+        c->fd = -1;
+    }
+    capz_stop(c->z);
+    c->z = NULL;
+    if (c->pipefd[0] != -1) {
+        capture_drop_splice(c);
+    }
+    free(c->buf);
+    free(c->index);
+    c->buf = NULL;
+    c->index = NULL;
+    return res;
+}
+
+/* "64k", "100M", "2G" */
+unsigned long long capture_parse_size(const char *s)
+{
+    char *end;
+    unsigned long long n = strtoull(s, &end, 10);
+
+    switch (*end) {
+    case 'g': case 'G':
+        n <<= 10;
+        /* fall through */
+    case 'm': case 'M':
+        n <<= 10;
+        /* fall through */
+    case 'k': case 'K':
+        n <<= 10;
+        break;
+    }
+    return n;
+}
+
+struct capture_loop {
+    struct evloop *ev;
+    struct serial_opt *serial;
+    struct capture *c;
+    int res;
+};
+
+static void capture_on_port(int fd, int events, void *arg)
+{
+    struct capture_loop *l = arg;
+    int res = capture_from_fd(l->c, fd);
+
+    if (res == -1) {
+        fprintf(stderr, "%s: capture failed: %s\n", l->serial->name, strerror(errno));
+        l->res = -1;
+        evloop_stop(l->ev);
+    } else if (res == 0 && (events & (EV_HUP | EV_ERR))) {
+        evloop_stop(l->ev);
+    }
+}
+
+/* buffered data shouldn't sit in memory while the port is quiet */
+int capture_tick(struct capture *c)
+{
+    if (capture_flush(c, 0) == -1) {
+        return -1;
+    }
+    if ((c->flags & CAPTURE_DIRECT) && !c->z && c->tail != c->fill &&
+        capture_flush_tail(c) == -1) {
+        return -1;
+    }
+    if (c->rotate_secs && time(NULL) - c->opened >= c->rotate_secs) {
+        return capture_rotate(c);
+    }
+    return 0;
+}
+
+static void capture_on_timer(int fd, int events, void *arg)
+{
+    struct capture_loop *l = arg;
+
+    evloop_timer_ack(fd);
+    if (capture_tick(l->c) == -1) {
+        fprintf(stderr, "%s: capture failed: %s\n", l->c->path, strerror(errno));
+        l->res = -1;
+        evloop_stop(l->ev);
+        return;
+    }
+    evloop_timer_set(fd, CAPTURE_FLUSH_MS);
+}
+
+static void capture_on_signal(int fd, int events, void *arg)
+{
+    struct capture_loop *l = arg;
+
+    if (evloop_signal_ack(fd) > 0) {
+        evloop_stop(l->ev);
+    }
+}
+
+/* records an already opened port into c until SIGINT or hangup */
+int serial_capture(struct serial_opt *serial, struct capture *c)
+{
+    struct capture_loop l;
+    int sigfd, timerfd;
+
+    l.serial = serial;
+    l.c = c;
+    l.res = 0;
+    sigfd = evloop_signalfd(SIGINT);
+    timerfd = evloop_timerfd();
+    if (!(l.ev = evloop_create()) || sigfd == -1 || timerfd == -1) {
+        perror("capture");
+        return -1;
+    }
+
+    evloop_add(l.ev, serial->handler, EV_READ, capture_on_port, &l);
+    evloop_add(l.ev, sigfd, EV_READ, capture_on_signal, &l);
+    evloop_add(l.ev, timerfd, EV_READ, capture_on_timer, &l);
+    evloop_timer_set(timerfd, CAPTURE_FLUSH_MS);
+    serial_stats_watch(l.ev);
+
+    fprintf(stderr, "Capturing to %s%s%s%s, ^C to exit.\n", c->path,
+            c->pipefd[0] != -1 ? " (splice)" : "", c->z ? " compressed " : "",
+            c->z ? capz_name(c->z->method) : "");
+
+    while (evloop_running(l.ev)) {
+        if (evloop_run_once(l.ev, -1) == -1) {
+            perror("epoll_wait()");
+            break;
+        }
+    }
+
+    fprintf(stderr, "\ncaptured: %llu bytes, %d rotation(s)%s\n", c->total, c->rotations,
+            c->pipefd[0] != -1 ? ", spliced" : "");
+    close(timerfd);
+    close(sigfd);
+    evloop_destroy(l.ev);
+    return l.res;
+}
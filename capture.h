@@ -0,0 +1,56 @@
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <time.h>
+#include <stdint.h>
+#include "usbserial.h"
+#include "capfmt.h"
+#include "capz.h"
+
+#define CAPTURE_DIRECT  0x01    /* O_DIRECT, aligned writes */
+#define CAPTURE_SYNC    0x02    /* fdatasync after every flushed block */
+#define CAPTURE_RECORDS 0x04    /* timestamped capfmt records instead of raw bytes */
+
+#define CAPTURE_BUF_SIZE    (1 << 20)
+#define CAPTURE_FLUSH_MS    1000
+#define CAPTURE_ALIGN       4096
+
+struct capture {
+    const char *path;
+    int fd;
+    int flags;
+    unsigned long long rotate_size;     /* 0 = never */
+    long rotate_secs;                   /* 0 = never */
+    time_t opened;
+    unsigned long long written;         /* current file */
+    unsigned long long total;
+    uint64_t offset;                    /* logical end of the current file */
+    struct capfmt_ent *index;           /* CAPTURE_RECORDS samples */
+    size_t nindex;
+    size_t maxindex;
+    size_t nflushed;                    /* samples already written inline */
+    uint64_t next_index;
+    int seq;                            /* last path.N, resumes after a prior run */
+    int rotations;
+    int pipefd[2];                      /* splice staging, -1 when unusable */
+    char *buf;
+    size_t fill;
+    size_t tail;                        /* direct mode: fill already put in the file */
+    struct capz *z;                     /* compressing thread, NULL when off */
+};
+
+int capture_open(struct capture *c, const char *path, int flags,
+                 unsigned long long rotate_size, long rotate_secs);
+int capture_compress(struct capture *c, int method, int level);
+int capture_from_fd(struct capture *c, int fd);
+int capture_write(struct capture *c, const char *buf, size_t len);
+int capture_record(struct capture *c, unsigned int port, uint64_t ts_ns,
+                   const char *buf, size_t len);
+int capture_flush(struct capture *c, int all);
+int capture_tick(struct capture *c);
+int capture_close(struct capture *c);
+unsigned long long capture_parse_size(const char *s);
+
+int serial_capture(struct serial_opt *serial, struct capture *c);
+
+#endif
@@ -0,0 +1,499 @@
+/*  capz.c - compressed capture sink, frames written on their own thread.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "usbserial_linux.h"
+#include "usbserial.h"
+#include "capz.h"
+
+#define CAPZ_LZ4_MAGIC      0x184D2204
+#define CAPZ_LZ4_FLG        0x60        /* version 1, independent blocks */
+#define CAPZ_LZ4_BD         0x70        /* blocks up to 4 MB */
+#define CAPZ_LZ4_STORED     0x80000000u /* block size flag: not compressed */
+#define CAPZ_HASH_LOG       14
+#define CAPZ_MIN_MATCH      4
+#define CAPZ_MF_LIMIT       12          /* no match starts in the last 12 bytes */
+#define CAPZ_LAST_LITERALS  5           /* nor covers the last 5 */
+#define CAPZ_MAX_OFFSET     65535
+
+#define CAPZ_PRIME1         2654435761u
+#define CAPZ_PRIME2         2246822519u
+#define CAPZ_PRIME3         3266489917u
+#define CAPZ_PRIME5         374761393u
+
+/* "lz4", "lz4,8" (acceleration), "zstd", "zstd,19"; empty picks the best
+ * one built in */
+int capz_parse(const char *s, int *method, int *level)
+{
+    const char *comma;
+    size_t len;
+
+    *level = 0;
+    if (!s || !*s) {
+#ifdef HAVE_ZSTD
+        *method = CAPZ_ZSTD;
+#else
+        *method = CAPZ_LZ4;
+#endif
+        return 0;
+    }
+    comma = strchr(s, ',');
+    len = comma ? (size_t)(comma - s) : strlen(s);
+    if (comma) {
+        *level = atoi(comma + 1);
+    }
+    if (len == 3 && !strncmp(s, "lz4", len)) {
+        *method = CAPZ_LZ4;
+        return 0;
+    }
+#ifdef HAVE_ZSTD
+    if (len == 4 && !strncmp(s, "zstd", len)) {
+        *method = CAPZ_ZSTD;
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+const char *capz_name(int method)
+{
+    switch (method) {
+    case CAPZ_LZ4:
+#ifdef HAVE_LZ4
+        return "lz4";
+#else
+        return "lz4 (built in)";
+#endif
+    case CAPZ_ZSTD:
+        return "zstd";
+    }
+    return "none";
+}
+
+static uint64_t capz_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void capz_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t capz_rotl(uint32_t v, int r)
+{
+    return (v << r) | (v >> (32 - r));
+}
+
+/* xxHash32 of a few bytes, all the frame descriptor checksum needs */
+static uint32_t capz_xxh32_short(const uint8_t *p, size_t len)
+{
+    uint32_t h = CAPZ_PRIME5 + len;
+
+    while (len--) {
+        h += *p++ * CAPZ_PRIME5;
+        h = capz_rotl(h, 11) * CAPZ_PRIME1;
+    }
+    h ^= h >> 15;
+    h *= CAPZ_PRIME2;
+    h ^= h >> 13;
+    h *= CAPZ_PRIME3;
+    h ^= h >> 16;
+    return h;
+}
+
+#ifndef HAVE_LZ4
+static uint32_t capz_load32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t capz_hash(uint32_t v)
+{
+    return (v * CAPZ_PRIME1) >> (32 - CAPZ_HASH_LOG);
+}
+
+static uint8_t *capz_put_len(uint8_t *op, size_t len)
+{
+    for (; len >= 255; len -= 255) {
+        *op++ = 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+static uint8_t *capz_put_seq(uint8_t *op, const uint8_t *lit, size_t nlit, size_t mlen)
+{
+    *op++ = (nlit < 15 ? nlit : 15) << 4 | (mlen < 15 ? mlen : 15);
+    if (nlit >= 15) {
+        op = capz_put_len(op, nlit - 15);
+    }
+    memcpy(op, lit, nlit);
+    return op + nlit;
+}
+
+/* LZ4 block format, greedy: one hash slot per 4 byte sequence, the
+ * step grows while nothing matches so noise is not searched byte by
+ * byte. Returns the block size, 0 when it doesn't fit in n bytes */
+static size_t capz_lz4_block(uint32_t *table, const uint8_t *src, size_t n, uint8_t *dst)
+{
+    const uint8_t *ip = src, *anchor = src, *end = src + n;
+    const uint8_t *mflimit = end - CAPZ_MF_LIMIT, *mlimit = end - CAPZ_LAST_LITERALS;
+    const uint8_t *ref, *p, *r;
+    uint8_t *op = dst, *oend = dst + n;
+    uint32_t seq, h;
+    size_t off;
+
+    memset(table, 0, sizeof(*table) << CAPZ_HASH_LOG);
+    while (n > CAPZ_MF_LIMIT && ip < mflimit) {
+        seq = capz_load32(ip);
+        h = capz_hash(seq);
+        ref = src + table[h];
+        table[h] = ip - src;
+        if (ref >= ip || ip - ref > CAPZ_MAX_OFFSET || capz_load32(ref) != seq) {
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+        while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+            ip--;
+            ref--;
+        }
+        for (p = ip + CAPZ_MIN_MATCH, r = ref + CAPZ_MIN_MATCH; p < mlimit && *p == *r; p++, r++) {
+        }
+        if (op + (ip - anchor) + (ip - anchor) / 255 + (p - ip) / 255 + 8 > oend) {
+            return 0;
+        }
+        off = ip - ref;
+        op = capz_put_seq(op, anchor, ip - anchor, p - ip - CAPZ_MIN_MATCH);
+        *op++ = off;
+        *op++ = off >> 8;
+        if (p - ip - CAPZ_MIN_MATCH >= 15) {
+            op = capz_put_len(op, p - ip - CAPZ_MIN_MATCH - 15);
+        }
+        ip = anchor = p;
+        if (ip < mflimit) {
+            table[capz_hash(capz_load32(ip - 2))] = ip - 2 - src;
+        }
+    }
+    if (op + (end - anchor) + (end - anchor) / 255 + 1 > oend) {
+        return 0;
+    }
+    op = capz_put_seq(op, anchor, end - anchor, 0);
+    return op - dst;
+}
+#endif
+
+/* one LZ4 frame holding one block, stored when it doesn't shrink */
+static size_t capz_lz4_frame(struct capz *z, size_t len)
+{
+    uint8_t *op = (uint8_t *)z->out;
+    size_t n;
+
+    capz_le32(op, CAPZ_LZ4_MAGIC);
+    op[4] = CAPZ_LZ4_FLG;
+    op[5] = CAPZ_LZ4_BD;
+    op[6] = capz_xxh32_short(op + 4, 2) >> 8;
+    op += 7;
+#ifdef HAVE_LZ4
+    n = LZ4_compress_fast(z->in, (char *)op + 4, len, len - 1, z->level > 0 ? z->level : 1);
+#else
+    n = capz_lz4_block(z->ctx, (const uint8_t *)z->in, len, op + 4);
+#endif
+    if (n) {
+        capz_le32(op, n);
+    } else {
+        memcpy(op + 4, z->in, len);
+        capz_le32(op, len | CAPZ_LZ4_STORED);
+        n = len;
+    }
+    op += 4 + n;
+    capz_le32(op, 0);
+    return op + 4 - (uint8_t *)z->out;
+}
+
+static size_t capz_compress(struct capz *z, size_t len)
+{
+#ifdef HAVE_ZSTD
+    if (z->method == CAPZ_ZSTD) {
+        size_t n = ZSTD_compressCCtx(z->ctx, z->out, z->out_size, z->in, len,
+                                     z->level ? z->level : ZSTD_CLEVEL_DEFAULT);
+
+        if (ZSTD_isError(n)) {
+            errno = EINVAL;
+            return 0;
+        }
+        return n;
+    }
+#endif
+    return capz_lz4_frame(z, len);
+}
+
+/* takes len bytes off the ring and writes them as one frame */
+static void capz_frame(struct capz *z, size_t len)
+{
+    uint64_t t0 = capz_cpu_ns();
+    size_t n;
+
+    rbuf_read(&z->ring, z->in, len);
+    n = capz_compress(z, len);
+    z->cpu_ns += capz_cpu_ns() - t0;
+
+    if (z->err) {
+        return;
+    }
+    if (!n || serial_write_out(z->fd, z->out, n) == -1) {
+        z->err = errno ? errno : EIO;
+        return;
+    }
+    if (z->sync) {
+        fdatasync(z->fd);
+    }
+    z->raw += len;
+    z->comp += n;
+    z->frames++;
+    __atomic_add_fetch(&z->written, n, __ATOMIC_RELAXED);
+}
+
+static void capz_deadline(struct timespec *ts, long ms)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+/* whole blocks as soon as they are queued, the rest on flush, stop or
+ * after CAPZ_FLUSH_MS without a full block */
+static void *capz_thread(void *arg)
+{
+    struct capz *z = arg;
+    struct timespec ts;
+    int timedout = 0;
+    size_t len;
+
+    pthread_mutex_lock(&z->lock);
+    for (;;) {
+        len = rbuf_len(&z->ring);
+        if (len >= CAPZ_BLOCK_SIZE || (len && (z->flush || z->stop || timedout))) {
+            pthread_mutex_unlock(&z->lock);
+            capz_frame(z, len < CAPZ_BLOCK_SIZE ? len : CAPZ_BLOCK_SIZE);
+            pthread_mutex_lock(&z->lock);
+            pthread_cond_broadcast(&z->done);
+            timedout = 0;
+            continue;
+        }
+        if (z->flush) {
+            z->flush = 0;
+            pthread_cond_broadcast(&z->done);
+            continue;
+        }
+        if (z->stop) {
+            break;
+        }
+        capz_deadline(&ts, CAPZ_FLUSH_MS);
+        timedout = pthread_cond_timedwait(&z->wake, &z->lock, &ts) == ETIMEDOUT;
+    }
+    pthread_mutex_unlock(&z->lock);
+    return NULL;
+}
+
+/* the block compressor's state: zstd context or the match table */
+static int capz_init_ctx(struct capz *z)
+{
+#ifdef HAVE_ZSTD
+    if (z->method == CAPZ_ZSTD) {
+        z->out_size = ZSTD_compressBound(CAPZ_BLOCK_SIZE);
+        return (z->ctx = ZSTD_createCCtx()) ? 0 : -1;
+    }
+#endif
+#ifndef HAVE_LZ4
+    return (z->ctx = malloc(sizeof(uint32_t) << CAPZ_HASH_LOG)) ? 0 : -1;
+#else
+    return 0;
+#endif
+}
+
+static void capz_free(struct capz *z)
+{
+#ifdef HAVE_ZSTD
+    if (z->method == CAPZ_ZSTD) {
+        ZSTD_freeCCtx(z->ctx);
+        z->ctx = NULL;
+    }
+#endif
+    free(z->ctx);
+    free(z->in);
+    free(z->out);
+    rbuf_free(&z->ring);
+    free(z);
+}
+
+struct capz *capz_start(int method, int level, int fd, int sync)
+{
+    struct capz *z = calloc(1, sizeof(*z));
+    sigset_t all, old;
+    int res;
+
+    if (!z) {
+        return NULL;
+    }
+    z->method = method;
+    z->level = level;
+    z->fd = fd;
+    z->sync = sync;
+    /* frame header, block size and end mark around a stored block */
+    z->out_size = CAPZ_BLOCK_SIZE + 64;
+    if (capz_init_ctx(z) == -1 || rbuf_init(&z->ring, CAPZ_RING_SIZE) == -1 ||
+        !(z->in = malloc(CAPZ_BLOCK_SIZE)) || !(z->out = malloc(z->out_size))) {
+        capz_free(z);
+        errno = ENOMEM;
+        return NULL;
+    }
+    pthread_mutex_init(&z->lock, NULL);
+    pthread_cond_init(&z->wake, NULL);
+    pthread_cond_init(&z->done, NULL);
+
+    /* signals stay with the capture loop's signalfd */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    res = pthread_create(&z->thread, NULL, capz_thread, z);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (res) {
+        capz_free(z);
+        errno = res;
+        return NULL;
+    }
+    return z;
+}
+
+/* queues len bytes, waits only while the ring is full */
+int capz_write(struct capz *z, const char *buf, size_t len)
+{
+    size_t n;
+    int err;
+
+    do {
+        n = rbuf_write(&z->ring, buf, len);
+        buf += n;
+        len -= n;
+
+        pthread_mutex_lock(&z->lock);
+        if (len || rbuf_len(&z->ring) >= CAPZ_BLOCK_SIZE) {
+            pthread_cond_signal(&z->wake);
+        }
+        while (len && !rbuf_space(&z->ring) && !z->err) {
+            pthread_cond_wait(&z->done, &z->lock);
+        }
+        err = z->err;
+        pthread_mutex_unlock(&z->lock);
+        if (err) {
+            errno = err;
+            return -1;
+        }
+    } while (len);
+    return 0;
+}
+
+/* everything queued is written as frames when this returns */
+int capz_flush(struct capz *z)
+{
+    int err;
+
+    pthread_mutex_lock(&z->lock);
+    z->flush = 1;
+    pthread_cond_signal(&z->wake);
+    while (z->flush && !z->err) {
+        pthread_cond_wait(&z->done, &z->lock);
+    }
+    err = z->err;
+    pthread_mutex_unlock(&z->lock);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/* after a rotation; the ring must have been flushed */
+void capz_set_fd(struct capz *z, int fd)
+{
+    pthread_mutex_lock(&z->lock);
+    z->fd = fd;
+    __atomic_store_n(&z->written, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&z->lock);
+}
+
+uint64_t capz_written(struct capz *z)
+{
+    return __atomic_load_n(&z->written, __ATOMIC_RELAXED);
+}
+
+void capz_report(struct capz *z, FILE *f)
+{
+    double mb = z->raw / 1e6;
+
+    fprintf(f, "compressed %s: %llu -> %llu bytes (%.2f:1) in %llu frames, %.2f ms CPU/MB\n",
+            capz_name(z->method), (unsigned long long)z->raw, (unsigned long long)z->comp,
+            z->comp ? (double)z->raw / z->comp : 0.0, (unsigned long long)z->frames,
+            mb > 0 ? z->cpu_ns / 1e6 / mb : 0.0);
+}
+
+/* writes out what is queued and ends the thread */
+void capz_stop(struct capz *z)
+{
+    if (!z) {
+        return;
+    }
+    pthread_mutex_lock(&z->lock);
+    z->stop = 1;
+    pthread_cond_signal(&z->wake);
+    pthread_mutex_unlock(&z->lock);
+    pthread_join(z->thread, NULL);
+    pthread_mutex_destroy(&z->lock);
+    pthread_cond_destroy(&z->wake);
+    pthread_cond_destroy(&z->done);
+    capz_free(z);
+}
@@ -0,0 +1,64 @@
+#ifndef _CAPZ_H
+#define _CAPZ_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "rbuff.h"
+
+/* Compressed capture sink: the capture loop copies flushed blocks into
+ * a ring and returns, a thread of its own cuts the ring into blocks of
+ * CAPZ_BLOCK_SIZE and writes each as one self-contained frame, so any
+ * prefix of frames decompresses (a crash loses the frame in flight):
+ *
+ *   lz4   LZ4 frame format, built in; liblz4 with HAVE_LZ4. lz4 -d reads it.
+ *         "lz4,N" is liblz4's acceleration: higher is faster and larger,
+ *         the opposite of a zstd level. The built-in encoder ignores it
+ *   zstd  one zstd frame per block, HAVE_ZSTD only. zstd -d reads it
+ *
+ * A quiet port still gets a (short) frame every CAPZ_FLUSH_MS. */
+#define CAPZ_BLOCK_SIZE     (1 << 20)
+#define CAPZ_RING_SIZE      (8 << 20)
+#define CAPZ_FLUSH_MS       5000
+
+enum {
+    CAPZ_NONE = 0,
+    CAPZ_LZ4,
+    CAPZ_ZSTD,
+};
+
+struct capz {
+    int method;
+    int level;
+    int fd;
+    int sync;                   /* fdatasync after every frame */
+    rbuf_t ring;                /* capture loop -> thread */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        /* data, flush or stop for the thread */
+    pthread_cond_t done;        /* ring space or flush done for the writer */
+    int flush;                  /* frame what is queued, then clear it */
+    int stop;
+    int err;                    /* errno of a failed write, sticky */
+    char *in;
+    char *out;
+    size_t out_size;
+    void *ctx;                  /* hash table or library context */
+    uint64_t raw;               /* totals, updated by the thread */
+    uint64_t comp;
+    uint64_t written;           /* compressed bytes in the current file */
+    uint64_t frames;
+    uint64_t cpu_ns;
+};
+
+int capz_parse(const char *s, int *method, int *level);
+const char *capz_name(int method);
+struct capz *capz_start(int method, int level, int fd, int sync);
+int capz_write(struct capz *z, const char *buf, size_t len);
+int capz_flush(struct capz *z);
+void capz_set_fd(struct capz *z, int fd);
+uint64_t capz_written(struct capz *z);
+void capz_report(struct capz *z, FILE *f);
+void capz_stop(struct capz *z);
+
+#endif
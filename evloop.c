@@ -0,0 +1,344 @@
+/*  evloop.c - epoll event loop with a poll() fallback.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+
+#include "evloop.h"
+
+#define EV_MAX_EVENTS   64
+
+struct ev_watch {
+    int fd;
+    int events;
+    ev_cb cb;
+    void *arg;
+};
+
+struct evloop {
+    int epfd;               /* -1 when running on poll() */
+    int running;
+    struct ev_watch *watch;
+    struct pollfd *pfd;
+    int nwatch;
+    int maxwatch;
+    int64_t wait_ns;        /* time blocked in the last run_once */
+};
+
+static struct ev_watch *evloop_find(struct evloop *loop, int fd)
+{
+    int i;
+
+    for (i = 0; i < loop->nwatch; i++) {
+        if (loop->watch[i].fd == fd) {
+            return &loop->watch[i];
+        }
+    }
+    return NULL;
+}
+
+static unsigned int ev_to_epoll(int events)
+{
+    return ((events & EV_READ) ? EPOLLIN : 0) | ((events & EV_WRITE) ? EPOLLOUT : 0);
+}
+
+static int epoll_to_ev(unsigned int events)
+{
+    return ((events & EPOLLIN) ? EV_READ : 0) |
+           ((events & EPOLLOUT) ? EV_WRITE : 0) |
+           ((events & EPOLLHUP) ? EV_HUP : 0) |
+           ((events & EPOLLERR) ? EV_ERR : 0);
+}
+
+struct evloop *evloop_create(void)
+{
+    struct evloop *loop = calloc(1, sizeof(*loop));
+
+    if (!loop) {
+        return NULL;
+    }
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    loop->running = 1;
+    return loop;
+}
+
+void evloop_destroy(struct evloop *loop)
+{
+    if (loop->epfd != -1) {
+        close(loop->epfd);
+    }
+    free(loop->watch);
+    free(loop->pfd);
+    free(loop);
+}
+
+int evloop_add(struct evloop *loop, int fd, int events, ev_cb cb, void *arg)
+{
+    struct ev_watch *w;
+
+    if (loop->nwatch == loop->maxwatch) {
+        int max = loop->maxwatch ? loop->maxwatch * 2 : 8;
+        void *watch = realloc(loop->watch, max * sizeof(*loop->watch));
+        void *pfd;
+
+        if (!watch) {
+            return -1;
+        }
+        loop->watch = watch;
+        if (!(pfd = realloc(loop->pfd, max * sizeof(*loop->pfd)))) {
+            return -1;
+        }
+        loop->pfd = pfd;
+        loop->maxwatch = max;
+    }
+
+    if (loop->epfd != -1) {
+        struct epoll_event ev;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = ev_to_epoll(events);
+        ev.data.fd = fd;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            return -1;
+        }
+    }
+
+    w = &loop->watch[loop->nwatch++];
+    w->fd = fd;
+    w->events = events;
+    w->cb = cb;
+    w->arg = arg;
+    return 0;
+}
+
+int evloop_mod(struct evloop *loop, int fd, int events)
+{
+    struct ev_watch *w = evloop_find(loop, fd);
+
+    if (!w) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (w->events == events) {
+        return 0;
+    }
+
+    if (loop->epfd != -1) {
+        struct epoll_event ev;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = ev_to_epoll(events);
+        ev.data.fd = fd;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+            return -1;
+        }
+    }
+    w->events = events;
+    return 0;
+}
+
+int evloop_del(struct evloop *loop, int fd)
+{
+    struct ev_watch *w = evloop_find(loop, fd);
+
+    if (!w) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (loop->epfd != -1) {
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+    }
+    /* keep dispatch safe: mark the slot dead, compact on the next run */
+    w->fd = -1;
+    w->cb = NULL;
+    return 0;
+}
+
+static void evloop_compact(struct evloop *loop)
+{
+    int i, j;
+
+    for (i = 0, j = 0; i < loop->nwatch; i++) {
+        if (loop->watch[i].fd != -1) {
+            loop->watch[j++] = loop->watch[i];
+        }
+    }
+    loop->nwatch = j;
+}
+
+static int64_t evloop_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void evloop_dispatch(struct evloop *loop, int fd, int events)
+{
+    struct ev_watch *w = evloop_find(loop, fd);
+
+    if (w && w->cb) {
+        w->cb(fd, events, w->arg);
+    }
+}
+
+/* waits up to timeout_ms (-1 forever), returns the number of ready fds */
+int evloop_run_once(struct evloop *loop, int timeout_ms)
+{
+    int i, n;
+    int64_t start;
+
+    evloop_compact(loop);
+
+    if (loop->epfd != -1) {
+        struct epoll_event ev[EV_MAX_EVENTS];
+
+        start = evloop_now();
+        n = epoll_wait(loop->epfd, ev, EV_MAX_EVENTS, timeout_ms);
+        loop->wait_ns = evloop_now() - start;
+        for (i = 0; i < n && loop->running; i++) {
+            evloop_dispatch(loop, ev[i].data.fd, epoll_to_ev(ev[i].events));
+        }
+    } else {
+        int nwatch = loop->nwatch;
+
+        for (i = 0; i < nwatch; i++) {
+            loop->pfd[i].fd = loop->watch[i].events ? loop->watch[i].fd : -1;
+            loop->pfd[i].events = ((loop->watch[i].events & EV_READ) ? POLLIN : 0) |
+                                  ((loop->watch[i].events & EV_WRITE) ? POLLOUT : 0);
+            loop->pfd[i].revents = 0;
+        }
+        start = evloop_now();
+        n = poll(loop->pfd, nwatch, timeout_ms);
+        loop->wait_ns = evloop_now() - start;
+        for (i = 0; i < nwatch && n > 0 && loop->running; i++) {
+            short re = loop->pfd[i].revents;
+
+            if (re) {
+                evloop_dispatch(loop, loop->pfd[i].fd,
+                    ((re & POLLIN) ? EV_READ : 0) | ((re & POLLOUT) ? EV_WRITE : 0) |
+                    ((re & POLLHUP) ? EV_HUP : 0) | ((re & (POLLERR | POLLNVAL)) ? EV_ERR : 0));
+            }
+        }
+    }
+
+    if (n == -1 && errno == EINTR) {
+        n = 0;
+    }
+    return n;
+}
+
+void evloop_stop(struct evloop *loop)
+{
+    loop->running = 0;
+}
+
+int evloop_running(struct evloop *loop)
+{
+    return loop->running;
+}
+
+int64_t evloop_last_wait(struct evloop *loop)
+{
+    return loop->wait_ns;
+}
+
+int evloop_timerfd(void)
+{
+    return timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+/* one-shot timer, msec <= 0 disarms */
+int evloop_timer_set(int fd, long msec)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    if (msec > 0) {
+        its.it_value.tv_sec = msec / 1000;
+        its.it_value.tv_nsec = (msec % 1000) * 1000000L;
+    }
+    return timerfd_settime(fd, 0, &its, NULL);
+}
+
+int evloop_timer_ack(int fd)
+{
+    uint64_t expired;
+
+    return read(fd, &expired, sizeof(expired)) == sizeof(expired) ? 0 : -1;
+}
+
+/* blocks sig for the whole process (threads created later inherit the
+ * mask) and returns a descriptor that becomes readable when it arrives */
+int evloop_signalfd(int sig)
+{
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, sig);
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0) {
+        return -1;
+    }
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+/* returns the delivered signal number, -1 when nothing was pending */
+int evloop_signal_ack(int fd)
+{
+    struct signalfd_siginfo si;
+
+    if (read(fd, &si, sizeof(si)) != sizeof(si)) {
+        return -1;
+    }
+    return si.ssi_signo;
+}
+
+int evloop_eventfd(void)
+{
+    return eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+void evloop_event_notify(int fd)
+{
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) != sizeof(one)) {
+        /* counter saturated, the loop is already due to wake up */
+    }
+}
+
+int evloop_event_ack(int fd)
+{
+    uint64_t count;
+
+    return read(fd, &count, sizeof(count)) == sizeof(count) ? 0 : -1;
+}
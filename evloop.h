@@ -0,0 +1,33 @@
+#ifndef _EVLOOP_H
+#define _EVLOOP_H
+
+#include <stdint.h>
+
+#define EV_READ     0x01
+#define EV_WRITE    0x02
+#define EV_HUP      0x04
+#define EV_ERR      0x08
+
+typedef void (*ev_cb)(int fd, int events, void *arg);
+
+struct evloop;
+
+struct evloop *evloop_create(void);
+void evloop_destroy(struct evloop *loop);
+int evloop_add(struct evloop *loop, int fd, int events, ev_cb cb, void *arg);
+int evloop_mod(struct evloop *loop, int fd, int events);
+int evloop_del(struct evloop *loop, int fd);
+int evloop_run_once(struct evloop *loop, int timeout_ms);
+void evloop_stop(struct evloop *loop);
+int evloop_running(struct evloop *loop);
+int64_t evloop_last_wait(struct evloop *loop);
+
+int evloop_timerfd(void);
+int evloop_timer_set(int fd, long msec);
+int evloop_timer_ack(int fd);
+int evloop_signalfd(int sig);
+int evloop_signal_ack(int fd);
+int evloop_eventfd(void);
+void evloop_event_notify(int fd);
+int evloop_event_ack(int fd);
+#endif
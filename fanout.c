@@ -0,0 +1,512 @@
+/*  fanout.c - share one serial port with many local socket clients.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "usbserial_linux.h"
+#include "usbserial.h"
+#include "rbuff.h"
+#include "evloop.h"
+#include "fanout.h"
+
+#define FANOUT_MAX_LISTEN   8
+#define FANOUT_NAME_LEN     64
+
+struct fanout;
+
+struct fanout_client {
+    struct fanout *f;
+    int fd;
+    int events;
+    int paused;             /* TX queue full, input is left in the socket */
+    size_t pos;             /* read cursor into the shared ring */
+    char name[FANOUT_NAME_LEN];
+    unsigned long long sent;
+    unsigned long long skipped;
+    size_t linelen;
+    char line[FANOUT_LINE_MAX];
+};
+
+struct fanout_listener {
+    struct fanout *f;
+    int fd;
+    char *path;             /* unix socket to unlink on exit */
+};
+
+/* every client reads the one RX ring through its own cursor, the ring
+ * tail is the slowest cursor */
+struct fanout {
+    struct evloop *ev;
+    struct serial_opt *serial;
+    rbuf_t ring;
+    int slow;
+    int port_events;
+    int nclients;
+    int naccepted;
+    int nlisten;
+    struct fanout_listener listen[FANOUT_MAX_LISTEN];
+    struct fanout_client clients[FANOUT_MAX_CLIENTS];
+};
+
+static const struct {
+    const char *name;
+    int slow;
+} fanout_slow_names[] = {
+    { "drop",   FANOUT_SLOW_DROP },
+    { "skip",   FANOUT_SLOW_SKIP },
+};
+
+int fanout_parse_slow(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(fanout_slow_names) / sizeof(fanout_slow_names[0]); i++) {
+        if (!strcmp(name, fanout_slow_names[i].name)) {
+            return fanout_slow_names[i].slow;
+        }
+    }
+    return -1;
+}
+
+static void fanout_port_events(struct fanout *f)
+{
+    int events = EV_READ | (serial_tx_pending() ? EV_WRITE : 0);
+
+    if (events != f->port_events) {
+        evloop_mod(f->ev, f->serial->handler, events);
+        f->port_events = events;
+    }
+}
+
+static void fanout_client_events(struct fanout_client *c)
+{
+    int events = (c->paused ? 0 : EV_READ) |
+                 (c->pos != rbuf_head(&c->f->ring) ? EV_WRITE : 0);
+
+    if (events != c->events) {
+        evloop_mod(c->f->ev, c->fd, events);
+        c->events = events;
+    }
+}
+
+/* lets the ring forget what every client has sent */
+static void fanout_release(struct fanout *f)
+{
+    size_t head = rbuf_head(&f->ring), keep = 0;
+    int i;
+
+    for (i = 0; i < FANOUT_MAX_CLIENTS; i++) {
+        if (f->clients[i].fd != -1 && head - f->clients[i].pos > keep) {
+            keep = head - f->clients[i].pos;
+        }
+    }
+    rbuf_read_commit(&f->ring, rbuf_len(&f->ring) - keep);
+}
+
+static void fanout_client_close(struct fanout_client *c, const char *why)
+{
+    fprintf(stderr, "%s: %s, %llu bytes sent, %llu skipped\n",
+            c->name, why, c->sent, c->skipped);
+    evloop_del(c->f->ev, c->fd);
+    close(c->fd);
+    c->fd = -1;
+    c->f->nclients--;
+}
+
+/* as much of the backlog as the socket takes now */
+static int fanout_client_send(struct fanout_client *c)
+{
+    size_t len;
+    ssize_t n;
+    char *span;
+
+    while ((span = rbuf_peek(&c->f->ring, c->pos, &len)) != NULL) {
+        n = send(c->fd, span, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        c->pos += n;
+        c->sent += n;
+        if ((size_t)n < len) {
+            break;
+        }
+    }
+    fanout_client_events(c);
+    return 0;
+}
+
+/* TX is arbitrated per line: a client's complete lines enter the port
+ * queue whole, so two writers never interleave inside a line; a line
+ * longer than the buffer goes in pieces. Returns 1 while the queue has
+ * no room, -1 on a port error. */
+static int fanout_client_forward(struct fanout_client *c)
+{
+    size_t n = c->linelen;
+
+    if (n < FANOUT_LINE_MAX) {
+        while (n && c->line[n - 1] != '\n') {
+            n--;
+        }
+    }
+    if (!n) {
+        return 0;
+    }
+    if (serial_tx_space() < n) {
+        return 1;
+    }
+    if (serial_write_buf(c->f->serial, c->line, n) == -1) {
+        return -1;
+    }
+    memmove(c->line, c->line + n, c->linelen - n);
+    c->linelen -= n;
+    return 0;
+}
+
+static void fanout_on_client(int fd, int events, void *arg)
+{
+    struct fanout_client *c = arg;
+    struct fanout *f = c->f;
+    ssize_t n;
+    int res;
+
+    if ((events & EV_WRITE) && fanout_client_send(c) == -1) {
+        fanout_client_close(c, strerror(errno));
+        fanout_release(f);
+        return;
+    }
+    if (events & EV_WRITE) {
+        fanout_release(f);
+    }
+    if (!(events & (EV_READ | EV_HUP | EV_ERR))) {
+        return;
+    }
+
+    n = read(fd, c->line + c->linelen, FANOUT_LINE_MAX - c->linelen);
+    if (n <= 0) {
+        if (n < 0 && errno == EAGAIN) {
+            return;
+        }
+        fanout_client_close(c, n ? strerror(errno) : "closed");
+        fanout_release(f);
+        return;
+    }
+    c->linelen += n;
+    if ((res = fanout_client_forward(c)) == -1) {
+        perror("write()");
+        evloop_stop(f->ev);
+        return;
+    }
+    c->paused = res;
+    fanout_client_events(c);
+    fanout_port_events(f);
+}
+
+/* the TX queue drained a bit, let paused clients in again */
+static int fanout_resume(struct fanout *f)
+{
+    struct fanout_client *c;
+    int i, res;
+
+    for (i = 0; i < FANOUT_MAX_CLIENTS; i++) {
+        c = &f->clients[i];
+        if (c->fd == -1 || !c->paused) {
+            continue;
+        }
+        if ((res = fanout_client_forward(c)) == -1) {
+            return -1;
+        }
+        c->paused = res;
+        fanout_client_events(c);
+    }
+    return 0;
+}
+
+/* a reader more than 3/4 of the ring behind is dropped or skipped ahead,
+ * the port itself never waits for a client */
+static void fanout_make_room(struct fanout *f)
+{
+    size_t head = rbuf_head(&f->ring), limit = f->ring.size / 4 * 3;
+    struct fanout_client *c;
+    int i;
+
+    if (rbuf_space(&f->ring) >= f->ring.size / 4) {
+        return;
+    }
+    for (i = 0; i < FANOUT_MAX_CLIENTS; i++) {
+        c = &f->clients[i];
+        if (c->fd == -1 || head - c->pos <= limit) {
+            continue;
+        }
+        if (f->slow == FANOUT_SLOW_DROP) {
+            fanout_client_close(c, "too slow");
+        } else {
+            c->skipped += head - c->pos;
+            c->pos = head;
+            fanout_client_events(c);
+        }
+    }
+    fanout_release(f);
+}
+
+static void fanout_on_port(int fd, int events, void *arg)
+{
+    struct fanout *f = arg;
+    int i, res;
+
+    if ((events & EV_WRITE) && (serial_tx_flush(f->serial) == -1 || fanout_resume(f) == -1)) {
+        perror("write()");
+        evloop_stop(f->ev);
+        return;
+    }
+    if (events & (EV_READ | EV_HUP | EV_ERR)) {
+        fanout_make_room(f);
+        res = serial_port_read_rbuff(f->serial, &f->ring);
+        if (res > 0) {
+            for (i = 0; i < FANOUT_MAX_CLIENTS; i++) {
+                if (f->clients[i].fd != -1 && fanout_client_send(&f->clients[i]) == -1) {
+                    fanout_client_close(&f->clients[i], strerror(errno));
+                }
+            }
+            fanout_release(f);
+        } else if (res == -1 || (events & (EV_HUP | EV_ERR))) {
+            fprintf(stderr, "%s: port closed\n", f->serial->name);
+            evloop_stop(f->ev);
+            return;
+        }
+    }
+    fanout_port_events(f);
+}
+
+static void fanout_on_accept(int fd, int events, void *arg)
+{
+    struct fanout_listener *l = arg;
+    struct fanout *f = l->f;
+    struct fanout_client *c = NULL;
+    struct sockaddr_storage sa;
+    socklen_t salen = sizeof(sa);
+    char host[INET6_ADDRSTRLEN] = "?";
+    int cfd, i, one = 1;
+
+    cfd = accept4(fd, (struct sockaddr *)&sa, &salen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd == -1) {
+        return;
+    }
+    for (i = 0; i < FANOUT_MAX_CLIENTS && !c; i++) {
+        if (f->clients[i].fd == -1) {
+            c = &f->clients[i];
+        }
+    }
+    if (!c) {
+        fprintf(stderr, "client limit %d reached\n", FANOUT_MAX_CLIENTS);
+        close(cfd);
+        return;
+    }
+
+    memset(c, 0, offsetof(struct fanout_client, line));
+    c->f = f;
+    c->fd = cfd;
+    c->pos = rbuf_head(&f->ring);   /* clients join the live stream */
+    f->naccepted++;
+    if (sa.ss_family == AF_UNIX) {
+        snprintf(c->name, sizeof(c->name), "%s#%d", l->path, f->naccepted);
+    } else {
+        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        getnameinfo((struct sockaddr *)&sa, salen, host, sizeof(host), NULL, 0, NI_NUMERICHOST);
+        snprintf(c->name, sizeof(c->name), "%s:%u", host,
+                 ntohs(sa.ss_family == AF_INET6 ? ((struct sockaddr_in6 *)&sa)->sin6_port
+                                                : ((struct sockaddr_in *)&sa)->sin_port));
+    }
+    if (evloop_add(f->ev, cfd, EV_READ, fanout_on_client, c) == -1) {
+        close(cfd);
+        c->fd = -1;
+        return;
+    }
+    c->events = EV_READ;
+    f->nclients++;
+    fprintf(stderr, "%s: connected, %d client(s)\n", c->name, f->nclients);
+}
+
+/* unix:/path, a bare /path, tcp:[host:]port or a bare port; tcp without
+ * a host stays on the loopback interface */
+static int fanout_listen(struct fanout_listener *l, const char *addr)
+{
+    struct addrinfo hints, *ai;
+    char host[256] = "127.0.0.1", *colon;
+    const char *port = addr;
+    int fd, one = 1;
+
+    if (!strncmp(addr, "unix:", 5) || addr[0] == '/' || addr[0] == '.') {
+        struct sockaddr_un sun;
+
+        l->path = strdup(addr[0] == 'u' ? addr + 5 : addr);
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (!l->path || strlen(l->path) >= sizeof(sun.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(sun.sun_path, l->path);
+        unlink(l->path);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1 || bind(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1 ||
+            listen(fd, 16) == -1) {
+            if (fd != -1) {
+                close(fd);
+            }
+            return -1;
+        }
+        return l->fd = fd;
+    }
+
+    if (!strncmp(addr, "tcp:", 4)) {
+        port = addr + 4;
+    }
+    if ((colon = strrchr(port, ':')) != NULL) {
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - port), port);
+        port = colon + 1;
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    if (getaddrinfo(host, port, &hints, &ai) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd != -1) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if (fd == -1 || bind(fd, ai->ai_addr, ai->ai_addrlen) == -1 || listen(fd, 16) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        freeaddrinfo(ai);
+        return -1;
+    }
+    freeaddrinfo(ai);
+    return l->fd = fd;
+}
+
+static void fanout_on_signal(int fd, int events, void *arg)
+{
+    struct fanout *f = arg;
+
+    if (evloop_signal_ack(fd) > 0) {
+        evloop_stop(f->ev);
+    }
+}
+
+/* owns the open port and serves it to the clients of every address in
+ * the comma separated addrs until SIGINT or the port goes away; client
+ * bytes go to the port as they are, without an added line ending */
+int serial_serve(struct serial_opt *serial, const char *addrs, int slow)
+{
+    struct fanout *f;
+    char *list, *tok, *save = NULL;
+    int i, sigfd, res = 0;
+
+    f = calloc(1, sizeof(*f));
+    list = strdup(addrs);
+    sigfd = evloop_signalfd(SIGINT);
+    if (!f || !list || sigfd == -1 || !(f->ev = evloop_create()) ||
+        rbuf_init(&f->ring, FANOUT_RBUF_SIZE) == -1) {
+        perror("serve");
+        free(list);
+        free(f);
+        return -1;
+    }
+    f->serial = serial;
+    f->slow = slow;
+    serial->endl = 0;
+    for (i = 0; i < FANOUT_MAX_CLIENTS; i++) {
+        f->clients[i].fd = -1;
+    }
+
+    for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        struct fanout_listener *l = &f->listen[f->nlisten];
+
+        if (f->nlisten == FANOUT_MAX_LISTEN) {
+            fprintf(stderr, "Too many addresses, max %d\n", FANOUT_MAX_LISTEN);
+            res = -1;
+            break;
+        }
+        l->f = f;
+        if (fanout_listen(l, tok) == -1) {
+            fprintf(stderr, "Unable to listen on %s : %s\n", tok, strerror(errno));
+            free(l->path);
+            res = -1;
+            break;
+        }
+        evloop_add(f->ev, l->fd, EV_READ, fanout_on_accept, l);
+        fprintf(stderr, "Serving %s on %s\n", serial->name, tok);
+        f->nlisten++;
+    }
+    free(list);
+
+    if (res == 0) {
+        evloop_add(f->ev, sigfd, EV_READ, fanout_on_signal, f);
+        evloop_add(f->ev, serial->handler, EV_READ, fanout_on_port, f);
+        f->port_events = EV_READ;
+        serial_stats_watch(f->ev);
+        fprintf(stderr, "^C to exit.\n");
+
+        while (evloop_running(f->ev)) {
+            if (evloop_run_once(f->ev, -1) == -1) {
+                perror("epoll_wait()");
+                res = -1;
+                break;
+            }
+        }
+    }
+
+    for (i = 0; i < FANOUT_MAX_CLIENTS; i++) {
+        if (f->clients[i].fd != -1) {
+            fanout_client_close(&f->clients[i], "server exit");
+        }
+    }
+    for (i = 0; i < f->nlisten; i++) {
+        close(f->listen[i].fd);
+        if (f->listen[i].path) {
+            unlink(f->listen[i].path);
+            free(f->listen[i].path);
+        }
+    }
+    close(sigfd);
+    evloop_destroy(f->ev);
+    rbuf_free(&f->ring);
+    free(f);
+    return res;
+}
@@ -0,0 +1,19 @@
+#ifndef _FANOUT_H
+#define _FANOUT_H
+
+#include "usbserial.h"
+
+#define FANOUT_RBUF_SIZE    (4 << 20)
+#define FANOUT_MAX_CLIENTS  64
+#define FANOUT_LINE_MAX     4096
+
+/* what to do with a client that fell more than 3/4 of the ring behind */
+enum {
+    FANOUT_SLOW_DROP = 0,   /* disconnect it */
+    FANOUT_SLOW_SKIP,       /* jump it to live data, it loses the gap */
+};
+
+int fanout_parse_slow(const char *name);
+int serial_serve(struct serial_opt *serial, const char *addrs, int slow);
+
+#endif
@@ -0,0 +1,257 @@
+/*  frame.c - incremental COBS, SLIP, HDLC and length-prefixed decoders.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "scan.h"
+#include "frame.h"
+
+#define SLIP_END        0xC0
+#define SLIP_ESC        0xDB
+#define SLIP_ESC_END    0xDC
+#define SLIP_ESC_ESC    0xDD
+
+#define HDLC_FLAG       0x7E
+#define HDLC_ESC        0x7D
+#define HDLC_XOR        0x20
+#define HDLC_GOOD_FCS   0xF0B8      /* CRC-16/X.25 residue over data + FCS */
+
+static const struct {
+    const char *name;
+    int type;
+} frame_types[] = {
+    { "cobs",   FRAME_COBS },
+    { "slip",   FRAME_SLIP },
+    { "hdlc",   FRAME_HDLC },
+    { "len",    FRAME_LEN },
+};
+
+/* bytes that end a run of plain payload */
+static const char slip_special[] = { (char)SLIP_END, (char)SLIP_ESC };
+static const char hdlc_special[] = { (char)HDLC_FLAG, (char)HDLC_ESC };
+
+int frame_parse_type(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(frame_types) / sizeof(frame_types[0]); i++) {
+        if (!strcmp(name, frame_types[i].name)) {
+            return frame_types[i].type;
+        }
+    }
+    return -1;
+}
+
+int frame_init(struct frame_dec *d, int type, size_t max)
+{
+    memset(d, 0, sizeof(*d));
+    d->type = type;
+    d->max = max;
+    /* one spare byte so the callback can terminate the frame in place */
+    d->buf = malloc(max + 1);
+    return d->buf ? 0 : -1;
+}
+
+void frame_free(struct frame_dec *d)
+{
+    free(d->buf);
+    d->buf = NULL;
+}
+
+static void frame_put(struct frame_dec *d, const void *p, size_t n)
+{
+    if (d->drop) {
+        return;
+    }
+    if (d->len + n > d->max) {
+        d->drop = 1;
+        return;
+    }
+    memcpy(d->buf + d->len, p, n);
+    d->len += n;
+}
+
+/* hands over a finished frame (unless it was bad) and starts the next */
+static int frame_emit(struct frame_dec *d, size_t len, int ok, frame_cb cb, void *arg)
+{
+    int res = 0;
+
+    if (d->drop || !ok) {
+        d->errors++;
+    } else {
+        d->frames++;
+        res = cb(d->buf, len, arg);
+    }
+    d->len = 0;
+    d->drop = 0;
+    d->esc = 0;
+    d->code = 0;
+    d->left = 0;
+    d->hdr = 0;
+    return res;
+}
+
+static size_t frame_slip(struct frame_dec *d, const unsigned char *p, const unsigned char *end,
+                         frame_cb cb, void *arg)
+{
+    const unsigned char *start = p, *q;
+    unsigned char c;
+
+    while (p < end) {
+        if (d->esc) {
+            c = (*p == SLIP_ESC_END) ? SLIP_END : (*p == SLIP_ESC_ESC) ? SLIP_ESC : *p;
+            frame_put(d, &c, 1);
+            d->esc = 0;
+            p++;
+            continue;
+        }
+        q = p + scan->find_set((const char *)p, end - p, slip_special, sizeof(slip_special));
+        frame_put(d, p, q - p);
+        if ((p = q) == end) {
+            break;
+        }
+        if (*p++ == SLIP_ESC) {
+            d->esc = 1;
+        } else if ((d->len || d->drop) && frame_emit(d, d->len, 1, cb, arg)) {
+            break;
+        }
+    }
+    return p - start;
+}
+
+static size_t frame_hdlc(struct frame_dec *d, const unsigned char *p, const unsigned char *end,
+                         frame_cb cb, void *arg)
+{
+    const unsigned char *start = p, *q;
+    unsigned char c;
+    int ok;
+
+    while (p < end) {
+        if (d->esc) {
+            c = *p++ ^ HDLC_XOR;
+            frame_put(d, &c, 1);
+            d->esc = 0;
+            continue;
+        }
+        q = p + scan->find_set((const char *)p, end - p, hdlc_special, sizeof(hdlc_special));
+        frame_put(d, p, q - p);
+        if ((p = q) == end) {
+            break;
+        }
+        if (*p++ == HDLC_ESC) {
+            d->esc = 1;
+            continue;
+        }
+        /* back to back flags delimit nothing */
+        if (!d->len && !d->drop) {
+            continue;
+        }
+        ok = d->len >= 2 && scan->crc16(0xFFFF, d->buf, d->len) == HDLC_GOOD_FCS;
+        if (frame_emit(d, d->len - 2, ok, cb, arg)) {
+            break;
+        }
+    }
+    return p - start;
+}
+
+static size_t frame_cobs(struct frame_dec *d, const unsigned char *p, const unsigned char *end,
+                         frame_cb cb, void *arg)
+{
+    const unsigned char *start = p;
+    size_t n, z;
+
+    while (p < end) {
+        if (!d->left) {
+            unsigned int c = *p++;
+
+            if (!c) {
+                if ((d->code || d->drop) && frame_emit(d, d->len, 1, cb, arg)) {
+                    break;
+                }
+                continue;
+            }
+            /* a block shorter than 254 bytes stood for a zero */
+            if (d->code && d->code != 0xFF) {
+                frame_put(d, "", 1);
+            }
+            d->code = c;
+            d->left = c - 1;
+            continue;
+        }
+        n = (size_t)(end - p) < d->left ? (size_t)(end - p) : d->left;
+        if ((z = scan->find((const char *)p, n, 0)) < n) {
+            /* delimiter inside a block: the frame was cut short */
+            d->drop = 1;
+            d->left = 0;
+            p += z;
+            continue;
+        }
+        frame_put(d, p, n);
+        d->left -= n;
+        p += n;
+    }
+    return p - start;
+}
+
+static size_t frame_len(struct frame_dec *d, const unsigned char *p, const unsigned char *end,
+                        frame_cb cb, void *arg)
+{
+    const unsigned char *start = p;
+    size_t n;
+
+    while (p < end) {
+        if (d->hdr < 2) {
+            d->left = (d->left << 8) | *p++;
+            if (++d->hdr < 2) {
+                continue;
+            }
+            if (d->left > d->max) {
+                d->drop = 1;
+            }
+        } else {
+            n = (size_t)(end - p) < d->left ? (size_t)(end - p) : d->left;
+            frame_put(d, p, n);
+            d->left -= n;
+            p += n;
+        }
+        if (!d->left && frame_emit(d, d->len, 1, cb, arg)) {
+            break;
+        }
+    }
+    return p - start;
+}
+
+/* feeds one contiguous span, returns the bytes consumed: all of them
+ * unless cb asked to stop, then up to the end of that frame */
+size_t frame_decode(struct frame_dec *d, const char *buf, size_t len, frame_cb cb, void *arg)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+
+    switch (d->type) {
+    case FRAME_COBS:
+        return frame_cobs(d, p, p + len, cb, arg);
+    case FRAME_SLIP:
+        return frame_slip(d, p, p + len, cb, arg);
+    case FRAME_HDLC:
+        return frame_hdlc(d, p, p + len, cb, arg);
+    case FRAME_LEN:
+        return frame_len(d, p, p + len, cb, arg);
+    }
+    return len;
+}
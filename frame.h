@@ -0,0 +1,39 @@
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include <stddef.h>
+
+enum {
+    FRAME_NONE = 0,
+    FRAME_COBS,             /* 0x00 delimited, consistent overhead byte stuffing */
+    FRAME_SLIP,             /* RFC 1055 */
+    FRAME_HDLC,             /* 0x7E flags, 0x7D escapes, CRC-16/X.25 FCS */
+    FRAME_LEN,              /* 16 bit big endian length, then the payload */
+};
+
+#define FRAME_MAX_DEFAULT   65536
+
+/* called once per decoded frame, frame[len] may be written by the callee;
+ * a non-zero return stops decoding right after this frame */
+typedef int (*frame_cb)(char *frame, size_t len, void *arg);
+
+/* incremental decoder, keeps a partial frame across calls */
+struct frame_dec {
+    int type;
+    char *buf;
+    size_t len;
+    size_t max;
+    int esc;                /* SLIP/HDLC escape byte seen */
+    int drop;               /* frame overflowed or is corrupt, skip to its end */
+    unsigned int code;      /* COBS: current code, 0 before the first block */
+    unsigned int left;      /* COBS: bytes left in the block, LEN: bytes of payload */
+    unsigned int hdr;       /* LEN: length bytes collected */
+    unsigned long frames;
+    unsigned long errors;
+};
+
+int frame_parse_type(const char *name);
+int frame_init(struct frame_dec *d, int type, size_t max);
+void frame_free(struct frame_dec *d);
+size_t frame_decode(struct frame_dec *d, const char *buf, size_t len, frame_cb cb, void *arg);
+#endif
@@ -0,0 +1,128 @@
+/*  hexdump.c - table driven hex/ASCII rendering of the RX stream.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "hexdump.h"
+
+/* offsets past 4 GB get 16 digits, every column moves right by 8 */
+#define HEX_WIDE        8
+#define HEX_COL(nd, c)  ((nd) + 2 + 3 * (c) + ((c) >= 8))
+#define HEX_ASCII(nd)   ((nd) + 53)
+#define HEX_LEN(nd)     ((nd) + 71)
+
+static char hex_pair[256][2];
+static char hex_ascii[256];
+static char hex_blank[2][HEX_LINE_LEN + HEX_WIDE];
+static const char hex_indent[HEX_STAMP_MAX + 1] = "                               ";
+
+static void hex_tables(void)
+{
+    static const char digits[] = "0123456789abcdef";
+    int i, nd;
+
+    for (i = 0; i < 256; i++) {
+        hex_pair[i][0] = digits[i >> 4];
+        hex_pair[i][1] = digits[i & 15];
+        hex_ascii[i] = (i >= 0x20 && i < 0x7f) ? i : '.';
+    }
+    for (i = 0; i < 2; i++) {
+        nd = 8 + i * HEX_WIDE;
+        memset(hex_blank[i], ' ', sizeof(hex_blank[i]));
+        hex_blank[i][HEX_ASCII(nd) - 1] = '|';
+        hex_blank[i][HEX_ASCII(nd) + HEX_PER_LINE] = '|';
+        hex_blank[i][HEX_LEN(nd) - 1] = '\n';
+    }
+}
+
+int hexdump_init(struct hexdump *h, int stamps)
+{
+    /* whole lines, plus one for a chunk that starts inside a line */
+    size_t lines = HEX_CHUNK / HEX_PER_LINE + 1;
+
+    memset(h, 0, sizeof(*h));
+    h->stamps = stamps;
+    if (!(h->out = malloc(lines * (HEX_LINE_LEN + HEX_WIDE + HEX_STAMP_MAX)))) {
+        return -1;
+    }
+    hex_tables();
+    return 0;
+}
+
+static void hex_offset(char *o, uint64_t off, int nd)
+{
+    for (nd -= 2; nd >= 0; nd -= 2, off >>= 8) {
+        o[nd] = hex_pair[off & 0xff][0];
+        o[nd + 1] = hex_pair[off & 0xff][1];
+    }
+}
+
+/* renders up to HEX_CHUNK bytes into out, one blank line template
+ * copy plus three stores per byte; returns the length rendered */
+size_t hexdump_render(struct hexdump *h, const char *buf, size_t len, uint64_t ts_ns, char *out)
+{
+    const unsigned char *p = (const unsigned char *)buf, *end = p + len;
+    char stamp[HEX_STAMP_MAX + 1];
+    const char *prefix = stamp;
+    unsigned int col;
+    uint64_t base;
+    char *o = out, *x;
+    int nd, plen = 0;
+
+    if (h->stamps) {
+        if (!h->start_ns) {
+            h->start_ns = ts_ns;
+        }
+        /* the prefix is as wide as the stamp, every line of the chunk
+         * gets the same width */
+        plen = snprintf(stamp, sizeof(stamp), "[%12.6f] ", (ts_ns - h->start_ns) / 1e9);
+        if (plen < 0 || plen > HEX_STAMP_MAX) {
+            plen = HEX_STAMP_MAX;
+        }
+    }
+    while (p < end) {
+        if (h->stamps) {
+            memcpy(o, prefix, plen);
+            o += plen;
+            prefix = hex_indent;
+        }
+        base = h->offset & ~(uint64_t)(HEX_PER_LINE - 1);
+        col = h->offset & (HEX_PER_LINE - 1);
+        nd = (base >> 32) ? 8 + HEX_WIDE : 8;
+        memcpy(o, hex_blank[nd != 8], HEX_LEN(nd));
+        hex_offset(o, base, nd);
+
+        h->offset += (end - p < HEX_PER_LINE - col) ? (unsigned int)(end - p) : HEX_PER_LINE - col;
+        for (; col < HEX_PER_LINE && p < end; col++, p++) {
+            x = o + HEX_COL(nd, col);
+            x[0] = hex_pair[*p][0];
+            x[1] = hex_pair[*p][1];
+            o[HEX_ASCII(nd) + col] = hex_ascii[*p];
+        }
+        o += HEX_LEN(nd);
+    }
+    return o - out;
+}
+
+void hexdump_free(struct hexdump *h)
+{
+    free(h->out);
+    h->out = NULL;
+}
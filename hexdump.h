@@ -0,0 +1,31 @@
+#ifndef _HEXDUMP_H
+#define _HEXDUMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* -x rendering, hexdump -C columns at a fixed width:
+ *
+ *   00000010  48 65 6c 6c 6f 2c 20 77  6f 72 6c 64 0a 00 01 02  |Hello, world....|
+ *
+ * A byte always sits in the column of its stream offset % 16, a chunk
+ * that starts or ends inside a line leaves the other columns blank.
+ * With stamps every chunk's first line is prefixed with the seconds
+ * since the first chunk, its other lines are indented to match. */
+#define HEX_PER_LINE    16
+#define HEX_LINE_LEN    79          /* including the newline */
+#define HEX_STAMP_MAX   31          /* "[%12.6f] ", wider past 100000 s */
+#define HEX_CHUNK       (64 * 1024) /* input per hexdump_render() into out */
+
+struct hexdump {
+    uint64_t offset;                /* stream offset of the next byte */
+    int stamps;
+    uint64_t start_ns;
+    char *out;                      /* room for HEX_CHUNK rendered */
+};
+
+int hexdump_init(struct hexdump *h, int stamps);
+size_t hexdump_render(struct hexdump *h, const char *buf, size_t len, uint64_t ts_ns, char *out);
+void hexdump_free(struct hexdump *h);
+
+#endif
@@ -0,0 +1,591 @@
+/*  multiport.c - capture many serial ports from one event loop.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <signal.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/uio.h>
+
+#include "usbserial_linux.h"
+#include "usbserial.h"
+#include "rbuff.h"
+#include "evloop.h"
+#include "multiport.h"
+#include "capture.h"
+#include "stats.h"
+#include "uring.h"
+
+#define PORT_RBUF_SIZE  65536
+#define PORT_TAG_LEN    64
+#define PORT_MAX_IOV    64
+
+/* io_uring user_data: what completed in the high half, the port below */
+#define MULTI_UD(kind, i)   ((uint64_t)(kind) << 32 | (uint32_t)(i))
+#define MULTI_UD_KIND(ud)   ((int)((ud) >> 32))
+#define MULTI_UD_PORT(ud)   ((int)(uint32_t)(ud))
+
+enum {
+    MULTI_UD_READ = 0,
+    MULTI_UD_WRITE,
+    MULTI_UD_POLL,
+    MULTI_UD_SIGNAL,
+    MULTI_UD_TIMER,
+    MULTI_UD_STATS,         /* SIGUSR1 or --stats, the fd below */
+    MULTI_UD_CANCEL,
+};
+
+struct serial_port {
+    struct serial_opt opt;
+    rbuf_t ring;
+    int out_fd;             /* per-port file, or stdout for tagged lines */
+    int tagged;
+    int line_start;
+    char tag[PORT_TAG_LEN];
+    int taglen;
+    unsigned long long bytes;
+    size_t wlen;            /* io_uring: write in flight from ring.buf */
+};
+
+struct serial_multi {
+    struct evloop *ev;
+    struct capture *cap;        /* one record file for all ports */
+    struct serial_port *ports;
+    int nports;
+    int open_ports;
+    struct uring *uring;        /* NULL on the epoll loop */
+    int fixed;                  /* port rings are registered buffers */
+    int sigfd;
+    int timerfd;
+    int res;
+};
+
+static const struct {
+    const char *name;
+    int io;
+} multi_io_names[] = {
+    { "epoll",  MULTI_IO_EPOLL },
+    { "uring",  MULTI_IO_URING },
+};
+
+int multi_parse_io(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(multi_io_names) / sizeof(multi_io_names[0]); i++) {
+        if (!strcmp(name, multi_io_names[i].name)) {
+            return multi_io_names[i].io;
+        }
+    }
+    return -1;
+}
+
+/* expands a comma separated list of device names or globs */
+static int multi_expand(const char *devices, glob_t *g)
+{
+    char *list = strdup(devices), *tok, *save = NULL;
+    int flags = GLOB_NOCHECK;
+
+    if (!list) {
+        return -1;
+    }
+    memset(g, 0, sizeof(*g));
+    for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        glob(tok, flags, NULL, g);
+        flags |= GLOB_APPEND;
+    }
+    free(list);
+    return g->gl_pathc ? 0 : -1;
+}
+
+static int multi_open_output(struct serial_port *port, const char *outdir)
+{
+    const char *base = strrchr(port->opt.name, '/');
+    char path[PATH_MAX];
+
+    base = base ? base + 1 : port->opt.name;
+    port->taglen = snprintf(port->tag, sizeof(port->tag), "[%s] ", base);
+    port->line_start = 1;
+
+    if (!outdir) {
+        port->tagged = 1;
+        port->out_fd = _fileno(stdout);
+        return 0;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s.log", outdir, base);
+    port->out_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    return port->out_fd;
+}
+
+/* stdout is shared: prefix every line with the port tag, one writev per batch */
+static int multi_write_tagged(struct serial_port *port, const char *buf, size_t len)
+{
+    struct iovec iov[PORT_MAX_IOV];
+    const char *p = buf, *end = buf + len, *nl;
+    int n = 0;
+
+    while (p < end) {
+        if (port->line_start) {
+            iov[n].iov_base = port->tag;
+            iov[n++].iov_len = port->taglen;
+        }
+        nl = memchr(p, '\n', end - p);
+        iov[n].iov_base = (void *)p;
+        iov[n++].iov_len = nl ? (size_t)(nl + 1 - p) : (size_t)(end - p);
+        port->line_start = (nl != NULL);
+        p = nl ? nl + 1 : end;
+
+        if (n >= PORT_MAX_IOV - 1 || p == end) {
+            if (serial_write_outv(port->out_fd, iov, n) == -1) {
+                return -1;
+            }
+            n = 0;
+        }
+    }
+    return 0;
+}
+
+static struct io_uring_sqe *multi_uring_sqe(struct serial_multi *m)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(m->uring);
+
+    if (!sqe && uring_submit_and_wait(m->uring, 0) != -1) {
+        sqe = uring_get_sqe(m->uring);
+    }
+    return sqe;
+}
+
+/* kills the port's read and poll, their -ECANCELED completions are then
+ * ignored as the handler is -1 */
+static void multi_uring_cancel(struct serial_multi *m, int i)
+{
+    static const int kinds[] = { MULTI_UD_READ, MULTI_UD_POLL };
+    struct io_uring_sqe *sqe;
+    size_t k;
+
+    for (k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        if ((sqe = multi_uring_sqe(m)) != NULL) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = MULTI_UD(kinds[k], i);
+            sqe->user_data = MULTI_UD(MULTI_UD_CANCEL, i);
+        }
+    }
+}
+
+static void multi_close_port(struct serial_multi *m, struct serial_port *port)
+{
+    if (m->uring) {
+        multi_uring_cancel(m, port - m->ports);
+    }
+    evloop_del(m->ev, port->opt.handler);
+    serial_port_close(&port->opt);
+    port->opt.handler = -1;
+    if (--m->open_ports == 0) {
+        evloop_stop(m->ev);
+    }
+}
+
+static int multi_deliver(struct serial_multi *m, struct serial_port *port,
+                         const char *buf, size_t len, uint64_t ts)
+{
+    int wres;
+
+    if (m->cap) {
+        wres = capture_record(m->cap, port - m->ports + 1, ts, buf, len);
+    } else if (port->tagged) {
+        wres = multi_write_tagged(port, buf, len);
+    } else {
+        wres = serial_write_out(port->out_fd, buf, len);
+    }
+    if (wres == -1) {
+        fprintf(stderr, "%s: write failed: %s\n", port->opt.name, strerror(errno));
+        return -1;
+    }
+    port->bytes += len;
+    return 0;
+}
+
+static void multi_on_port(int fd, int events, void *arg)
+{
+    struct serial_multi *m = arg;
+    struct serial_port *port = NULL;
+    size_t len;
+    char *span;
+    int i, res;
+    uint64_t ts;
+
+    for (i = 0; i < m->nports; i++) {
+        if (m->ports[i].opt.handler == fd) {
+            port = &m->ports[i];
+            break;
+        }
+    }
+    if (!port) {
+        return;
+    }
+
+    res = serial_port_read_rbuff(&port->opt, &port->ring);
+    ts = capfmt_now();
+
+    /* the ring is only staging, drain it completely on every wakeup */
+    while ((span = rbuf_read_span(&port->ring, &len)) != NULL) {
+        if (multi_deliver(m, port, span, len, ts) == -1) {
+            multi_close_port(m, port);
+            return;
+        }
+        rbuf_read_commit(&port->ring, len);
+    }
+
+    if (res == -1 || (res == 0 && (events & (EV_HUP | EV_ERR)))) {
+        fprintf(stderr, "%s: port closed\n", port->opt.name);
+        multi_close_port(m, port);
+    }
+}
+
+static void multi_on_timer(int fd, int events, void *arg)
+{
+    struct serial_multi *m = arg;
+
+    evloop_timer_ack(fd);
+    if (capture_tick(m->cap) == -1) {
+        fprintf(stderr, "%s: capture failed: %s\n", m->cap->path, strerror(errno));
+        m->res = -1;
+        evloop_stop(m->ev);
+        return;
+    }
+    evloop_timer_set(fd, CAPTURE_FLUSH_MS);
+}
+
+static void multi_on_signal(int fd, int events, void *arg)
+{
+    struct serial_multi *m = arg;
+
+    if (evloop_signal_ack(fd) > 0) {
+        evloop_stop(m->ev);
+    }
+}
+
+/* a read into the port's ring buffer, behind a POLL_ADD when the kernel
+ * could not wait on the tty itself (-EAGAIN on older kernels) */
+static int multi_uring_arm(struct serial_multi *m, struct serial_port *port, int poll_first)
+{
+    struct io_uring_sqe *sqe;
+    int i = port - m->ports;
+
+    if (poll_first) {
+        if (!(sqe = multi_uring_sqe(m))) {
+            return -1;
+        }
+        uring_prep_poll(sqe, port->opt.handler, POLLIN, MULTI_UD(MULTI_UD_POLL, i));
+        sqe->flags |= IOSQE_IO_LINK;
+    }
+    if (!(sqe = multi_uring_sqe(m))) {
+        return -1;
+    }
+    uring_prep_rw(sqe, m->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ, port->opt.handler,
+                  port->ring.buf, port->ring.size, (uint64_t)-1, MULTI_UD(MULTI_UD_READ, i));
+    sqe->buf_index = i;
+    return 0;
+}
+
+static int multi_uring_poll(struct serial_multi *m, int fd, int kind)
+{
+    struct io_uring_sqe *sqe = multi_uring_sqe(m);
+
+    if (!sqe) {
+        return -1;
+    }
+    uring_prep_poll(sqe, fd, POLLIN, MULTI_UD(kind, fd));
+    return 0;
+}
+
+/* per-port files: the write goes out of the ring buffer and the next read
+ * is linked behind it, both in the same submission */
+static int multi_uring_write(struct serial_multi *m, struct serial_port *port, size_t len)
+{
+    struct io_uring_sqe *sqe = multi_uring_sqe(m);
+    int i = port - m->ports;
+
+    if (!sqe) {
+        return -1;
+    }
+    uring_prep_rw(sqe, m->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, port->out_fd,
+                  port->ring.buf, len, (uint64_t)-1, MULTI_UD(MULTI_UD_WRITE, i));
+    sqe->buf_index = i;
+    sqe->flags |= IOSQE_IO_LINK;
+    port->wlen = len;
+    port->bytes += len;
+    return multi_uring_arm(m, port, 0);
+}
+
+static void multi_uring_read_done(struct serial_multi *m, struct serial_port *port, int res)
+{
+    int again;
+
+    if (res > 0) {
+        stats_rx_read(res);
+        if (!m->cap && !port->tagged) {
+            again = multi_uring_write(m, port, res);
+        } else {
+            again = multi_deliver(m, port, port->ring.buf, res, capfmt_now());
+            if (again == 0) {
+                again = multi_uring_arm(m, port, 0);
+            }
+        }
+    } else if (res == -EAGAIN || res == -EINTR) {
+        again = multi_uring_arm(m, port, res == -EAGAIN);
+    } else if (res == -ECANCELED) {
+        /* behind a short write or a failed poll, handled there */
+        return;
+    } else {
+        fprintf(stderr, "%s: port closed\n", port->opt.name);
+        again = -1;
+    }
+    if (again == -1) {
+        multi_close_port(m, port);
+    }
+}
+
+static void multi_uring_write_done(struct serial_multi *m, struct serial_port *port, int res)
+{
+    if (res >= 0 && (size_t)res == port->wlen) {
+        return;
+    }
+    /* the linked read was cancelled: finish by hand and rearm */
+    if (res < 0 || serial_write_out(port->out_fd, port->ring.buf + res, port->wlen - res) == -1 ||
+        multi_uring_arm(m, port, 0) == -1) {
+        fprintf(stderr, "%s: write failed: %s\n", port->opt.name, strerror(res < 0 ? -res : errno));
+        multi_close_port(m, port);
+    }
+}
+
+static void multi_uring_complete(struct serial_multi *m, uint64_t ud, int res)
+{
+    struct serial_port *port;
+
+    switch (MULTI_UD_KIND(ud)) {
+    case MULTI_UD_SIGNAL:
+        if (evloop_signal_ack(m->sigfd) > 0) {
+            evloop_stop(m->ev);
+        } else {
+            multi_uring_poll(m, m->sigfd, MULTI_UD_SIGNAL);
+        }
+        return;
+    case MULTI_UD_TIMER:
+        multi_on_timer(m->timerfd, EV_READ, m);
+        multi_uring_poll(m, m->timerfd, MULTI_UD_TIMER);
+        return;
+    case MULTI_UD_STATS:
+        serial_on_stats(MULTI_UD_PORT(ud), EV_READ, NULL);
+        multi_uring_poll(m, MULTI_UD_PORT(ud), MULTI_UD_STATS);
+        return;
+    case MULTI_UD_CANCEL:
+        return;
+    }
+    port = &m->ports[MULTI_UD_PORT(ud)];
+    if (port->opt.handler == -1) {
+        return;
+    }
+    switch (MULTI_UD_KIND(ud)) {
+    case MULTI_UD_READ:
+        multi_uring_read_done(m, port, res);
+        break;
+    case MULTI_UD_WRITE:
+        multi_uring_write_done(m, port, res);
+        break;
+    case MULTI_UD_POLL:
+        if (res < 0) {
+            fprintf(stderr, "%s: poll failed: %s\n", port->opt.name, strerror(-res));
+            multi_close_port(m, port);
+        }
+        break;
+    }
+}
+
+/* the whole capture on one io_uring: every port keeps a read posted and
+ * each pass is a single io_uring_enter that submits the rearmed reads and
+ * queued writes and waits for the next completion */
+static int multi_run_uring(struct serial_multi *m)
+{
+    struct io_uring_cqe *cqe;
+    struct iovec *iov;
+    struct uring u;
+    uint64_t start;
+    int i, n, stats[2];
+
+    if (uring_init(&u, m->nports * 4 + 6) == -1) {
+        fprintf(stderr, "io_uring unavailable (%s), using epoll\n", strerror(errno));
+        return -1;
+    }
+    m->uring = &u;
+    /* pinned once, READ_FIXED/WRITE_FIXED skip the page walk; RLIMIT_MEMLOCK
+     * may refuse and plain READ/WRITE do the same job */
+    if ((iov = calloc(m->nports, sizeof(*iov))) != NULL) {
+        for (i = 0; i < m->nports; i++) {
+            iov[i].iov_base = m->ports[i].ring.buf;
+            iov[i].iov_len = m->ports[i].ring.size;
+        }
+        m->fixed = uring_register_buffers(&u, iov, m->nports) == 0;
+        free(iov);
+    }
+
+    multi_uring_poll(m, m->sigfd, MULTI_UD_SIGNAL);
+    if (m->timerfd != -1) {
+        multi_uring_poll(m, m->timerfd, MULTI_UD_TIMER);
+    }
+    n = serial_stats_fds(stats);
+    for (i = 0; i < n; i++) {
+        multi_uring_poll(m, stats[i], MULTI_UD_STATS);
+    }
+    for (i = 0; i < m->nports; i++) {
+        multi_uring_arm(m, &m->ports[i], 0);
+    }
+
+    while (m->open_ports && evloop_running(m->ev)) {
+        start = stats_now();
+        if (uring_submit_and_wait(&u, 1) == -1) {
+            perror("io_uring_enter()");
+            break;
+        }
+        stats_rx_wakeup(stats_now() - start);
+        while ((cqe = uring_peek_cqe(&u)) != NULL) {
+            uint64_t ud = cqe->user_data;
+            int res = cqe->res;
+
+            uring_cqe_seen(&u);
+            multi_uring_complete(m, ud, res);
+        }
+    }
+    fprintf(stderr, "io_uring: %llu enters%s\n", u.enters, m->fixed ? ", fixed buffers" : "");
+
+    /* closing the ring cancels what is still in flight */
+    uring_exit(&u);
+    m->uring = NULL;
+    return 0;
+}
+
+/* opens every device matched by devices (list or globs) with the settings
+ * of tmpl and multiplexes them on one event loop until SIGINT or until all
+ * of them are gone; output goes to outdir/<dev>.log, tagged to stdout or,
+ * with cap, into one record file where port ids follow the device order */
+int serial_multi_capture(struct serial_opt *tmpl, const char *devices,
+                         const char *outdir, struct capture *cap, int io)
+{
+    struct serial_multi m;
+    glob_t g;
+    size_t i;
+    int sigfd, timerfd = -1;
+
+    memset(&m, 0, sizeof(m));
+    m.cap = cap;
+    if (multi_expand(devices, &g) == -1) {
+        fprintf(stderr, "No devices match %s\n", devices);
+        return -1;
+    }
+
+    sigfd = evloop_signalfd(SIGINT);
+    m.ev = evloop_create();
+    m.ports = calloc(g.gl_pathc, sizeof(*m.ports));
+    if (!m.ev || !m.ports || sigfd == -1) {
+        perror("multi capture");
+        globfree(&g);
+        return -1;
+    }
+    evloop_add(m.ev, sigfd, EV_READ, multi_on_signal, &m);
+    if (cap && (timerfd = evloop_timerfd()) != -1) {
+        evloop_add(m.ev, timerfd, EV_READ, multi_on_timer, &m);
+        evloop_timer_set(timerfd, CAPTURE_FLUSH_MS);
+    }
+    serial_stats_watch(m.ev);
+
+    for (i = 0; i < g.gl_pathc; i++) {
+        struct serial_port *port = &m.ports[m.nports];
+
+        port->opt = *tmpl;
+        port->opt.name = strdup(g.gl_pathv[i]);
+        port->opt.handler = -1;
+        port->out_fd = -1;
+
+        if (serial_port_open(&port->opt) == -1) {
+            fprintf(stderr, "Unable to open %s : %s\n", port->opt.name, strerror(errno));
+            free(port->opt.name);
+            continue;
+        }
+        if (rbuf_init(&port->ring, PORT_RBUF_SIZE) == -1 ||
+            (!cap && multi_open_output(port, outdir) == -1) ||
+            evloop_add(m.ev, port->opt.handler, EV_READ, multi_on_port, &m) == -1) {
+            fprintf(stderr, "%s: setup failed: %s\n", port->opt.name, strerror(errno));
+            serial_port_close(&port->opt);
+            if (!cap && !port->tagged && port->out_fd != -1) {
+                close(port->out_fd);
+            }
+            rbuf_free(&port->ring);
+            free(port->opt.name);
+            /* the slot goes to the next device */
+            memset(port, 0, sizeof(*port));
+            continue;
+        }
+        if (cap) {
+            fprintf(stderr, "#%d %s\n", m.nports + 1, port->opt.name);
+        }
+        m.nports++;
+        m.open_ports++;
+    }
+    globfree(&g);
+
+    fprintf(stderr, "Capturing %d port(s), ^C to exit.\n", m.nports);
+
+    m.sigfd = sigfd;
+    m.timerfd = timerfd;
+    if (io != MULTI_IO_URING || multi_run_uring(&m) == -1) {
+        while (m.open_ports && evloop_running(m.ev)) {
+            if (evloop_run_once(m.ev, -1) == -1) {
+                perror("epoll_wait()");
+                break;
+            }
+            stats_rx_wakeup(evloop_last_wait(m.ev));
+        }
+    }
+
+    for (i = 0; i < (size_t)m.nports; i++) {
+        struct serial_port *port = &m.ports[i];
+
+        fprintf(stderr, "%s: %llu bytes\n", port->opt.name, port->bytes);
+        if (port->opt.handler != -1) {
+            serial_port_close(&port->opt);
+        }
+        if (!cap && !port->tagged && port->out_fd != -1) {
+            close(port->out_fd);
+        }
+        rbuf_free(&port->ring);
+        free(port->opt.name);
+    }
+    free(m.ports);
+    if (timerfd != -1) {
+        close(timerfd);
+    }
+    evloop_destroy(m.ev);
+    return m.res;
+}
@@ -0,0 +1,18 @@
+#ifndef _MULTIPORT_H
+#define _MULTIPORT_H
+
+#include "usbserial.h"
+
+struct capture;
+
+/* -M event loops: epoll readiness plus read(), or io_uring completions */
+enum {
+    MULTI_IO_EPOLL = 0,
+    MULTI_IO_URING,
+};
+
+int multi_parse_io(const char *name);
+int serial_multi_capture(struct serial_opt *tmpl, const char *devices,
+                         const char *outdir, struct capture *cap, int io);
+
+#endif
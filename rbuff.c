@@ -2,51 +2,177 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
 
 #include "rbuff.h"
 
-void rbuf_init(rbuf_t *b)
+/* head is only stored by the producer and tail only by the consumer,
+ * the other side observes them with acquire/release ordering */
+static size_t load_acquire(const size_t *p)
 {
-    memset(&b->buf, 0, BUFSIZE);
-    b->pIn = b->pOut = b->buf;
-    b->pEnd = &b->buf[BUFSIZE];
-    b->len = 0;
+#ifdef _WIN32
+    size_t v = *(volatile const size_t *)p;
+    MemoryBarrier();
+    return v;
+#else
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static void store_release(size_t *p, size_t v)
+{
+#ifdef _WIN32
+    MemoryBarrier();
+    *(volatile size_t *)p = v;
+#else
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#endif
+}
+
+/* size is rounded up to a power of two, past SIZE_MAX / 2 there is none */
+int rbuf_init(rbuf_t *b, size_t size)
+{
+    size_t cap = 1;
+
+    memset(b, 0, sizeof(*b));
+    if (size > SIZE_MAX / 2) {
+        errno = EINVAL;
+        return -1;
+    }
+    while (cap < size) {
+        cap <<= 1;
+    }
+
+    b->buf = malloc(cap);
+    if (!b->buf) {
+        return -1;
+    }
+    b->size = cap;
+    b->mask = cap - 1;
+    return 0;
+}
+
+void rbuf_free(rbuf_t *b)
+{
+    free(b->buf);
+    b->buf = NULL;
+    b->size = b->mask = 0;
+}
+
+size_t rbuf_len(rbuf_t *b)
+{
+    return load_acquire(&b->head) - load_acquire(&b->tail);
+}
+
+size_t rbuf_space(rbuf_t *b)
+{
+    return b->size - rbuf_len(b);
 }
 
 int rbuf_is_full(rbuf_t *b)
 {
-    return b->len == BUFSIZE;
+    return rbuf_len(b) == b->size;
 }
 
 int rbuf_is_empty(rbuf_t *b)
 {
-	return b->len == 0;
+    return rbuf_len(b) == 0;
 }
 
 int rbuf_put(rbuf_t *b, char c)
 {
-    if (b->pIn == b->pOut && rbuf_is_full(b)) {
-        return 0;
-    }
-
-    *b->pIn++ = c;
-    b->len++;
-    if (b->pIn >= b->pEnd) {
-        b->pIn = b->buf;
-    }
-    return 1;
+    return rbuf_write(b, &c, 1) == 1;
 }
 
 int rbuf_get(rbuf_t *b, char *pc)
 {
-    if (b->pIn == b->pOut && rbuf_is_empty(b)) {
-        return 0;
-    }
+    return rbuf_read(b, pc, 1) == 1;
+}
+
+/* contiguous free region at head, NULL when full */
+char *rbuf_write_span(rbuf_t *b, size_t *len)
+{
+    size_t head = b->head;
+    size_t off = head & b->mask;
+    size_t room = b->size - (head - load_acquire(&b->tail));
+
+    *len = (room < b->size - off) ? room : b->size - off;
+    return *len ? &b->buf[off] : NULL;
+}
+
+/* publish n bytes written into the span returned by rbuf_write_span */
+void rbuf_write_commit(rbuf_t *b, size_t n)
+{
+    store_release(&b->head, b->head + n);
+}
+
+/* contiguous readable region at tail, NULL when empty */
+char *rbuf_read_span(rbuf_t *b, size_t *len)
+{
+    size_t tail = b->tail;
+    size_t off = tail & b->mask;
+    size_t avail = load_acquire(&b->head) - tail;
+
+    *len = (avail < b->size - off) ? avail : b->size - off;
+    return *len ? &b->buf[off] : NULL;
+}
+
+/* release n bytes consumed from the span returned by rbuf_read_span */
+void rbuf_read_commit(rbuf_t *b, size_t n)
+{
+    store_release(&b->tail, b->tail + n);
+}
 
-    *pc = *b->pOut++;
-    b->len--;
-    if (b->pOut >= b->pEnd) {
-        b->pOut = b->buf;
+/* producer: free running position of the next byte it writes */
+size_t rbuf_head(rbuf_t *b)
+{
+    return b->head;
+}
+
+/* producer: contiguous committed region from pos (an earlier rbuf_head)
+ * up to head; stays valid until the producer writes again, even once the
+ * consumer released it */
+char *rbuf_peek(rbuf_t *b, size_t pos, size_t *len)
+{
+    size_t off = pos & b->mask;
+    size_t avail = b->head - pos;
+
+    *len = (avail < b->size - off) ? avail : b->size - off;
+    return *len ? &b->buf[off] : NULL;
+}
+
+size_t rbuf_write(rbuf_t *b, const char *buf, size_t n)
+{
+    size_t done = 0, len;
+    char *p;
+
+    while (done < n && (p = rbuf_write_span(b, &len)) != NULL) {
+        if (len > n - done) {
+            len = n - done;
+        }
+        memcpy(p, buf + done, len);
+        rbuf_write_commit(b, len);
+        done += len;
     }
-    return 1;
+    return done;
 }
+
+size_t rbuf_read(rbuf_t *b, char *buf, size_t n)
+{
+    size_t done = 0, len;
+    char *p;
+
+    while (done < n && (p = rbuf_read_span(b, &len)) != NULL) {
+        if (len > n - done) {
+            len = n - done;
+        }
+        memcpy(buf + done, p, len);
+        rbuf_read_commit(b, len);
+        done += len;
+    }
+    return done;
+}
\ No newline at end of file
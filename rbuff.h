@@ -1,19 +1,38 @@
 #ifndef _RBUFF_H
 #define _RBUFF_H
 
-#define BUFSIZE 10
+#include <stddef.h>
 
+#define RBUF_DEFAULT_SIZE   (1 << 20)
+#define RBUF_CACHELINE      64
+
+/* single-producer/single-consumer ring, head and tail are free running
+ * indices owned by the producer and the consumer respectively */
 typedef struct _rbuf {
-    char buf[BUFSIZE];
-    char *pIn;
-    char *pOut;
-    char *pEnd;
-    int len;
+    char *buf;
+    size_t size;
+    size_t mask;
+    char pad0[RBUF_CACHELINE - sizeof(char *) - 2 * sizeof(size_t)];
+    size_t head;
+    char pad1[RBUF_CACHELINE - sizeof(size_t)];
+    size_t tail;
+    char pad2[RBUF_CACHELINE - sizeof(size_t)];
 } rbuf_t;
 
-void rbuf_init(rbuf_t *b);
-int rbuf_put(rbuf_t *b, char c);
-int rbuf_get(rbuf_t *b, char *pc);
+int rbuf_init(rbuf_t *b, size_t size);
+void rbuf_free(rbuf_t *b);
+size_t rbuf_len(rbuf_t *b);
+size_t rbuf_space(rbuf_t *b);
 int rbuf_is_full(rbuf_t *b);
 int rbuf_is_empty(rbuf_t *b);
+int rbuf_put(rbuf_t *b, char c);
+int rbuf_get(rbuf_t *b, char *pc);
+size_t rbuf_write(rbuf_t *b, const char *buf, size_t n);
+size_t rbuf_read(rbuf_t *b, char *buf, size_t n);
+char *rbuf_write_span(rbuf_t *b, size_t *len);
+void rbuf_write_commit(rbuf_t *b, size_t n);
+char *rbuf_read_span(rbuf_t *b, size_t *len);
+void rbuf_read_commit(rbuf_t *b, size_t n);
+size_t rbuf_head(rbuf_t *b);
+char *rbuf_peek(rbuf_t *b, size_t pos, size_t *len);
 #endif
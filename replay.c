@@ -0,0 +1,262 @@
+/*  replay.c - stream a capture back onto a port at its original pacing.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "usbserial_linux.h"
+#include "usbserial.h"
+#include "capfmt.h"
+#include "stats.h"
+#include "evloop.h"
+#include "replay.h"
+
+#define REPLAY_RAW_CHUNK    64
+#define NSEC_PER_SEC        1000000000LL
+#define REPLAY_SLACK_NS     2000000LL   /* slept on the clock alone */
+#define REPLAY_POLL_MS      100         /* ^C check while the port is full */
+
+struct replay_stats {
+    struct stats_hist late; /* write completion minus deadline, ns */
+    unsigned long long bytes;
+};
+
+static int64_t replay_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* SIGINT, SIGUSR1 and --stats are served while waiting for the deadline,
+ * the last REPLAY_SLACK_NS go to clock_nanosleep to keep the pacing tight */
+static void replay_sleep_until(struct evloop *ev, int64_t deadline)
+{
+    struct timespec ts;
+    int64_t left;
+
+    if ((left = deadline - replay_now()) <= 0) {
+        evloop_run_once(ev, 0);
+        return;
+    }
+    while (left > REPLAY_SLACK_NS && evloop_running(ev)) {
+        evloop_run_once(ev, (int)((left - REPLAY_SLACK_NS) / 1000000) + 1);
+        left = deadline - replay_now();
+    }
+    if (!evloop_running(ev)) {
+        return;
+    }
+    ts.tv_sec = deadline / NSEC_PER_SEC;
+    ts.tv_nsec = deadline % NSEC_PER_SEC;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+/* the port is non-blocking, wait for room instead of dropping bytes;
+ * returns what went out, less than len after ^C */
+static ssize_t replay_write(struct serial_opt *serial, struct evloop *ev,
+                            const char *buf, size_t len)
+{
+    struct pollfd pfd = { serial->handler, POLLOUT, 0 };
+    size_t done = 0;
+    int res;
+
+    while (done < len) {
+        res = serial_port_write(serial, buf + done, len - done);
+        if (res < 0) {
+            return -1;
+        } else if (res == 0) {
+            poll(&pfd, 1, REPLAY_POLL_MS);
+            evloop_run_once(ev, 0);
+            if (!evloop_running(ev)) {
+                break;
+            }
+            continue;
+        }
+        done += res;
+    }
+    return done;
+}
+
+static void replay_account(struct replay_stats *st, int64_t deadline, size_t len)
+{
+    int64_t late = replay_now() - deadline;
+
+    st->bytes += len;
+    stats_hist_add(&st->late, late > 0 ? late : 0);
+}
+
+static void replay_report(struct replay_stats *st)
+{
+    if (!st->late.count) {
+        fprintf(stderr, "replayed: %llu bytes\n", st->bytes);
+        return;
+    }
+    fprintf(stderr, "replayed: %llu bytes in %llu writes, jitter us p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+            st->bytes, (unsigned long long)st->late.count,
+            stats_hist_pct(&st->late, 0.5) / 1e3,
+            stats_hist_pct(&st->late, 0.9) / 1e3,
+            stats_hist_pct(&st->late, 0.99) / 1e3,
+            st->late.max / 1e3);
+}
+
+/* DATA records go out at start + (ts - first ts) / speed; a -M -B file
+ * tags every record with its port id (1..n), port picks one of them */
+static int replay_records(struct serial_opt *serial, struct capfmt_reader *r,
+                          double speed, int port, struct evloop *ev, struct replay_stats *st)
+{
+    struct capfmt_rec rec;
+    char *buf = NULL;
+    size_t bufsize = 0;
+    int64_t start = replay_now(), deadline = start;
+    uint64_t first = 0;
+    ssize_t n;
+    int res = 0;
+
+    while (evloop_running(ev) && (res = capfmt_next(r, &rec, &buf, &bufsize)) > 0) {
+        if (!port && rec.port) {
+            fprintf(stderr, "records of several ports, pick one with --port\n");
+            errno = EINVAL;
+            res = -1;
+            break;
+        } else if (port && !rec.port) {
+            fprintf(stderr, "--port needs a file captured with -M -B\n");
+            errno = EINVAL;
+            res = -1;
+            break;
+        } else if (rec.port != port) {
+            continue;
+        }
+        if (!first) {
+            first = rec.ts_ns;
+        }
+        if (speed > 0) {
+            deadline = start + (int64_t)((rec.ts_ns - first) / speed);
+        } else {
+            deadline = replay_now();
+        }
+        replay_sleep_until(ev, deadline);
+        if (!evloop_running(ev)) {
+            break;
+        }
+        if ((n = replay_write(serial, ev, buf, rec.len)) == -1) {
+            res = -1;
+            break;
+        }
+        replay_account(st, deadline, n);
+    }
+    free(buf);
+    return res;
+}
+
+/* raw bytes carry no timing: pace them at the port's line rate */
+static int replay_raw(struct serial_opt *serial, const char *path,
+                      double speed, struct evloop *ev, struct replay_stats *st)
+{
+    char buf[REPLAY_RAW_CHUNK];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    int bps = serial->rate / serial_char_bits(serial);
+    int64_t deadline = replay_now(), step;
+    ssize_t n = 0;
+
+    if (fd == -1) {
+        return -1;
+    }
+    if (!bps) {
+        speed = 0;
+    }
+
+    while (evloop_running(ev) && (n = read(fd, buf, sizeof(buf))) > 0) {
+        if (speed <= 0) {
+            deadline = replay_now();
+        }
+        replay_sleep_until(ev, deadline);
+        if (!evloop_running(ev)) {
+            break;
+        }
+        if ((n = replay_write(serial, ev, buf, n)) == -1) {
+            break;
+        }
+        replay_account(st, deadline, n);
+        if (speed > 0) {
+            step = (int64_t)(n * (double)NSEC_PER_SEC / bps / speed);
+            deadline += step;
+        }
+    }
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+static void replay_on_signal(int fd, int events, void *arg)
+{
+    struct evloop *ev = arg;
+
+    if (evloop_signal_ack(fd) > 0) {
+        evloop_stop(ev);
+    }
+}
+
+/* replays a -B record file or a raw capture onto an opened port;
+ * speed 1 is real time, 10 ten times faster, 0 as fast as possible,
+ * port selects the records of one port of a multi-port file */
+int serial_replay(struct serial_opt *serial, const char *path, double speed, int port)
+{
+    struct capfmt_reader r;
+    struct replay_stats st;
+    struct evloop *ev;
+    int sigfd, res;
+
+    memset(&st, 0, sizeof(st));
+    sigfd = evloop_signalfd(SIGINT);
+    if (!(ev = evloop_create()) || sigfd == -1) {
+        perror("replay");
+        return -1;
+    }
+    evloop_add(ev, sigfd, EV_READ, replay_on_signal, ev);
+    serial_stats_watch(ev);
+
+    if (capfmt_open(&r, path) == 0) {
+        res = replay_records(serial, &r, speed, port, ev, &st);
+        capfmt_close(&r);
+    } else if (errno == EINVAL) {
+        res = replay_raw(serial, path, speed, ev, &st);
+    } else {
+        res = -1;
+    }
+
+    if (res == -1) {
+        fprintf(stderr, "replay of %s failed: %s\n", path, strerror(errno));
+    }
+    if (!evloop_running(ev)) {
+        fprintf(stderr, "\ninterrupted, draining the port\n");
+    }
+    serial_port_drain(serial);
+    replay_report(&st);
+    close(sigfd);
+    evloop_destroy(ev);
+    return res;
+}
@@ -0,0 +1,8 @@
+#ifndef _REPLAY_H
+#define _REPLAY_H
+
+#include "usbserial.h"
+
+int serial_replay(struct serial_opt *serial, const char *path, double speed, int port);
+
+#endif
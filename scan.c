@@ -0,0 +1,320 @@
+/*  scan.c - delimiter search/count, byte set search and CRC kernels.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#include <string.h>
+
+#include "scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+#define CRC32C_POLY     0x82F63B78      /* reflected Castagnoli */
+#define CRC16_POLY      0x8408          /* reflected CCITT, X.25/HDLC */
+
+static uint32_t crc32c_table[8][256];
+static uint16_t crc16_table[8][256];
+
+/* slicing-by-8 tables, built once by scan_init */
+static void scan_tables(void)
+{
+    uint32_t c32;
+    uint16_t c16;
+    int i, j;
+
+    for (i = 0; i < 256; i++) {
+        c32 = i;
+        c16 = i;
+        for (j = 0; j < 8; j++) {
+            c32 = (c32 & 1) ? (c32 >> 1) ^ CRC32C_POLY : c32 >> 1;
+            c16 = (c16 & 1) ? (c16 >> 1) ^ CRC16_POLY : c16 >> 1;
+        }
+        crc32c_table[0][i] = c32;
+        crc16_table[0][i] = c16;
+    }
+    for (i = 0; i < 256; i++) {
+        for (j = 1; j < 8; j++) {
+            crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[j - 1][i] & 0xFF];
+            crc16_table[j][i] = (crc16_table[j - 1][i] >> 8) ^ crc16_table[0][crc16_table[j - 1][i] & 0xFF];
+        }
+    }
+}
+
+static int scan_always(void)
+{
+    return 1;
+}
+
+/* libc's memchr is vectorized and dispatched already, it beats an own
+ * SSE2/AVX2 loop in make bench, so every implementation uses it */
+static size_t find_scalar(const char *buf, size_t len, char c)
+{
+    const char *p = memchr(buf, c, len);
+
+    return p ? (size_t)(p - buf) : len;
+}
+
+static size_t count_scalar(const char *buf, size_t len, char c)
+{
+    size_t i, n = 0;
+
+    for (i = 0; i < len; i++) {
+        n += buf[i] == c;
+    }
+    return n;
+}
+
+static size_t find_set_scalar(const char *buf, size_t len, const char *set, int nset)
+{
+    size_t i;
+    int j;
+
+    for (i = 0; i < len; i++) {
+        for (j = 0; j < nset; j++) {
+            if (buf[i] == set[j]) {
+                return i;
+            }
+        }
+    }
+    return len;
+}
+
+/* standard CRC-32C: pass 0 to start, the previous result to continue */
+static uint32_t crc32c_scalar(uint32_t crc, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    uint32_t lo, hi;
+
+    crc = ~crc;
+    while (len && ((uintptr_t)p & 7)) {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+        len--;
+    }
+    while (len >= 8) {
+        lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+              crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF] ^
+              crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+    }
+    return ~crc;
+}
+
+/* raw CRC-16 register, no final xor: the X.25 FCS is ~crc16(0xFFFF, ..) */
+static uint16_t crc16_scalar(uint16_t crc, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+
+    while (len >= 8) {
+        crc = crc16_table[7][(p[0] ^ crc) & 0xFF] ^ crc16_table[6][(p[1] ^ (crc >> 8)) & 0xFF] ^
+              crc16_table[5][p[2]] ^ crc16_table[4][p[3]] ^
+              crc16_table[3][p[4]] ^ crc16_table[2][p[5]] ^
+              crc16_table[1][p[6]] ^ crc16_table[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = (crc >> 8) ^ crc16_table[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef SCAN_X86
+static int scan_has_sse2(void)
+{
+    return __builtin_cpu_supports("sse2");
+}
+
+static int scan_has_avx2(void)
+{
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2");
+}
+
+/* matches are summed per byte lane (at most 255 rounds), then folded */
+__attribute__((target("sse2")))
+static size_t count_sse2(const char *buf, size_t len, char c)
+{
+    __m128i v = _mm_set1_epi8(c), zero = _mm_setzero_si128(), acc, sum = zero;
+    size_t i = 0, n;
+    int k;
+
+    while (i + 16 <= len) {
+        acc = zero;
+        for (k = 0; k < 255 && i + 16 <= len; k++, i += 16) {
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i)), v));
+        }
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(acc, zero));
+    }
+    n = (size_t)_mm_cvtsi128_si32(sum) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+    return n + count_scalar(buf + i, len - i, c);
+}
+
+__attribute__((target("sse2")))
+static size_t find_set_sse2(const char *buf, size_t len, const char *set, int nset)
+{
+    __m128i v[SCAN_SET_MAX], x, hit;
+    size_t i;
+    int j, m;
+
+    if (nset > SCAN_SET_MAX) {
+        return find_set_scalar(buf, len, set, nset);
+    }
+    for (j = 0; j < nset; j++) {
+        v[j] = _mm_set1_epi8(set[j]);
+    }
+    for (i = 0; i + 16 <= len; i += 16) {
+        x = _mm_loadu_si128((const __m128i *)(buf + i));
+        hit = _mm_setzero_si128();
+        for (j = 0; j < nset; j++) {
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(x, v[j]));
+        }
+        if ((m = _mm_movemask_epi8(hit)) != 0) {
+            return i + __builtin_ctz(m);
+        }
+    }
+    return i + find_set_scalar(buf + i, len - i, set, nset);
+}
+
+__attribute__((target("avx2")))
+static size_t count_avx2(const char *buf, size_t len, char c)
+{
+    __m256i v = _mm256_set1_epi8(c), zero = _mm256_setzero_si256(), acc, sum = zero;
+    uint64_t lane[4];
+    size_t i = 0;
+    int k;
+
+    while (i + 32 <= len) {
+        acc = zero;
+        for (k = 0; k < 255 && i + 32 <= len; k++, i += 32) {
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i)), v));
+        }
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(acc, zero));
+    }
+    _mm256_storeu_si256((__m256i *)lane, sum);
+    return (size_t)(lane[0] + lane[1] + lane[2] + lane[3]) + count_sse2(buf + i, len - i, c);
+}
+
+__attribute__((target("avx2")))
+static size_t find_set_avx2(const char *buf, size_t len, const char *set, int nset)
+{
+    __m256i v[SCAN_SET_MAX], x, hit;
+    size_t i;
+    int j;
+    unsigned int m;
+
+    if (nset > SCAN_SET_MAX) {
+        return find_set_scalar(buf, len, set, nset);
+    }
+    for (j = 0; j < nset; j++) {
+        v[j] = _mm256_set1_epi8(set[j]);
+    }
+    for (i = 0; i + 32 <= len; i += 32) {
+        x = _mm256_loadu_si256((const __m256i *)(buf + i));
+        hit = _mm256_setzero_si256();
+        for (j = 0; j < nset; j++) {
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(x, v[j]));
+        }
+        if ((m = _mm256_movemask_epi8(hit)) != 0) {
+            return i + __builtin_ctz(m);
+        }
+    }
+    return i + find_set_sse2(buf + i, len - i, set, nset);
+}
+
+/* the SSE4.2 crc32 instruction computes CRC-32C directly */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+
+    crc = ~crc;
+#ifdef __x86_64__
+    {
+        uint64_t c = crc, w;
+
+        while (len >= 8) {
+            memcpy(&w, p, 8);
+            c = _mm_crc32_u64(c, w);
+            p += 8;
+            len -= 8;
+        }
+        crc = (uint32_t)c;
+    }
+#endif
+    while (len >= 4) {
+        uint32_t w;
+
+        memcpy(&w, p, 4);
+        crc = _mm_crc32_u32(crc, w);
+        p += 4;
+        len -= 4;
+    }
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return ~crc;
+}
+#endif
+
+static const struct scan_impl scan_impls[] = {
+    { "scalar", scan_always, find_scalar, count_scalar, find_set_scalar, crc32c_scalar, crc16_scalar },
+#ifdef SCAN_X86
+    { "sse2", scan_has_sse2, find_scalar, count_sse2, find_set_sse2, crc32c_scalar, crc16_scalar },
+    { "avx2", scan_has_avx2, find_scalar, count_avx2, find_set_avx2, crc32c_sse42, crc16_scalar },
+#endif
+};
+
+const struct scan_impl *scan = &scan_impls[0];
+
+/* picks the last (widest) implementation the CPU supports */
+void scan_init(void)
+{
+    int i;
+
+    scan_tables();
+    for (i = 0; scan_impl_at(i); i++) {
+        if (scan_impls[i].supported()) {
+            scan = &scan_impls[i];
+        }
+    }
+}
+
+int scan_select(const char *name)
+{
+    int i;
+
+    for (i = 0; scan_impl_at(i); i++) {
+        if (!strcmp(scan_impls[i].name, name) && scan_impls[i].supported()) {
+            scan = &scan_impls[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const struct scan_impl *scan_impl_at(int i)
+{
+    return i < (int)(sizeof(scan_impls) / sizeof(scan_impls[0])) ? &scan_impls[i] : NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef _SCAN_H
+#define _SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCAN_SET_MAX    4
+
+/* byte scanning and CRC kernels; find and find_set return the offset of
+ * the first match or len when there is none */
+struct scan_impl {
+    const char *name;
+    int (*supported)(void);
+    size_t (*find)(const char *buf, size_t len, char c);
+    size_t (*count)(const char *buf, size_t len, char c);
+    size_t (*find_set)(const char *buf, size_t len, const char *set, int nset);
+    uint32_t (*crc32c)(uint32_t crc, const void *buf, size_t len);
+    uint16_t (*crc16)(uint16_t crc, const void *buf, size_t len);
+};
+
+/* the best kernels this CPU runs, scalar until scan_init() */
+extern const struct scan_impl *scan;
+
+void scan_init(void);
+int scan_select(const char *name);
+const struct scan_impl *scan_impl_at(int i);
+#endif
@@ -0,0 +1,424 @@
+/*  script.c - stream a command file over one port with pipelining.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <regex.h>
+#include <unistd.h>
+
+#include "usbserial_linux.h"
+#include "usbserial.h"
+#include "rbuff.h"
+#include "evloop.h"
+#include "capfmt.h"
+#include "stats.h"
+#include "script.h"
+
+#define SCRIPT_RBUF_SIZE    65536
+#define SCRIPT_MAX_RESP     (1 << 20)
+
+/* matcher settings, changed by @expect/@term/@timeout lines */
+struct script_match {
+    regex_t *re;
+    char term[32];
+    size_t termlen;
+    int timeout_ms;
+};
+
+struct script_cmd {
+    char *line;
+    size_t len;
+    struct script_match match;
+    uint64_t sent_ns;
+    unsigned long seq;
+};
+
+struct script {
+    struct evloop *ev;
+    struct serial_opt *serial;
+    FILE *in;
+    int timerfd;
+    int eof;
+    struct script_match cur;
+    regex_t **regs;             /* every compiled @expect, freed at the end */
+    size_t nregs;
+    struct script_cmd *q;       /* in-flight FIFO */
+    int qsize, qhead, qlen;
+    unsigned long seq;
+    rbuf_t ring;
+    char *resp;                 /* RX since the oldest command was answered */
+    size_t resplen;
+    size_t scanned;             /* resp before this can't start the head's match */
+    int failed;
+    unsigned long ok, timeouts;
+    struct stats_hist lat;
+};
+
+/* "\r\n" style escapes of @term and --term; for regexes (keep) any other
+ * backslash sequence is left for regcomp */
+static size_t script_unescape(char *dst, size_t max, const char *src, int keep)
+{
+    size_t n = 0;
+
+    while (*src && n < max) {
+        if (keep && src[0] == '\\' && !strchr("rnt", src[1])) {
+            dst[n++] = *src++;
+            if (*src && n < max) {
+                dst[n++] = *src++;
+            }
+            continue;
+        }
+        if (src[0] == '\\' && src[1]) {
+            src++;
+            dst[n++] = (*src == 'r') ? '\r' : (*src == 'n') ? '\n' :
+                       (*src == 't') ? '\t' : (*src == '0') ? '\0' : *src;
+        } else {
+            dst[n++] = *src;
+        }
+        src++;
+    }
+    return n;
+}
+
+static int script_set_expect(struct script *s, const char *pattern)
+{
+    regex_t *re = malloc(sizeof(*re));
+    regex_t **regs = realloc(s->regs, (s->nregs + 1) * sizeof(*regs));
+    char *expr = malloc(strlen(pattern) + 1);
+
+    if (regs) {
+        s->regs = regs;
+    }
+    if (expr) {
+        expr[script_unescape(expr, strlen(pattern), pattern, 1)] = '\0';
+    }
+    if (!re || !regs || !expr || regcomp(re, expr, REG_EXTENDED | REG_NEWLINE)) {
+        fprintf(stderr, "bad expect pattern: %s\n", pattern);
+        free(expr);
+        free(re);
+        return -1;
+    }
+    free(expr);
+    s->regs[s->nregs++] = re;
+    s->cur.re = re;
+    return 0;
+}
+
+/* length of the response of cmd at the start of buf, 0 while incomplete;
+ * *scan carries where the next call resumes, a regex from the start of
+ * the last unfinished line (REG_NEWLINE patterns match within a line) */
+static size_t script_matched(struct script_cmd *cmd, const char *buf, size_t len,
+                             size_t *scan)
+{
+    if (cmd->match.re) {
+        regmatch_t m;
+        const char *nl;
+
+        /* REG_STARTEND: bounded by rm_eo, NUL bytes in the response included */
+        m.rm_so = *scan;
+        m.rm_eo = len;
+        if (regexec(cmd->match.re, buf, 1, &m, REG_STARTEND) == 0) {
+            return m.rm_eo ? (size_t)m.rm_eo : 1;
+        }
+        if ((nl = memrchr(buf + *scan, '\n', len - *scan)) != NULL) {
+            *scan = nl + 1 - buf;
+        }
+        return 0;
+    } else {
+        size_t i;
+
+        for (i = *scan; i + cmd->match.termlen <= len; i++) {
+            if (!memcmp(buf + i, cmd->match.term, cmd->match.termlen)) {
+                return i + cmd->match.termlen;
+            }
+        }
+        *scan = i;
+        return 0;
+    }
+}
+
+static void script_csv(const char *buf, size_t len)
+{
+    size_t i;
+
+    putchar('"');
+    for (i = 0; i < len; i++) {
+        switch (buf[i]) {
+        case '"':  fputs("\"\"", stdout); break;
+        case '\r': fputs("\\r", stdout); break;
+        case '\n': fputs("\\n", stdout); break;
+        default:   putchar(buf[i]);
+        }
+    }
+    putchar('"');
+}
+
+/* one latency record per exchange: seq,status,latency_us,command,response */
+static void script_record(struct script *s, struct script_cmd *cmd,
+                          const char *status, size_t resplen)
+{
+    uint64_t lat = capfmt_now() - cmd->sent_ns;
+
+    if (status[0] == 'o') {
+        s->ok++;
+        stats_hist_add(&s->lat, lat);
+    } else {
+        s->timeouts++;
+    }
+    printf("%lu,%s,%.1f,", cmd->seq, status, lat / 1e3);
+    script_csv(cmd->line, cmd->len);
+    putchar(',');
+    script_csv(s->resp, resplen);
+    putchar('\n');
+}
+
+static void script_pop(struct script *s, size_t consumed)
+{
+    free(s->q[s->qhead].line);
+    s->qhead = (s->qhead + 1) % s->qsize;
+    s->qlen--;
+    memmove(s->resp, s->resp + consumed, s->resplen - consumed);
+    s->resplen -= consumed;
+    s->scanned = 0;
+}
+
+static void script_arm(struct script *s)
+{
+    struct script_cmd *head = &s->q[s->qhead];
+    int64_t left;
+
+    if (!s->qlen || head->match.timeout_ms <= 0) {
+        evloop_timer_set(s->timerfd, 0);
+        return;
+    }
+    left = head->match.timeout_ms - (int64_t)(capfmt_now() - head->sent_ns) / 1000000;
+    evloop_timer_set(s->timerfd, left > 0 ? left : 1);
+}
+
+/* keeps the pipeline full from the script file */
+static void script_fill(struct script *s)
+{
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+
+    while (!s->eof && s->qlen < s->qsize) {
+        if ((n = getline(&line, &cap, s->in)) <= 0) {
+            s->eof = 1;
+            break;
+        }
+        while (n && (line[n - 1] == '\n' || line[n - 1] == '\r')) {
+            line[--n] = '\0';
+        }
+
+        if (!n || line[0] == '#') {
+            continue;
+        } else if (!strncmp(line, "@timeout ", 9)) {
+            s->cur.timeout_ms = atoi(line + 9);
+        } else if (!strncmp(line, "@term ", 6)) {
+            s->cur.termlen = script_unescape(s->cur.term, sizeof(s->cur.term), line + 6, 0);
+            s->cur.re = NULL;
+        } else if (!strncmp(line, "@expect ", 8)) {
+            if (script_set_expect(s, line + 8) == -1) {
+                s->failed = 1;
+                s->eof = 1;
+                evloop_stop(s->ev);
+                break;
+            }
+        } else {
+            struct script_cmd *cmd = &s->q[(s->qhead + s->qlen) % s->qsize];
+
+            cmd->line = strdup(line);
+            cmd->len = n;
+            cmd->match = s->cur;
+            cmd->seq = ++s->seq;
+            cmd->sent_ns = capfmt_now();
+            if (serial_write_buf(s->serial, line, n) == -1) {
+                perror("write()");
+                free(cmd->line);
+                evloop_stop(s->ev);
+                break;
+            }
+            s->qlen++;
+        }
+    }
+    free(line);
+
+    evloop_mod(s->ev, s->serial->handler, EV_READ | (serial_tx_pending() ? EV_WRITE : 0));
+    if (s->eof && !s->qlen) {
+        evloop_stop(s->ev);
+    }
+}
+
+static void script_on_port(int fd, int events, void *arg)
+{
+    struct script *s = arg;
+    size_t len, n;
+    char *span;
+    int res;
+
+    if ((events & EV_WRITE) && serial_tx_flush(s->serial) == -1) {
+        perror("write()");
+        evloop_stop(s->ev);
+        return;
+    }
+
+    if (events & (EV_READ | EV_HUP | EV_ERR)) {
+        res = serial_port_read_rbuff(s->serial, &s->ring);
+        if (res == -1 || (res == 0 && (events & (EV_HUP | EV_ERR)))) {
+            evloop_stop(s->ev);
+            return;
+        }
+
+        while ((span = rbuf_read_span(&s->ring, &len)) != NULL) {
+            if (len > SCRIPT_MAX_RESP - s->resplen) {
+                /* nobody claims this much data, drop the oldest */
+                s->resplen = 0;
+                s->scanned = 0;
+            }
+            memcpy(s->resp + s->resplen, span, len);
+            s->resplen += len;
+            rbuf_read_commit(&s->ring, len);
+        }
+
+        while (s->qlen && (n = script_matched(&s->q[s->qhead], s->resp, s->resplen,
+                                              &s->scanned)) != 0) {
+            script_record(s, &s->q[s->qhead], "ok", n);
+            script_pop(s, n);
+        }
+        if (!s->qlen) {
+            /* unsolicited output between exchanges */
+            s->resplen = 0;
+            s->scanned = 0;
+        }
+    }
+
+    script_fill(s);
+    script_arm(s);
+}
+
+static void script_on_timer(int fd, int events, void *arg)
+{
+    struct script *s = arg;
+
+    evloop_timer_ack(fd);
+    if (s->qlen) {
+        struct script_cmd *head = &s->q[s->qhead];
+
+        if ((int64_t)(capfmt_now() - head->sent_ns) / 1000000 >= head->match.timeout_ms) {
+            script_record(s, head, "timeout", s->resplen);
+            script_pop(s, s->resplen);
+        }
+    }
+    script_fill(s);
+    script_arm(s);
+}
+
+static void script_on_signal(int fd, int events, void *arg)
+{
+    struct script *s = arg;
+
+    if (evloop_signal_ack(fd) > 0) {
+        evloop_stop(s->ev);
+    }
+}
+
+/* sends the commands of opt->path keeping opt->inflight of them
+ * outstanding; answers are matched in order, by regex or terminator,
+ * each within its own timeout (serial->timeout unless @timeout) */
+int serial_script(struct serial_opt *serial, struct script_opt *opt)
+{
+    struct script s;
+    uint64_t start = capfmt_now();
+    int sigfd;
+    size_t i;
+
+    memset(&s, 0, sizeof(s));
+    s.serial = serial;
+    s.qsize = opt->inflight > 0 ? opt->inflight : 1;
+    s.cur.timeout_ms = serial->timeout;
+    s.cur.termlen = script_unescape(s.cur.term, sizeof(s.cur.term), opt->term ? opt->term : "\\n", 0);
+
+    if (!(s.in = strcmp(opt->path, "-") ? fopen(opt->path, "r") : stdin)) {
+        fprintf(stderr, "Unable to open %s : %s\n", opt->path, strerror(errno));
+        return -1;
+    }
+    if (opt->expect && script_set_expect(&s, opt->expect) == -1) {
+        return -1;
+    }
+
+    s.q = calloc(s.qsize, sizeof(*s.q));
+    s.resp = malloc(SCRIPT_MAX_RESP + 1);
+    s.timerfd = evloop_timerfd();
+    sigfd = evloop_signalfd(SIGINT);
+    s.ev = evloop_create();
+    if (!s.q || !s.resp || !s.ev || s.timerfd == -1 || sigfd == -1 ||
+        rbuf_init(&s.ring, SCRIPT_RBUF_SIZE) == -1) {
+        perror("script");
+        return -1;
+    }
+
+    evloop_add(s.ev, serial->handler, EV_READ, script_on_port, &s);
+    evloop_add(s.ev, s.timerfd, EV_READ, script_on_timer, &s);
+    evloop_add(s.ev, sigfd, EV_READ, script_on_signal, &s);
+    serial_stats_watch(s.ev);
+
+    printf("seq,status,latency_us,command,response\n");
+    script_fill(&s);
+    script_arm(&s);
+
+    while (evloop_running(s.ev)) {
+        if (evloop_run_once(s.ev, -1) == -1) {
+            perror("epoll_wait()");
+            break;
+        }
+    }
+    fflush(stdout);
+
+    fprintf(stderr, "script: %lu ok, %lu timeout, %lu unanswered, latency avg %.1f p50 %.1f p99 %.1f max %.1f us, %.3f s total\n",
+            s.ok, s.timeouts, (unsigned long)s.qlen,
+            s.ok ? s.lat.sum / 1e3 / s.ok : 0.0, stats_hist_pct(&s.lat, 0.5) / 1e3,
+            stats_hist_pct(&s.lat, 0.99) / 1e3, s.lat.max / 1e3,
+            (capfmt_now() - start) / 1e9);
+
+    while (s.qlen) {
+        script_pop(&s, 0);
+    }
+    for (i = 0; i < s.nregs; i++) {
+        regfree(s.regs[i]);
+        free(s.regs[i]);
+    }
+    free(s.regs);
+    free(s.q);
+    free(s.resp);
+    rbuf_free(&s.ring);
+    close(s.timerfd);
+    close(sigfd);
+    evloop_destroy(s.ev);
+    if (s.in != stdin) {
+        fclose(s.in);
+    }
+    return s.timeouts || s.failed ? -1 : 0;
+}
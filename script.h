@@ -0,0 +1,15 @@
+#ifndef _SCRIPT_H
+#define _SCRIPT_H
+
+#include "usbserial.h"
+
+struct script_opt {
+    const char *path;
+    int inflight;           /* commands sent before the oldest answers */
+    const char *expect;     /* default response regex, NULL for term */
+    const char *term;       /* default response terminator */
+};
+
+int serial_script(struct serial_opt *serial, struct script_opt *opt);
+
+#endif
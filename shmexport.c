@@ -0,0 +1,124 @@
+/*  shmexport.c - publish the RX stream of one port in a shared memory ring.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "usbserial_linux.h"
+#include "usbserial.h"
+#include "evloop.h"
+#include "shmring.h"
+#include "shmexport.h"
+
+/* per read(): the writer reserves this much ahead of seq, so a reader
+ * is safe while it is less than capacity - SHMEXPORT_READ_SIZE behind */
+#define SHMEXPORT_READ_SIZE 65536
+
+struct shmexport {
+    struct evloop *ev;
+    struct serial_opt *serial;
+    struct shmring *ring;
+};
+
+static void shmexport_on_port(int fd, int events, void *arg)
+{
+    struct shmexport *x = arg;
+    size_t len;
+    char *span;
+    int n;
+
+    if (events & (EV_READ | EV_HUP | EV_ERR)) {
+        /* straight from the port into the shared pages, never past what
+         * the reservation covers: a small ring grants less */
+        do {
+            len = SHMEXPORT_READ_SIZE;
+            span = shmring_write_span(x->ring, &len);
+            if ((n = serial_port_read(x->serial, span, len)) > 0) {
+                shmring_write_commit(x->ring, n);
+            }
+        } while (n == (int)len);
+
+        if (n == -1 || (n == 0 && (events & (EV_HUP | EV_ERR)))) {
+            fprintf(stderr, "%s: port closed\n", x->serial->name);
+            evloop_stop(x->ev);
+        }
+    }
+}
+
+static void shmexport_on_signal(int fd, int events, void *arg)
+{
+    struct shmexport *x = arg;
+
+    if (evloop_signal_ack(fd) > 0) {
+        evloop_stop(x->ev);
+    }
+}
+
+/* --shm name[,bytes]: owns the open port and publishes what it receives
+ * until SIGINT or the port goes away; nothing is sent to the port */
+int serial_shm_export(struct serial_opt *serial, const char *spec)
+{
+    struct shmexport x;
+    char *name = strdup(spec), *size;
+    size_t capacity = SHMRING_DEFAULT_SIZE;
+    int sigfd, res = 0;
+
+    if (name && (size = strchr(name, ',')) != NULL) {
+        *size++ = '\0';
+        capacity = strtoul(size, NULL, 0);
+    }
+    memset(&x, 0, sizeof(x));
+    x.serial = serial;
+    if (!name || !(x.ring = shmring_create(name, capacity))) {
+        fprintf(stderr, "Unable to create shared ring %s : %s\n", spec, strerror(errno));
+        free(name);
+        return -1;
+    }
+    sigfd = evloop_signalfd(SIGINT);
+    if (sigfd == -1 || !(x.ev = evloop_create())) {
+        perror("shm");
+        shmring_close(x.ring);
+        free(name);
+        return -1;
+    }
+    evloop_add(x.ev, sigfd, EV_READ, shmexport_on_signal, &x);
+    evloop_add(x.ev, serial->handler, EV_READ, shmexport_on_port, &x);
+    serial_stats_watch(x.ev);
+    fprintf(stderr, "Publishing %s on /dev/shm/%s, %llu byte ring\n", serial->name,
+            name + strspn(name, "/"), (unsigned long long)x.ring->hdr->capacity);
+    fprintf(stderr, "^C to exit.\n");
+
+    while (evloop_running(x.ev)) {
+        if (evloop_run_once(x.ev, -1) == -1) {
+            perror("epoll_wait()");
+            res = -1;
+            break;
+        }
+    }
+
+    fprintf(stderr, "%s: %llu bytes published, %d reader(s) attached\n", name,
+            (unsigned long long)x.ring->pos, shmring_readers(x.ring));
+    shmring_close(x.ring);
+    close(sigfd);
+    evloop_destroy(x.ev);
+    free(name);
+    return res;
+}
@@ -0,0 +1,8 @@
+#ifndef _SHMEXPORT_H
+#define _SHMEXPORT_H
+
+#include "usbserial.h"
+
+int serial_shm_export(struct serial_opt *serial, const char *spec);
+
+#endif
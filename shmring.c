@@ -0,0 +1,326 @@
+/*  shmring.c - RX ring in POSIX shared memory, writer and reader sides.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shmring.h"
+
+#define SHMRING_LOAD(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define SHMRING_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static int shmring_futex(uint32_t *addr, int op, uint32_t val, const struct timespec *ts)
+{
+    return syscall(SYS_futex, addr, op, val, ts, NULL, 0);
+}
+
+/* "name" and "/name" both mean /dev/shm/name */
+static char *shmring_path(const char *name)
+{
+    char *path;
+
+    while (*name == '/') {
+        name++;
+    }
+    if (!*name || strchr(name, '/') || !(path = malloc(strlen(name) + 2))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    path[0] = '/';
+    strcpy(path + 1, name);
+    return path;
+}
+
+/* header, then the data mapped twice so a span never wraps */
+static int shmring_map(struct shmring *r, int fd, uint64_t capacity, int prot)
+{
+    size_t len = SHMRING_HDR_SIZE + 2 * capacity;
+    char *base = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+    if (mmap(base, SHMRING_HDR_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(base + SHMRING_HDR_SIZE, capacity, prot, MAP_SHARED | MAP_FIXED, fd,
+             SHMRING_HDR_SIZE) == MAP_FAILED ||
+        mmap(base + SHMRING_HDR_SIZE + capacity, capacity, prot, MAP_SHARED | MAP_FIXED, fd,
+             SHMRING_HDR_SIZE) == MAP_FAILED) {
+        munmap(base, len);
+        return -1;
+    }
+    r->hdr = (struct shmring_hdr *)base;
+    r->data = base + SHMRING_HDR_SIZE;
+    r->map_len = len;
+    r->mask = capacity - 1;
+    return 0;
+}
+
+static int shmring_alive(uint32_t pid)
+{
+    return pid && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+/* a segment left by a writer that died is taken over, a live one is not */
+static int shmring_create_fd(const char *path)
+{
+    struct shmring_hdr hdr;
+    int fd;
+
+    if ((fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0660)) != -1 || errno != EEXIST) {
+        return fd;
+    }
+    if ((fd = shm_open(path, O_RDONLY, 0)) != -1) {
+        if (read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) && hdr.magic == SHMRING_MAGIC &&
+            !hdr.closed && shmring_alive(hdr.writer_pid)) {
+            close(fd);
+            errno = EBUSY;
+            return -1;
+        }
+        close(fd);
+    }
+    shm_unlink(path);
+    return shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0660);
+}
+
+struct shmring *shmring_create(const char *name, size_t capacity)
+{
+    struct shmring *r = calloc(1, sizeof(*r));
+    long page = sysconf(_SC_PAGESIZE);
+    uint64_t cap = page;
+    int fd = -1;
+
+    while (cap < capacity) {
+        cap <<= 1;
+    }
+    if (!r || !(r->name = shmring_path(name)) || (fd = shmring_create_fd(r->name)) == -1) {
+        goto fail;
+    }
+    if (ftruncate(fd, SHMRING_HDR_SIZE + cap) == -1 || shmring_map(r, fd, cap, PROT_READ | PROT_WRITE) == -1) {
+        shm_unlink(r->name);
+        goto fail;
+    }
+    close(fd);
+
+    r->slot = -1;
+    r->hdr->version = SHMRING_VERSION;
+    r->hdr->capacity = cap;
+    r->hdr->data_offset = SHMRING_HDR_SIZE;
+    r->hdr->max_readers = SHMRING_MAX_READERS;
+    r->hdr->writer_pid = getpid();
+    /* readers check the magic before anything else */
+    SHMRING_STORE(&r->hdr->magic, SHMRING_MAGIC);
+    return r;
+
+fail:
+    if (fd != -1) {
+        close(fd);
+    }
+    if (r) {
+        free(r->name);
+        free(r);
+    }
+    return NULL;
+}
+
+/* room for up to *len bytes at seq, *len is set to what was reserved
+ * (at most the capacity); readers see them after the commit */
+char *shmring_write_span(struct shmring *r, size_t *len)
+{
+    if (*len > r->mask + 1) {
+        *len = r->mask + 1;
+    }
+    __atomic_store_n(&r->hdr->reserve, r->pos + *len, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return r->data + (r->pos & r->mask);
+}
+
+void shmring_write_commit(struct shmring *r, size_t n)
+{
+    r->pos += n;
+    /* pairs with the waiters/seq order in shmring_wait */
+    __atomic_store_n(&r->hdr->seq, r->pos, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->hdr->waiters, __ATOMIC_SEQ_CST)) {
+        __atomic_add_fetch(&r->hdr->futex, 1, __ATOMIC_SEQ_CST);
+        shmring_futex(&r->hdr->futex, FUTEX_WAKE, INT_MAX, NULL);
+    }
+}
+
+int shmring_readers(struct shmring *r)
+{
+    int i, n = 0;
+
+    for (i = 0; i < SHMRING_MAX_READERS; i++) {
+        n += shmring_alive(SHMRING_LOAD(&r->hdr->slot[i].pid));
+    }
+    return n;
+}
+
+static int shmring_claim(struct shmring *r)
+{
+    uint32_t pid, me = getpid();
+    int i;
+
+    for (i = 0; i < SHMRING_MAX_READERS; i++) {
+        pid = SHMRING_LOAD(&r->hdr->slot[i].pid);
+        if ((!pid || !shmring_alive(pid)) &&
+            __atomic_compare_exchange_n(&r->hdr->slot[i].pid, &pid, me, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return i;
+        }
+    }
+    errno = EUSERS;
+    return -1;
+}
+
+struct shmring *shmring_open(const char *name)
+{
+    struct shmring *r = calloc(1, sizeof(*r));
+    char *path = shmring_path(name);
+    struct stat st;
+    int fd = -1;
+
+    if (!r || !path || (fd = shm_open(path, O_RDWR, 0)) == -1 || fstat(fd, &st) == -1) {
+        goto fail;
+    }
+    if (st.st_size <= SHMRING_HDR_SIZE ||
+        shmring_map(r, fd, st.st_size - SHMRING_HDR_SIZE, PROT_READ) == -1) {
+        errno = st.st_size <= SHMRING_HDR_SIZE ? EPROTO : errno;
+        goto fail;
+    }
+    if (SHMRING_LOAD(&r->hdr->magic) != SHMRING_MAGIC || r->hdr->version != SHMRING_VERSION ||
+        r->hdr->capacity != r->mask + 1) {
+        munmap(r->hdr, r->map_len);
+        errno = EPROTO;
+        goto fail;
+    }
+    if ((r->slot = shmring_claim(r)) == -1) {
+        munmap(r->hdr, r->map_len);
+        goto fail;
+    }
+    close(fd);
+    free(path);
+
+    r->pos = SHMRING_LOAD(&r->hdr->seq);
+    __atomic_store_n(&r->hdr->slot[r->slot].lost, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&r->hdr->slot[r->slot].pos, r->pos, __ATOMIC_RELAXED);
+    return r;
+
+fail:
+    if (fd != -1) {
+        close(fd);
+    }
+    free(path);
+    free(r);
+    return NULL;
+}
+
+/* the writer lapped us: continue with live data */
+static void shmring_overrun(struct shmring *r)
+{
+    uint64_t seq = SHMRING_LOAD(&r->hdr->seq);
+
+    r->lost += seq - r->pos;
+    r->pos = seq;
+    __atomic_store_n(&r->hdr->slot[r->slot].lost, r->lost, __ATOMIC_RELAXED);
+    __atomic_store_n(&r->hdr->slot[r->slot].pos, r->pos, __ATOMIC_RELAXED);
+}
+
+/* everything readable at the cursor in one piece, NULL when nothing is */
+const char *shmring_read_span(struct shmring *r, size_t *len)
+{
+    uint64_t seq = SHMRING_LOAD(&r->hdr->seq);
+
+    if (seq - r->pos > r->mask + 1) {
+        shmring_overrun(r);
+        seq = r->pos;
+    }
+    *len = seq - r->pos;
+    return *len ? r->data + (r->pos & r->mask) : NULL;
+}
+
+/* call once done with n bytes of the span; -1 when the writer may have
+ * overwritten them meanwhile, the copy must be dropped */
+int shmring_read_commit(struct shmring *r, size_t n)
+{
+    uint64_t reserve;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    reserve = __atomic_load_n(&r->hdr->reserve, __ATOMIC_RELAXED);
+    if (reserve - r->pos > r->mask + 1) {
+        shmring_overrun(r);
+        return -1;
+    }
+    r->pos += n;
+    __atomic_store_n(&r->hdr->slot[r->slot].pos, r->pos, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* sleeps until there is data (1), timeout_ms passes (0, < 0 waits
+ * forever) or the writer closed the ring and it was read to the end (-1) */
+int shmring_wait(struct shmring *r, int timeout_ms)
+{
+    struct shmring_hdr *h = r->hdr;
+    struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    uint32_t f;
+
+    __atomic_add_fetch(&h->waiters, 1, __ATOMIC_SEQ_CST);
+    f = __atomic_load_n(&h->futex, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&h->seq, __ATOMIC_SEQ_CST) == r->pos && !SHMRING_LOAD(&h->closed)) {
+        shmring_futex(&h->futex, FUTEX_WAIT, f, timeout_ms < 0 ? NULL : &ts);
+    }
+    __atomic_sub_fetch(&h->waiters, 1, __ATOMIC_SEQ_CST);
+
+    if (SHMRING_LOAD(&h->seq) != r->pos) {
+        return 1;
+    }
+    return SHMRING_LOAD(&h->closed) ? -1 : 0;
+}
+
+/* the writer marks the ring final and unlinks it, readers keep their
+ * mapping until they close */
+void shmring_close(struct shmring *r)
+{
+    if (!r) {
+        return;
+    }
+    if (r->slot == -1) {
+        SHMRING_STORE(&r->hdr->closed, 1);
+        __atomic_add_fetch(&r->hdr->futex, 1, __ATOMIC_SEQ_CST);
+        shmring_futex(&r->hdr->futex, FUTEX_WAKE, INT_MAX, NULL);
+        shm_unlink(r->name);
+    } else {
+        SHMRING_STORE(&r->hdr->slot[r->slot].pid, 0);
+    }
+    munmap(r->hdr, r->map_len);
+    free(r->name);
+    free(r);
+}
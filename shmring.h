@@ -0,0 +1,78 @@
+#ifndef _SHMRING_H
+#define _SHMRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* RX ring published in POSIX shared memory (/dev/shm/<name>) for local
+ * readers. The segment is one header page followed by the data:
+ *
+ *   offset 0      struct shmring_hdr
+ *   data_offset   capacity bytes, byte n of the stream is at n % capacity
+ *
+ * seq counts the bytes ever written and only grows. The writer never
+ * waits for readers: before it fills [seq, seq + k) it raises reserve
+ * to seq + k, so a reader that copied [pos, pos + len) knows its bytes
+ * were intact when reserve - pos <= capacity afterwards. Each reader
+ * owns one slot: its pid and cursor, for tools that show the lag.
+ * Readers map the data twice back to back, every span is contiguous.
+ * The writer bumps futex after every commit that has waiters. Words are
+ * in host byte order, each group sits on its own 64 byte line. */
+#define SHMRING_MAGIC       0x52485355  /* "USHR" */
+#define SHMRING_VERSION     1
+#define SHMRING_HDR_SIZE    4096
+#define SHMRING_MAX_READERS 32
+#define SHMRING_DEFAULT_SIZE (4 << 20)
+
+struct shmring_slot {
+    uint32_t pid;               /* 0 when free */
+    uint32_t pad;
+    uint64_t pos;               /* the reader's cursor in seq units */
+    uint64_t lost;              /* bytes it was overrun by */
+    char pad1[40];
+};
+
+struct shmring_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;          /* power of two, a page multiple */
+    uint64_t data_offset;       /* SHMRING_HDR_SIZE */
+    uint32_t max_readers;
+    uint32_t writer_pid;
+    uint32_t closed;            /* the writer is gone, seq is final */
+    char pad0[28];
+    uint64_t seq;               /* bytes written and visible */
+    uint64_t reserve;           /* bytes the writer may be overwriting up to */
+    char pad1[48];
+    uint32_t futex;
+    uint32_t waiters;
+    char pad2[56];
+    struct shmring_slot slot[SHMRING_MAX_READERS];
+};
+
+struct shmring {
+    struct shmring_hdr *hdr;
+    char *data;
+    size_t map_len;
+    uint64_t mask;
+    uint64_t pos;               /* reader: cursor */
+    uint64_t lost;              /* reader: bytes skipped after overruns */
+    int slot;                   /* reader: our slot, -1 for the writer */
+    char *name;                 /* writer: unlinked on close */
+};
+
+/* writer */
+struct shmring *shmring_create(const char *name, size_t capacity);
+char *shmring_write_span(struct shmring *r, size_t *len);
+void shmring_write_commit(struct shmring *r, size_t n);
+int shmring_readers(struct shmring *r);
+
+/* reader, starts at the live end of the stream */
+struct shmring *shmring_open(const char *name);
+const char *shmring_read_span(struct shmring *r, size_t *len);
+int shmring_read_commit(struct shmring *r, size_t n);
+int shmring_wait(struct shmring *r, int timeout_ms);
+
+void shmring_close(struct shmring *r);
+
+#endif
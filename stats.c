@@ -0,0 +1,513 @@
+/*  stats.c - counters and histograms of the RX/TX paths.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#endif
+
+#include "rbuff.h"
+#include "stats.h"
+
+#define STATS_MARKS     4096
+
+/* every group below is written by one thread only; readers load the
+ * fields relaxed, so a report may be a few events behind */
+struct stats_rx {
+    uint64_t bytes;
+    uint64_t reads;
+    uint64_t wakeups;
+    uint64_t stalls;
+    uint64_t reconnects;
+    struct stats_hist read_size;
+    struct stats_hist ring_fill;    /* bytes queued after each read */
+    struct stats_hist wait_ns;      /* time blocked waiting for the port */
+    struct stats_hist outage_ns;    /* port lost until reopened */
+    char pad[RBUF_CACHELINE];
+};
+
+struct stats_out {
+    uint64_t bytes;
+    uint64_t writes;
+    struct stats_hist latency_ns;   /* port read to stdout write */
+    char pad[RBUF_CACHELINE];
+};
+
+struct stats_tx {
+    uint64_t bytes;
+    uint64_t writes;
+    uint64_t since;                 /* queue went non-empty, 0 when empty */
+    struct stats_hist drain_ns;     /* queued until written (and drained with -W) */
+    char pad[RBUF_CACHELINE];
+};
+
+/* driver error counters, polled by the reporter */
+struct stats_port {
+    uint64_t overruns;
+    uint64_t frame;
+    uint64_t parity;
+};
+
+/* arrival time of the byte that ends at offset 'end' of the RX stream */
+struct stats_mark {
+    uint64_t end;
+    uint64_t ns;
+};
+
+static struct stats_rx rx;
+static struct stats_out out;
+static struct stats_tx tx;
+static struct stats_port port, port_base, port_prev;  /* prev: devices before a reconnect */
+static rbuf_t marks;
+static size_t ring_size;
+static int port_fd = -1;
+static uint64_t start_ns;
+
+static const struct {
+    const char *name;
+    const uint64_t *val;
+} counters[] = {
+    { "rx_bytes",       &rx.bytes },
+    { "rx_reads",       &rx.reads },
+    { "rx_wakeups",     &rx.wakeups },
+    { "rx_stalls",      &rx.stalls },
+    { "rx_reconnects",  &rx.reconnects },
+    { "out_bytes",      &out.bytes },
+    { "out_writes",     &out.writes },
+    { "tx_bytes",       &tx.bytes },
+    { "tx_writes",      &tx.writes },
+    { "port_overruns",  &port.overruns },
+    { "port_frame_errors",  &port.frame },
+    { "port_parity_errors", &port.parity },
+};
+
+static const struct {
+    const char *name;
+    const struct stats_hist *h;
+    int ns;                         /* nanoseconds, else bytes */
+} hists[] = {
+    { "rx_read_size",   &rx.read_size,      0 },
+    { "rx_ring_fill",   &rx.ring_fill,      0 },
+    { "rx_wait",        &rx.wait_ns,        1 },
+    { "rx_outage",      &rx.outage_ns,      1 },
+    { "rx_latency",     &out.latency_ns,    1 },
+    { "tx_drain",       &tx.drain_ns,       1 },
+};
+
+static const struct {
+    double pct;
+    const char *name;
+    const char *quantile;
+} pcts[] = {
+    { 0.5,   "p50",  "0.5" },
+    { 0.9,   "p90",  "0.9" },
+    { 0.99,  "p99",  "0.99" },
+    { 0.999, "p999", "0.999" },
+};
+
+#define NELEM(a)    (sizeof(a) / sizeof((a)[0]))
+
+static uint64_t stats_load(const uint64_t *p)
+{
+#ifdef _WIN32
+    return *(const volatile uint64_t *)p;
+#else
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+#endif
+}
+
+static void stats_store(uint64_t *p, uint64_t v)
+{
+#ifdef _WIN32
+    *(volatile uint64_t *)p = v;
+#else
+    __atomic_store_n(p, v, __ATOMIC_RELAXED);
+#endif
+}
+
+/* single writer: a plain load and store, no locked instruction */
+static void stats_add(uint64_t *p, uint64_t v)
+{
+    stats_store(p, stats_load(p) + v);
+}
+
+uint64_t stats_now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER f, c;
+
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&c);
+    return (uint64_t)(c.QuadPart / f.QuadPart) * 1000000000ULL +
+           (uint64_t)(c.QuadPart % f.QuadPart) * 1000000000ULL / f.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static unsigned int stats_index(uint64_t v)
+{
+    unsigned int msb;
+
+    if (v < 2 * STATS_SUB) {
+        return (unsigned int)v;
+    }
+#ifdef _WIN32
+    for (msb = 0; v >> (msb + 1); msb++) {
+    }
+#else
+    msb = 63 - __builtin_clzll(v);
+#endif
+    return (msb - STATS_SUB_BITS + 1) * STATS_SUB +
+           (unsigned int)((v >> (msb - STATS_SUB_BITS)) & (STATS_SUB - 1));
+}
+
+/* largest value that lands in bucket i */
+static uint64_t stats_bucket_top(unsigned int i)
+{
+    unsigned int shift;
+
+    if (i < 2 * STATS_SUB) {
+        return i;
+    }
+    shift = i / STATS_SUB - 1;
+    return ((uint64_t)(STATS_SUB + i % STATS_SUB) << shift) + ((uint64_t)1 << shift) - 1;
+}
+
+void stats_hist_add(struct stats_hist *h, uint64_t v)
+{
+    stats_add(&h->bucket[stats_index(v)], 1);
+    stats_add(&h->sum, v);
+    if (v > stats_load(&h->max)) {
+        stats_store(&h->max, v);
+    }
+    stats_add(&h->count, 1);
+}
+
+/* value at or below which pct (0..1) of the samples fall */
+uint64_t stats_hist_pct(const struct stats_hist *h, double pct)
+{
+    uint64_t count = stats_load(&h->count), max = stats_load(&h->max);
+    uint64_t target = (uint64_t)(pct * count + 0.999999), seen = 0;
+    unsigned int i;
+
+    if (!count) {
+        return 0;
+    }
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        seen += stats_load(&h->bucket[i]);
+        if (seen >= target) {
+            uint64_t top = stats_bucket_top(i);
+
+            return top < max ? top : max;
+        }
+    }
+    return max;
+}
+
+static void stats_port_poll(void)
+{
+#ifdef TIOCGICOUNT
+    struct serial_icounter_struct ic;
+
+    /* ptys and most USB adapters without a driver count fail here */
+    if (port_fd != -1 && ioctl(port_fd, TIOCGICOUNT, &ic) == 0) {
+        port.overruns = port_prev.overruns + (uint64_t)(ic.overrun + ic.buf_overrun) - port_base.overruns;
+        port.frame = port_prev.frame + (uint64_t)ic.frame - port_base.frame;
+        port.parity = port_prev.parity + (uint64_t)ic.parity - port_base.parity;
+    }
+#endif
+}
+
+int stats_init(size_t rsize, int fd)
+{
+    start_ns = stats_now();
+    ring_size = rsize;
+    port_fd = fd;
+    stats_port_poll();
+    port_base = port;
+    memset(&port, 0, sizeof(port));
+    /* arrival stamps only make sense with a sink draining a ring */
+    return rsize ? rbuf_init(&marks, STATS_MARKS * sizeof(struct stats_mark)) : 0;
+}
+
+/* the port went away, keep what its driver counted */
+void stats_port_lost(void)
+{
+    stats_port_poll();
+    port_prev = port;
+    port_fd = -1;
+}
+
+/* reopened after down_ns; a new device counts from its own zero */
+void stats_port_found(int fd, uint64_t down_ns)
+{
+    stats_add(&rx.reconnects, 1);
+    stats_hist_add(&rx.outage_ns, down_ns);
+    port_fd = fd;
+    memset(&port_base, 0, sizeof(port_base));
+    stats_port_poll();
+    port_base.overruns = port.overruns - port_prev.overruns;
+    port_base.frame = port.frame - port_prev.frame;
+    port_base.parity = port.parity - port_prev.parity;
+    port = port_prev;
+}
+
+void stats_rx_read(size_t n)
+{
+    stats_add(&rx.reads, 1);
+    stats_add(&rx.bytes, n);
+    stats_hist_add(&rx.read_size, n);
+}
+
+/* after a read: samples the ring fill and stamps the new data so the
+ * sink can tell how long it waited */
+void stats_rx_queued(size_t ring_len)
+{
+    struct stats_mark m;
+
+    stats_hist_add(&rx.ring_fill, ring_len);
+    if (marks.size && rbuf_space(&marks) >= sizeof(m)) {
+        m.end = rx.bytes;
+        m.ns = stats_now();
+        rbuf_write(&marks, (const char *)&m, sizeof(m));
+    }
+}
+
+void stats_rx_wakeup(uint64_t wait_ns)
+{
+    stats_add(&rx.wakeups, 1);
+    stats_hist_add(&rx.wait_ns, wait_ns);
+}
+
+void stats_rx_stall(void)
+{
+    stats_add(&rx.stalls, 1);
+}
+
+size_t stats_rx_high_water(void)
+{
+    return (size_t)stats_load(&rx.ring_fill.max);
+}
+
+unsigned long stats_rx_stalls(void)
+{
+    return (unsigned long)stats_load(&rx.stalls);
+}
+
+void stats_out_write(size_t n)
+{
+    struct stats_mark m;
+    uint64_t now = 0;
+    size_t len;
+    char *p;
+
+    stats_add(&out.writes, 1);
+    stats_add(&out.bytes, n);
+
+    /* marks are a multiple of the ring size, so never split by the wrap */
+    while ((p = rbuf_read_span(&marks, &len)) != NULL && len >= sizeof(m)) {
+        memcpy(&m, p, sizeof(m));
+        if (m.end > out.bytes) {
+            break;
+        }
+        if (!now) {
+            now = stats_now();
+        }
+        stats_hist_add(&out.latency_ns, now - m.ns);
+        rbuf_read_commit(&marks, sizeof(m));
+    }
+}
+
+void stats_tx_queued(void)
+{
+    if (!tx.since) {
+        tx.since = stats_now();
+    }
+}
+
+void stats_tx_write(size_t n)
+{
+    stats_add(&tx.writes, 1);
+    stats_add(&tx.bytes, n);
+}
+
+void stats_tx_done(void)
+{
+    if (tx.since) {
+        stats_hist_add(&tx.drain_ns, stats_now() - tx.since);
+        tx.since = 0;
+    }
+}
+
+/* histograms in ns are reported in us */
+static double stats_scaled(int i, uint64_t v)
+{
+    return hists[i].ns ? v / 1e3 : (double)v;
+}
+
+static double stats_uptime(void)
+{
+    return (stats_now() - start_ns) / 1e9;
+}
+
+/* one line per --stats interval: rates since the previous line */
+void stats_print_line(FILE *f)
+{
+    static uint64_t last_ns, last_rx, last_out;
+    uint64_t now = stats_now(), rxb = stats_load(&rx.bytes), outb = stats_load(&out.bytes);
+    uint64_t reads = stats_load(&rx.reads);
+    double secs = (now - (last_ns ? last_ns : start_ns)) / 1e9;
+
+    if (secs <= 0) {
+        secs = 1e-9;
+    }
+    stats_port_poll();
+    fprintf(f, "stats: rx %.1f KiB/s out %.1f KiB/s, %llu reads avg %.0f B, "
+               "ring p99 %llu/%lu B, stalls %llu, overruns %llu, "
+               "latency p50 %.1f p99 %.1f us, tx %llu B drain p99 %.1f us\n",
+            (rxb - last_rx) / 1024.0 / secs, (outb - last_out) / 1024.0 / secs,
+            (unsigned long long)reads, reads ? (double)rxb / reads : 0.0,
+            (unsigned long long)stats_hist_pct(&rx.ring_fill, 0.99), (unsigned long)ring_size,
+            (unsigned long long)stats_load(&rx.stalls), (unsigned long long)port.overruns,
+            stats_hist_pct(&out.latency_ns, 0.5) / 1e3, stats_hist_pct(&out.latency_ns, 0.99) / 1e3,
+            (unsigned long long)stats_load(&tx.bytes), stats_hist_pct(&tx.drain_ns, 0.99) / 1e3);
+    last_ns = now;
+    last_rx = rxb;
+    last_out = outb;
+}
+
+/* everything, for SIGUSR1 and the end of a run */
+void stats_dump(FILE *f)
+{
+    size_t i, j;
+
+    stats_port_poll();
+    fprintf(f, "stats after %.3f s:\n", stats_uptime());
+    for (i = 0; i < NELEM(counters); i++) {
+        fprintf(f, "  %-20s %llu\n", counters[i].name, (unsigned long long)stats_load(counters[i].val));
+    }
+    for (i = 0; i < NELEM(hists); i++) {
+        const struct stats_hist *h = hists[i].h;
+        uint64_t n = stats_load(&h->count);
+
+        fprintf(f, "  %-20s n %llu avg %.1f", hists[i].name, (unsigned long long)n,
+                n ? stats_scaled(i, stats_load(&h->sum)) / n : 0.0);
+        for (j = 0; j < NELEM(pcts); j++) {
+            fprintf(f, " %s %.1f", pcts[j].name, stats_scaled(i, stats_hist_pct(h, pcts[j].pct)));
+        }
+        fprintf(f, " max %.1f %s\n", stats_scaled(i, stats_load(&h->max)), hists[i].ns ? "us" : "B");
+    }
+}
+
+static void stats_json(FILE *f)
+{
+    size_t i, j;
+
+    fprintf(f, "{\n  \"uptime_s\": %.3f,\n  \"ring_size\": %lu,\n  \"counters\": {\n",
+            stats_uptime(), (unsigned long)ring_size);
+    for (i = 0; i < NELEM(counters); i++) {
+        fprintf(f, "    \"%s\": %llu%s\n", counters[i].name,
+                (unsigned long long)stats_load(counters[i].val), i + 1 < NELEM(counters) ? "," : "");
+    }
+    fprintf(f, "  },\n  \"histograms\": {\n");
+    for (i = 0; i < NELEM(hists); i++) {
+        const struct stats_hist *h = hists[i].h;
+
+        fprintf(f, "    \"%s\": { \"unit\": \"%s\", \"count\": %llu, \"sum\": %.1f",
+                hists[i].name, hists[i].ns ? "us" : "bytes",
+                (unsigned long long)stats_load(&h->count), stats_scaled(i, stats_load(&h->sum)));
+        for (j = 0; j < NELEM(pcts); j++) {
+            fprintf(f, ", \"%s\": %.1f", pcts[j].name, stats_scaled(i, stats_hist_pct(h, pcts[j].pct)));
+        }
+        fprintf(f, ", \"max\": %.1f }%s\n", stats_scaled(i, stats_load(&h->max)),
+                i + 1 < NELEM(hists) ? "," : "");
+    }
+    fprintf(f, "  }\n}\n");
+}
+
+/* Prometheus text exposition: counters and one summary per histogram */
+static void stats_prom(FILE *f)
+{
+    size_t i, j;
+
+    for (i = 0; i < NELEM(counters); i++) {
+        fprintf(f, "# TYPE usbserial_%s_total counter\nusbserial_%s_total %llu\n",
+                counters[i].name, counters[i].name, (unsigned long long)stats_load(counters[i].val));
+    }
+    for (i = 0; i < NELEM(hists); i++) {
+        const struct stats_hist *h = hists[i].h;
+        const char *unit = hists[i].ns ? "seconds" : "bytes";
+        double scale = hists[i].ns ? 1e-9 : 1;
+
+        fprintf(f, "# TYPE usbserial_%s_%s summary\n", hists[i].name, unit);
+        for (j = 0; j < NELEM(pcts); j++) {
+            fprintf(f, "usbserial_%s_%s{quantile=\"%s\"} %g\n", hists[i].name, unit,
+                    pcts[j].quantile, stats_hist_pct(h, pcts[j].pct) * scale);
+        }
+        fprintf(f, "usbserial_%s_%s_sum %g\nusbserial_%s_%s_count %llu\n",
+                hists[i].name, unit, stats_load(&h->sum) * scale,
+                hists[i].name, unit, (unsigned long long)stats_load(&h->count));
+    }
+}
+
+/* JSON when path ends in .json, Prometheus text otherwise; replaced
+ * with a rename so scrapers never see a partial file */
+int stats_write_file(const char *path)
+{
+    size_t len = strlen(path);
+    char *tmp = malloc(len + 5);
+    FILE *f;
+    int res = -1;
+
+    if (!tmp) {
+        return -1;
+    }
+    sprintf(tmp, "%s.tmp", path);
+    if ((f = fopen(tmp, "w")) != NULL) {
+        stats_port_poll();
+        if (len > 5 && !strcmp(path + len - 5, ".json")) {
+            stats_json(f);
+        } else {
+            stats_prom(f);
+        }
+        res = ferror(f) ? -1 : 0;
+        if (fclose(f) != 0) {
+            res = -1;
+        }
+#ifdef _WIN32
+        remove(path);
+#endif
+        if (res == 0 && rename(tmp, path) != 0) {
+            res = -1;
+        }
+    }
+    free(tmp);
+    return res;
+}
@@ -0,0 +1,50 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define STATS_SUB_BITS  4
+#define STATS_SUB       (1 << STATS_SUB_BITS)
+#define STATS_BUCKETS   ((64 - STATS_SUB_BITS + 1) * STATS_SUB)
+
+/* log-linear histogram: exact below 2 * STATS_SUB, then STATS_SUB buckets
+ * per power of two (~6% error). One thread writes it, others may read it
+ * at any time without a lock. */
+struct stats_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t bucket[STATS_BUCKETS];
+};
+
+uint64_t stats_now(void);
+void stats_hist_add(struct stats_hist *h, uint64_t v);
+uint64_t stats_hist_pct(const struct stats_hist *h, double pct);
+
+/* terminal pipeline counters; each group has a single writer thread */
+int stats_init(size_t ring_size, int port_fd);
+
+/* port reader */
+void stats_rx_read(size_t n);
+void stats_rx_queued(size_t ring_len);
+void stats_rx_wakeup(uint64_t wait_ns);
+void stats_rx_stall(void);
+size_t stats_rx_high_water(void);
+unsigned long stats_rx_stalls(void);
+void stats_port_lost(void);
+void stats_port_found(int fd, uint64_t down_ns);
+
+/* stdout sink */
+void stats_out_write(size_t n);
+
+/* TX queue */
+void stats_tx_queued(void);
+void stats_tx_write(size_t n);
+void stats_tx_done(void);
+
+void stats_print_line(FILE *f);
+void stats_dump(FILE *f);
+int stats_write_file(const char *path);
+#endif
@@ -0,0 +1,337 @@
+/*  test_capz.c - LZ4 frames of --compress decoded back, run by make test.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "capz.h"
+
+#define TEST_SHORT_MAX      300
+#define TEST_LONG_SIZE      (3 * CAPZ_BLOCK_SIZE + 12345)
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* capz.o writes through this one, usbserial.c is not linked in */
+int serial_write_out(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        if ((n = write(fd, buf, len)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static uint32_t rnd_state = 2026;
+
+static unsigned int rnd(void)
+{
+    rnd_state = rnd_state * 1103515245 + 12345;
+    return rnd_state >> 16;
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint32_t rotl(uint32_t v, int r)
+{
+    return (v << r) | (v >> (32 - r));
+}
+
+/* xxHash32, seed 0, inputs under 16 bytes */
+static uint32_t xxh32_short(const uint8_t *p, size_t len)
+{
+    uint32_t h = 374761393u + len;
+
+    for (; len >= 4; len -= 4, p += 4) {
+        h = rotl(h + le32(p) * 3266489917u, 17) * 668265263u;
+    }
+    while (len--) {
+        h = rotl(h + *p++ * 374761393u, 11) * 2654435761u;
+    }
+    h ^= h >> 15;
+    h *= 2246822519u;
+    h ^= h >> 13;
+    h *= 3266489917u;
+    return h ^ (h >> 16);
+}
+
+static size_t lz4_len(const uint8_t **ip, const uint8_t *end, size_t len)
+{
+    if (len == 15) {
+        do {
+            if (*ip >= end) {
+                return (size_t)-1;
+            }
+            len += **ip;
+        } while (*(*ip)++ == 255);
+    }
+    return len;
+}
+
+/* LZ4 block decoder, strict about the end of block rules liblz4 relies
+ * on: the last 5 bytes are literals, no match starts in the last 12;
+ * returns the decoded size, -1 on a malformed block */
+static long lz4_block(const uint8_t *ip, size_t n, uint8_t *dst, size_t max)
+{
+    const uint8_t *end = ip + n;
+    uint8_t *op = dst;
+    size_t nlit, mlen, off;
+    uint8_t token;
+
+    for (;;) {
+        if (ip >= end) {
+            return -1;
+        }
+        token = *ip++;
+        nlit = lz4_len(&ip, end, token >> 4);
+        if (nlit == (size_t)-1 || nlit > (size_t)(end - ip) || nlit > max - (op - dst)) {
+            return -1;
+        }
+        memcpy(op, ip, nlit);
+        op += nlit;
+        ip += nlit;
+        if (ip == end) {
+            /* the closing literals-only sequence */
+            return (token & 15) ? -1 : op - dst;
+        }
+        if (max - (op - dst) < 12) {
+            return -1;
+        }
+        if (end - ip < 2) {
+            return -1;
+        }
+        off = ip[0] | ip[1] << 8;
+        ip += 2;
+        mlen = lz4_len(&ip, end, token & 15);
+        if (mlen == (size_t)-1 || !off || off > (size_t)(op - dst)) {
+            return -1;
+        }
+        mlen += 4;
+        if (mlen > max - (op - dst)) {
+            return -1;
+        }
+        for (; mlen; mlen--, op++) {
+            *op = op[-off];
+        }
+        if (max - (op - dst) < 5) {
+            return -1;
+        }
+    }
+}
+
+/* one frame per flushed block; ref holds them back to back, stored counts
+ * the blocks that went out uncompressed */
+static void check_frames(FILE *f, const uint8_t *ref, const size_t *lens, int nblocks,
+                         int *stored)
+{
+    static uint8_t in[CAPZ_BLOCK_SIZE + 64], out[CAPZ_BLOCK_SIZE];
+    uint8_t hdr[7];
+    uint32_t bsize;
+    long n;
+    int i;
+
+    *stored = 0;
+    for (i = 0; i < nblocks; ref += lens[i], i++) {
+        if (fread(hdr, sizeof(hdr), 1, f) != 1) {
+            CHECK(!"short file");
+            return;
+        }
+        CHECK(le32(hdr) == 0x184D2204);
+        CHECK(hdr[4] == 0x60 && hdr[5] == 0x70);
+        CHECK(hdr[6] == ((xxh32_short(hdr + 4, 2) >> 8) & 0xFF));
+        if (fread(in, 4, 1, f) != 1) {
+            CHECK(!"short file");
+            return;
+        }
+        bsize = le32(in);
+        if ((bsize & 0x7FFFFFFF) > sizeof(in) ||
+            fread(in, bsize & 0x7FFFFFFF, 1, f) != 1) {
+            CHECK(!"bad block size");
+            return;
+        }
+        if (bsize & 0x80000000u) {
+            (*stored)++;
+            n = bsize & 0x7FFFFFFF;
+            memcpy(out, in, n);
+        } else {
+            /* a compressed block must have shrunk */
+            CHECK(bsize < lens[i]);
+            n = lz4_block(in, bsize, out, lens[i]);
+        }
+        if (n != (long)lens[i] || memcmp(out, ref, lens[i])) {
+            fprintf(stderr, "block %d of %zu bytes: decoded %ld\n", i, lens[i], n);
+            CHECK(!"round trip");
+        }
+        CHECK(fread(in, 4, 1, f) == 1 && le32(in) == 0);
+    }
+    CHECK(fread(in, 1, 1, f) == 0);
+}
+
+/* each block written and flushed alone, so each is one frame */
+static void roundtrip(const char *name, const uint8_t *data, const size_t *lens, int nblocks,
+                      int *stored)
+{
+    char path[] = "/tmp/test_capz.XXXXXX";
+    int fd = mkstemp(path), i;
+    const uint8_t *p = data;
+    int before = failures;
+    struct capz *z;
+    FILE *f;
+
+    if (fd == -1) {
+        CHECK(!"mkstemp");
+        return;
+    }
+    unlink(path);
+    z = capz_start(CAPZ_LZ4, 0, fd, 0);
+    CHECK(z != NULL);
+    if (!z) {
+        close(fd);
+        return;
+    }
+    for (i = 0; i < nblocks; p += lens[i], i++) {
+        CHECK(capz_write(z, (const char *)p, lens[i]) == 0);
+        CHECK(capz_flush(z) == 0);
+    }
+    capz_stop(z);
+
+    lseek(fd, 0, SEEK_SET);
+    if (!(f = fdopen(fd, "rb"))) {
+        close(fd);
+        return;
+    }
+    check_frames(f, data, lens, nblocks, stored);
+    fclose(f);
+    if (failures != before) {
+        fprintf(stderr, "in the %s blocks\n", name);
+    }
+}
+
+/* every length up to TEST_SHORT_MAX, around the 12 / 5 byte end rules */
+static void test_short(void)
+{
+    static uint8_t data[TEST_SHORT_MAX * (TEST_SHORT_MAX + 1) / 2];
+    static size_t lens[TEST_SHORT_MAX];
+    size_t i, n, pos;
+    int stored;
+
+    /* highly repetitive: one byte, then a short period */
+    for (n = 1, pos = 0; n <= TEST_SHORT_MAX; pos += n, n++) {
+        lens[n - 1] = n;
+        for (i = 0; i < n; i++) {
+            data[pos + i] = n & 1 ? 'a' : "abc"[i % 3];
+        }
+    }
+    roundtrip("repetitive", data, lens, TEST_SHORT_MAX, &stored);
+    /* under 13 bytes nothing can match, those go out stored */
+    CHECK(stored >= 12 && stored < TEST_SHORT_MAX / 2);
+
+    /* incompressible: stored, and still framed right */
+    for (i = 0; i < pos; i++) {
+        data[i] = rnd();
+    }
+    roundtrip("random", data, lens, TEST_SHORT_MAX, &stored);
+}
+
+/* full blocks, matches right up to the 64K offset limit and past it */
+static void test_long(void)
+{
+    uint8_t *data = malloc(TEST_LONG_SIZE);
+    size_t lens[4], i;
+    int stored;
+
+    if (!data) {
+        CHECK(!"malloc");
+        return;
+    }
+    for (i = 0; i < 65536; i++) {
+        data[i] = rnd();
+    }
+    for (; i < TEST_LONG_SIZE; i++) {
+        /* runs of fresh bytes and of repeats from 65535 and 65536 back,
+         * the encoder may only use the first */
+        switch (i / 64 % 3) {
+        case 0:
+            data[i] = rnd();
+            break;
+        case 1:
+            data[i] = data[i - 65535];
+            break;
+        default:
+            data[i] = data[i - 65536];
+        }
+    }
+    lens[0] = CAPZ_BLOCK_SIZE;
+    lens[1] = CAPZ_BLOCK_SIZE;
+    lens[2] = CAPZ_BLOCK_SIZE;
+    lens[3] = TEST_LONG_SIZE - 3 * CAPZ_BLOCK_SIZE;
+    roundtrip("long", data, lens, 4, &stored);
+
+    /* words from a small vocabulary: matches at every offset up to 64K */
+    for (i = 0; i < TEST_LONG_SIZE; i++) {
+        uint32_t w = rnd() % 512, k, wlen = 3 + w % 10;
+
+        for (k = 0; k < wlen && i < TEST_LONG_SIZE; k++, i++) {
+            data[i] = 'a' + (w * 7 + k * 13) % 26;
+        }
+        if (i < TEST_LONG_SIZE) {
+            data[i] = rnd() % 16 ? ' ' : '\n';
+        }
+    }
+    roundtrip("words", data, lens, 4, &stored);
+    CHECK(stored == 0);
+
+    memset(data, 'x', TEST_LONG_SIZE);
+    roundtrip("constant", data, lens, 4, &stored);
+    CHECK(stored == 0);
+    free(data);
+}
+
+int main(void)
+{
+    int method, level;
+
+    CHECK(capz_parse("lz4,8", &method, &level) == 0 && method == CAPZ_LZ4 && level == 8);
+    CHECK(capz_parse("gzip", &method, &level) == -1);
+    test_short();
+    test_long();
+
+    printf("test_capz: %s (%s)\n", failures ? "FAILED" : "ok", capz_name(CAPZ_LZ4));
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,372 @@
+/*  test_frame.c - unit tests for the -F frame decoders, run by make test.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "scan.h"
+#include "frame.h"
+
+#define TEST_MAX_FRAMES     16
+#define TEST_STREAM_SIZE    4096
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s [%s]: check failed: %s\n", __FILE__, __LINE__, \
+                    __func__, scan->name, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* what the callback was handed, frames back to back */
+struct got {
+    char data[TEST_STREAM_SIZE];
+    size_t fill;
+    size_t len[TEST_MAX_FRAMES];
+    int n;
+    int stop_after;             /* callback returns 1 after this many, 0 = never */
+};
+
+struct sample {
+    const char *data;
+    size_t len;
+};
+
+/* payloads with every byte the encodings treat specially */
+static const struct sample samples[] = {
+    { "hello", 5 },
+    { "\x00\x00", 2 },
+    { "\xC0\xDB\xDC\xDD", 4 },
+    { "\x7E\x7D\x5E\x5D\x20", 5 },
+    { "a\x00" "b\x00\x00" "c", 6 },
+    { "\x01", 1 },
+};
+
+static int test_cb(char *frame, size_t len, void *arg)
+{
+    struct got *g = arg;
+
+    if (g->n < TEST_MAX_FRAMES && g->fill + len <= sizeof(g->data)) {
+        memcpy(g->data + g->fill, frame, len);
+        g->fill += len;
+        g->len[g->n] = len;
+    }
+    g->n++;
+    return g->stop_after && g->n >= g->stop_after;
+}
+
+/* bitwise CRC-16/X.25 register, independent of the scan tables */
+static uint16_t test_crc16(uint16_t crc, const unsigned char *p, size_t len)
+{
+    int i;
+
+    while (len--) {
+        crc ^= *p++;
+        for (i = 0; i < 8; i++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+static size_t enc_cobs(unsigned char *out, const unsigned char *in, size_t len)
+{
+    size_t o = 1, code_at = 0, i;
+    unsigned char code = 1;
+
+    for (i = 0; i < len; i++) {
+        if (in[i]) {
+            out[o++] = in[i];
+            code++;
+        }
+        if (!in[i] || code == 0xFF) {
+            out[code_at] = code;
+            code_at = o++;
+            code = 1;
+        }
+    }
+    out[code_at] = code;
+    out[o++] = 0;
+    return o;
+}
+
+static size_t enc_slip(unsigned char *out, const unsigned char *in, size_t len)
+{
+    size_t o = 0, i;
+
+    out[o++] = 0xC0;
+    for (i = 0; i < len; i++) {
+        if (in[i] == 0xC0 || in[i] == 0xDB) {
+            out[o++] = 0xDB;
+            out[o++] = in[i] == 0xC0 ? 0xDC : 0xDD;
+        } else {
+            out[o++] = in[i];
+        }
+    }
+    out[o++] = 0xC0;
+    return o;
+}
+
+static size_t enc_hdlc_byte(unsigned char *out, unsigned char c)
+{
+    if (c == 0x7E || c == 0x7D) {
+        out[0] = 0x7D;
+        out[1] = c ^ 0x20;
+        return 2;
+    }
+    out[0] = c;
+    return 1;
+}
+
+static size_t enc_hdlc(unsigned char *out, const unsigned char *in, size_t len)
+{
+    uint16_t fcs = ~test_crc16(0xFFFF, in, len);
+    size_t o = 0, i;
+
+    out[o++] = 0x7E;
+    for (i = 0; i < len; i++) {
+        o += enc_hdlc_byte(out + o, in[i]);
+    }
+    o += enc_hdlc_byte(out + o, fcs & 0xFF);
+    o += enc_hdlc_byte(out + o, fcs >> 8);
+    out[o++] = 0x7E;
+    return o;
+}
+
+static size_t enc_len(unsigned char *out, const unsigned char *in, size_t len)
+{
+    out[0] = len >> 8;
+    out[1] = len & 0xFF;
+    memcpy(out + 2, in, len);
+    return len + 2;
+}
+
+static size_t (*const encoders[])(unsigned char *, const unsigned char *, size_t) = {
+    [FRAME_COBS] = enc_cobs,
+    [FRAME_SLIP] = enc_slip,
+    [FRAME_HDLC] = enc_hdlc,
+    [FRAME_LEN]  = enc_len,
+};
+
+static size_t encode_samples(int type, unsigned char *out)
+{
+    size_t n = 0, i;
+
+    for (i = 0; i < sizeof(samples) / sizeof(samples[0]); i++) {
+        n += encoders[type](out + n, (const unsigned char *)samples[i].data, samples[i].len);
+    }
+    return n;
+}
+
+static void check_samples(const struct got *g)
+{
+    size_t i, off = 0;
+
+    CHECK(g->n == (int)(sizeof(samples) / sizeof(samples[0])));
+    for (i = 0; i < sizeof(samples) / sizeof(samples[0]) && (int)i < g->n; i++) {
+        CHECK(g->len[i] == samples[i].len);
+        CHECK(!memcmp(g->data + off, samples[i].data, samples[i].len));
+        off += g->len[i];
+    }
+}
+
+/* the stream cut into reads of every size, and at every single offset */
+static void test_split(int type)
+{
+    unsigned char stream[TEST_STREAM_SIZE];
+    size_t len = encode_samples(type, stream), chunk, pos, n, cut;
+    struct frame_dec d;
+    struct got g;
+
+    for (chunk = 1; chunk <= len; chunk++) {
+        memset(&g, 0, sizeof(g));
+        CHECK(frame_init(&d, type, 64) == 0);
+        for (pos = 0; pos < len; pos += n) {
+            n = len - pos < chunk ? len - pos : chunk;
+            CHECK(frame_decode(&d, (const char *)stream + pos, n, test_cb, &g) == n);
+        }
+        check_samples(&g);
+        CHECK(d.errors == 0 && d.frames == g.n);
+        frame_free(&d);
+    }
+    for (cut = 0; cut <= len; cut++) {
+        memset(&g, 0, sizeof(g));
+        CHECK(frame_init(&d, type, 64) == 0);
+        frame_decode(&d, (const char *)stream, cut, test_cb, &g);
+        frame_decode(&d, (const char *)stream + cut, len - cut, test_cb, &g);
+        check_samples(&g);
+        frame_free(&d);
+    }
+}
+
+/* a frame over max is counted as an error and the next one still decodes */
+static void test_overrun(int type)
+{
+    unsigned char big[40], stream[256];
+    struct frame_dec d;
+    struct got g;
+    size_t n;
+
+    memset(big, 'x', sizeof(big));
+    n = encoders[type](stream, big, sizeof(big));
+    n += encoders[type](stream + n, (const unsigned char *)"ok", 2);
+
+    memset(&g, 0, sizeof(g));
+    CHECK(frame_init(&d, type, 16) == 0);
+    CHECK(frame_decode(&d, (const char *)stream, 7, test_cb, &g) == 7);
+    CHECK(frame_decode(&d, (const char *)stream + 7, n - 7, test_cb, &g) == n - 7);
+    CHECK(d.errors == 1 && d.frames == 1);
+    CHECK(g.n == 1 && g.len[0] == 2 && !memcmp(g.data, "ok", 2));
+    frame_free(&d);
+}
+
+static void test_escapes(void)
+{
+    /* SLIP: an escape split from its code, and an unknown code kept as is */
+    static const char slip[] = "\xC0" "a\xDB" "\xDC" "b\xDB" "q\xC0";
+    /* HDLC: bad FCS, then a good frame behind back to back flags */
+    unsigned char hdlc[64];
+    /* COBS: a delimiter inside a block cuts the frame short */
+    static const char cobs[] = "\x05" "ab\x00" "\x03" "cd\x00";
+    struct frame_dec d;
+    struct got g;
+    size_t n;
+
+    memset(&g, 0, sizeof(g));
+    CHECK(frame_init(&d, FRAME_SLIP, 64) == 0);
+    frame_decode(&d, slip, 3, test_cb, &g);
+    frame_decode(&d, slip + 3, sizeof(slip) - 1 - 3, test_cb, &g);
+    CHECK(g.n == 1 && g.len[0] == 4 && !memcmp(g.data, "a\xC0" "bq", 4));
+    frame_free(&d);
+
+    n = enc_hdlc(hdlc, (const unsigned char *)"bad", 3);
+    hdlc[2] ^= 1;
+    hdlc[n++] = 0x7E;
+    n += enc_hdlc(hdlc + n, (const unsigned char *)"good", 4);
+    memset(&g, 0, sizeof(g));
+    CHECK(frame_init(&d, FRAME_HDLC, 64) == 0);
+    CHECK(frame_decode(&d, (const char *)hdlc, n, test_cb, &g) == n);
+    CHECK(d.errors == 1 && g.n == 1 && g.len[0] == 4 && !memcmp(g.data, "good", 4));
+    frame_free(&d);
+
+    memset(&g, 0, sizeof(g));
+    CHECK(frame_init(&d, FRAME_COBS, 64) == 0);
+    CHECK(frame_decode(&d, cobs, sizeof(cobs) - 1, test_cb, &g) == sizeof(cobs) - 1);
+    CHECK(d.errors == 1 && g.n == 1 && g.len[0] == 2 && !memcmp(g.data, "cd", 2));
+    frame_free(&d);
+
+    /* COBS: a full 254 byte block has no implied zero behind it */
+    {
+        unsigned char in[300], out[320];
+        size_t i;
+
+        for (i = 0; i < sizeof(in); i++) {
+            in[i] = i % 255 + 1;
+        }
+        n = enc_cobs(out, in, sizeof(in));
+        memset(&g, 0, sizeof(g));
+        CHECK(frame_init(&d, FRAME_COBS, 512) == 0);
+        CHECK(frame_decode(&d, (const char *)out, n, test_cb, &g) == n);
+        CHECK(g.n == 1 && g.len[0] == sizeof(in) && !memcmp(g.data, in, sizeof(in)));
+        frame_free(&d);
+    }
+}
+
+/* 16 bit big endian length: 0, exactly max, max + 1, and 0xFFFF */
+static void test_len_limits(void)
+{
+    static unsigned char stream[3 * 70000];
+    static unsigned char payload[65535];
+    struct frame_dec d;
+    struct got g;
+    size_t n = 0;
+
+    memset(payload, 'p', sizeof(payload));
+    n += enc_len(stream + n, payload, 0);
+    n += enc_len(stream + n, payload, 32);
+    n += enc_len(stream + n, payload, 33);
+    n += enc_len(stream + n, (const unsigned char *)"end", 3);
+
+    memset(&g, 0, sizeof(g));
+    CHECK(frame_init(&d, FRAME_LEN, 32) == 0);
+    CHECK(frame_decode(&d, (const char *)stream, n, test_cb, &g) == n);
+    CHECK(d.frames == 3 && d.errors == 1);
+    CHECK(g.n == 3 && g.len[0] == 0 && g.len[1] == 32 && g.len[2] == 3);
+    CHECK(!memcmp(g.data + 32, "end", 3));
+    frame_free(&d);
+
+    n = enc_len(stream, payload, sizeof(payload));
+    memset(&g, 0, sizeof(g));
+    CHECK(frame_init(&d, FRAME_LEN, FRAME_MAX_DEFAULT) == 0);
+    CHECK(frame_decode(&d, (const char *)stream, 1, test_cb, &g) == 1);
+    CHECK(frame_decode(&d, (const char *)stream + 1, n - 1, test_cb, &g) == n - 1);
+    CHECK(d.frames == 1 && d.errors == 0 && g.n == 1);
+    frame_free(&d);
+}
+
+/* a non-zero callback return stops right behind that frame */
+static void test_stop(int type)
+{
+    unsigned char stream[TEST_STREAM_SIZE];
+    size_t len = encode_samples(type, stream), used;
+    struct frame_dec d;
+    struct got g;
+
+    memset(&g, 0, sizeof(g));
+    g.stop_after = 2;
+    CHECK(frame_init(&d, type, 64) == 0);
+    used = frame_decode(&d, (const char *)stream, len, test_cb, &g);
+    CHECK(g.n == 2 && used < len);
+    g.stop_after = 0;
+    CHECK(frame_decode(&d, (const char *)stream + used, len - used, test_cb, &g) == len - used);
+    check_samples(&g);
+    frame_free(&d);
+}
+
+int main(void)
+{
+    static const int types[] = { FRAME_COBS, FRAME_SLIP, FRAME_HDLC, FRAME_LEN };
+    const struct scan_impl *impl;
+    size_t t;
+    int i;
+
+    scan_init();
+    CHECK(frame_parse_type("hdlc") == FRAME_HDLC && frame_parse_type("x") == -1);
+
+    /* every kernel the CPU runs, the decoders lean on find/find_set/crc16 */
+    for (i = 0; (impl = scan_impl_at(i)) != NULL; i++) {
+        if (!impl->supported()) {
+            continue;
+        }
+        scan = impl;
+        for (t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+            test_split(types[t]);
+            test_overrun(types[t]);
+            test_stop(types[t]);
+        }
+        test_escapes();
+        test_len_limits();
+    }
+
+    printf("test_frame: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,548 @@
+/*  test_pty.c - end to end tests of usbserial against pty pairs, run by
+ *  make test as ./test_pty ./usbserial.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "capfmt.h"
+
+#define CHILD_LOG_SIZE      8192
+#define REPLAY_MSG_SIZE     8
+#define REPLAY_SLACK_MS     25          /* arrival vs recorded offset */
+#define SERVE_RX_LINES      200
+#define SERVE_TX_LINES      50
+#define SERVE_TX_LEN        46          /* "A000-" 40 fill bytes and '\n' */
+#define RECONNECT_WITHIN_MS 50          /* node back -> port reopened */
+
+static const char *usbserial = "./usbserial";
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+struct child {
+    pid_t pid;
+    int out;
+    int err;
+    char log[CHILD_LOG_SIZE];           /* its stderr so far */
+    size_t loglen;
+    size_t seen;                        /* child_expect matched up to here */
+};
+
+static int64_t test_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* master side, non-blocking and kept from the children, so closing it
+ * hangs the slave up; name gets the slave path */
+static int test_openpt(char *name, size_t len)
+{
+    int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd == -1 || grantpt(fd) == -1 || unlockpt(fd) == -1 ||
+        ptsname_r(fd, name, len) != 0) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+/* usbserial with args, stdin on /dev/null, stdout and stderr on pipes */
+static int child_spawn(struct child *c, const char **args)
+{
+    const char *argv[32];
+    int out[2], err[2], i;
+
+    argv[0] = usbserial;
+    for (i = 0; args[i] && i < 30; i++) {
+        argv[i + 1] = args[i];
+    }
+    argv[i + 1] = NULL;
+
+    memset(c, 0, sizeof(*c));
+    if (pipe2(out, O_CLOEXEC) == -1 || pipe2(err, O_CLOEXEC) == -1) {
+        return -1;
+    }
+    if ((c->pid = fork()) == 0) {
+        int null = open("/dev/null", O_RDONLY);
+
+        dup2(null, STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        dup2(err[1], STDERR_FILENO);
+        execv(usbserial, (char **)argv);
+        _exit(127);
+    }
+    close(out[1]);
+    close(err[1]);
+    c->out = out[0];
+    c->err = err[0];
+    fcntl(c->out, F_SETFL, O_NONBLOCK);
+    fcntl(c->err, F_SETFL, O_NONBLOCK);
+    return c->pid == -1 ? -1 : 0;
+}
+
+/* collects stderr for up to ms, returns 0 once text shows up past the
+ * last match */
+static int child_expect(struct child *c, const char *text, int ms)
+{
+    struct pollfd pfd = { c->err, POLLIN, 0 };
+    int64_t end = test_now_ms() + ms;
+    const char *p;
+    ssize_t n;
+
+    for (;;) {
+        c->log[c->loglen] = '\0';
+        if ((p = strstr(c->log + c->seen, text)) != NULL) {
+            c->seen = p - c->log + strlen(text);
+            return 0;
+        }
+        if (test_now_ms() >= end || c->loglen == sizeof(c->log) - 1) {
+            return -1;
+        }
+        if (poll(&pfd, 1, (int)(end - test_now_ms())) <= 0) {
+            continue;
+        }
+        n = read(c->err, c->log + c->loglen, sizeof(c->log) - 1 - c->loglen);
+        if (n <= 0) {
+            c->log[c->loglen] = '\0';
+            return strstr(c->log + c->seen, text) ? 0 : -1;
+        }
+        c->loglen += n;
+    }
+}
+
+/* the rest of stderr, up to its end or the end of the log */
+static void child_drain(struct child *c)
+{
+    ssize_t n;
+
+    while (c->loglen < sizeof(c->log) - 1 &&
+           (n = read(c->err, c->log + c->loglen, sizeof(c->log) - 1 - c->loglen)) > 0) {
+        c->loglen += n;
+    }
+    c->log[c->loglen] = '\0';
+}
+
+/* waits up to ms for the child to exit (SIGINT first when stop is set),
+ * returns its exit status, -1 if it had to be killed */
+static int child_wait(struct child *c, int ms, int stop)
+{
+    int64_t end = test_now_ms() + ms;
+    int status, res = -1;
+
+    if (stop) {
+        kill(c->pid, SIGINT);
+    }
+    while (waitpid(c->pid, &status, WNOHANG) == 0) {
+        if (test_now_ms() >= end) {
+            kill(c->pid, SIGKILL);
+            waitpid(c->pid, &status, 0);
+            status = -1;
+            break;
+        }
+        usleep(1000);
+    }
+    if (status != -1 && WIFEXITED(status)) {
+        res = WEXITSTATUS(status);
+    }
+    child_drain(c);
+    close(c->out);
+    close(c->err);
+    return res;
+}
+
+/* exactly len bytes within ms, or what arrived by then; a pty master
+ * reads EIO while no one has the slave open, that is waited out too */
+static size_t test_read(int fd, char *buf, size_t len, int ms)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int64_t end = test_now_ms() + ms;
+    size_t got = 0;
+    ssize_t n;
+
+    while (got < len && test_now_ms() < end) {
+        if (poll(&pfd, 1, (int)(end - test_now_ms())) <= 0) {
+            continue;
+        }
+        n = read(fd, buf + got, len - got);
+        if (n > 0) {
+            got += n;
+        } else if (n == -1 && errno == EIO) {
+            usleep(1000);
+        } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            break;
+        }
+    }
+    return got;
+}
+
+/* -B record file: record i carries an 8 byte message at offset ms[i],
+ * port 0 for a single port capture, else alternating 1..nports */
+static const int replay_ms[] = { 0, 40, 120, 250, 400, 430 };
+#define REPLAY_RECS (int)(sizeof(replay_ms) / sizeof(replay_ms[0]))
+
+static void replay_msg(char *msg, int i, int port)
+{
+    char tmp[16];
+
+    snprintf(tmp, sizeof(tmp), "%c%07d", 'A' + port, i);
+    memcpy(msg, tmp, REPLAY_MSG_SIZE);
+}
+
+static int replay_port(int i, int nports)
+{
+    return nports ? 1 + i % nports : 0;
+}
+
+static int write_capture(const char *path, int nports)
+{
+    struct capfmt_hdr hdr;
+    struct capfmt_rec rec;
+    char msg[REPLAY_MSG_SIZE];
+    uint64_t base = 1000000000ULL;
+    FILE *f = fopen(path, "wb");
+    int i, ok;
+
+    if (!f) {
+        return -1;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CAPFMT_MAGIC, sizeof(hdr.magic));
+    hdr.version = CAPFMT_VERSION;
+    hdr.start_ns = base;
+    ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    for (i = 0; i < REPLAY_RECS; i++) {
+        memset(&rec, 0, sizeof(rec));
+        rec.type = CAPFMT_DATA;
+        rec.len = REPLAY_MSG_SIZE;
+        rec.ts_ns = base + replay_ms[i] * 1000000ULL;
+        rec.port = replay_port(i, nports);
+        replay_msg(msg, i, rec.port);
+        ok &= fwrite(&rec, sizeof(rec), 1, f) == 1 && fwrite(msg, sizeof(msg), 1, f) == 1;
+    }
+    return fclose(f) == 0 && ok ? 0 : -1;
+}
+
+/* records arrive at their recorded offsets divided by speed */
+static void test_replay_timing(const char *path, const char *speed, double div)
+{
+    const char *args[] = { "-d", NULL, "--replay", path, "--speed", speed, NULL };
+    char tty[64], msg[REPLAY_MSG_SIZE], want[REPLAY_MSG_SIZE];
+    int64_t at[REPLAY_RECS];
+    struct child c;
+    int master, i;
+
+    if ((master = test_openpt(tty, sizeof(tty))) == -1) {
+        CHECK(!"openpt");
+        return;
+    }
+    args[1] = tty;
+    CHECK(child_spawn(&c, args) == 0);
+
+    for (i = 0; i < REPLAY_RECS; i++) {
+        replay_msg(want, i, 0);
+        CHECK(test_read(master, msg, sizeof(msg), 2000) == sizeof(msg));
+        CHECK(!memcmp(msg, want, sizeof(msg)));
+        at[i] = test_now_ms();
+    }
+    for (i = 1; i < REPLAY_RECS; i++) {
+        int64_t late = (at[i] - at[0]) - (int64_t)(replay_ms[i] / div);
+
+        if (late < -REPLAY_SLACK_MS || late > REPLAY_SLACK_MS) {
+            fprintf(stderr, "record %d at %lld ms, recorded %d ms, speed %s\n", i,
+                    (long long)(at[i] - at[0]), replay_ms[i], speed);
+            CHECK(!"replay timing");
+        }
+    }
+    CHECK(child_wait(&c, 2000, 0) == 0);
+    CHECK(strstr(c.log, "replayed: 48 bytes in 6 writes") != NULL);
+    close(master);
+}
+
+/* a -M -B file needs --port, which sends only that port */
+static void test_replay_ports(const char *path)
+{
+    const char *args[] = { "-d", NULL, "--replay", path, "--speed", "max", NULL, NULL, NULL };
+    char tty[64], buf[REPLAY_RECS * REPLAY_MSG_SIZE], want[REPLAY_MSG_SIZE];
+    struct child c;
+    int master, i, n = 0;
+
+    if ((master = test_openpt(tty, sizeof(tty))) == -1) {
+        CHECK(!"openpt");
+        return;
+    }
+    args[1] = tty;
+    CHECK(child_spawn(&c, args) == 0);
+    CHECK(child_expect(&c, "pick one with --port", 2000) == 0);
+    CHECK(child_wait(&c, 2000, 0) == 1);
+    CHECK(test_read(master, buf, 1, 100) == 0);
+
+    args[6] = "--port";
+    args[7] = "2";
+    CHECK(child_spawn(&c, args) == 0);
+    for (i = 0; i < REPLAY_RECS; i++) {
+        if (replay_port(i, 2) != 2) {
+            continue;
+        }
+        replay_msg(want, i, 2);
+        CHECK(test_read(master, buf, REPLAY_MSG_SIZE, 2000) == REPLAY_MSG_SIZE);
+        CHECK(!memcmp(buf, want, REPLAY_MSG_SIZE));
+        n++;
+    }
+    CHECK(child_wait(&c, 2000, 0) == 0);
+    CHECK(test_read(master, buf, 1, 100) == 0);
+    CHECK(n == REPLAY_RECS / 2);
+    close(master);
+}
+
+/* ^C between records still reports and drains, and exits normally */
+static void test_replay_interrupt(const char *path)
+{
+    const char *args[] = { "-d", NULL, "--replay", path, "--speed", "0.1", NULL };
+    char tty[64], msg[REPLAY_MSG_SIZE];
+    struct child c;
+    int master;
+
+    if ((master = test_openpt(tty, sizeof(tty))) == -1) {
+        CHECK(!"openpt");
+        return;
+    }
+    args[1] = tty;
+    CHECK(child_spawn(&c, args) == 0);
+    CHECK(test_read(master, msg, sizeof(msg), 2000) == sizeof(msg));
+    CHECK(child_wait(&c, 300, 1) == 0);
+    CHECK(strstr(c.log, "interrupted") != NULL);
+    CHECK(strstr(c.log, "replayed: 8 bytes in 1 writes") != NULL);
+    close(master);
+}
+
+static void test_replay(void)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/tmp/usbserial_test.%d.cap", (int)getpid());
+    CHECK(write_capture(path, 0) == 0);
+    test_replay_timing(path, "1", 1);
+    test_replay_timing(path, "4", 4);
+    test_replay_interrupt(path);
+    CHECK(write_capture(path, 2) == 0);
+    test_replay_ports(path);
+    unlink(path);
+}
+
+/* a unix path, else loopback TCP on port; blocking until connected */
+static int test_connect(const char *path, int port)
+{
+    struct sockaddr_un sun;
+    struct sockaddr_in sin;
+    int fd = socket(path ? AF_UNIX : AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int res;
+
+    if (fd == -1) {
+        return -1;
+    }
+    if (path) {
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", path);
+        res = connect(fd, (struct sockaddr *)&sun, sizeof(sun));
+    } else {
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(port);
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        res = connect(fd, (struct sockaddr *)&sin, sizeof(sin));
+    }
+    if (res == -1) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+static void serve_tx_line(char *line, int client, int i)
+{
+    char tmp[8];
+
+    snprintf(tmp, sizeof(tmp), "%c%03d-", 'A' + client, i);
+    memcpy(line, tmp, 5);
+    memset(line + 5, 'a' + client, SERVE_TX_LEN - 6);
+    line[SERVE_TX_LEN - 1] = '\n';
+}
+
+/* --serve: a unix and a TCP client get the same RX stream, and lines
+ * both of them send in halves reach the port whole */
+static void test_serve(void)
+{
+    char tty[64], path[64], addrs[128], port[8];
+    const char *args[] = { "-d", tty, "--serve", addrs, NULL };
+    char rx[SERVE_RX_LINES * 8 + 1], got[sizeof(rx)];
+    char tx[2 * SERVE_TX_LINES * SERVE_TX_LEN], line[SERVE_TX_LEN];
+    int master, fd[2], next[2] = { 0, 0 }, i, k;
+    struct child c;
+
+    snprintf(path, sizeof(path), "/tmp/usbserial_test.%d.sock", (int)getpid());
+    snprintf(port, sizeof(port), "%d", 20000 + (int)getpid() % 20000);
+    snprintf(addrs, sizeof(addrs), "unix:%s,tcp:127.0.0.1:%s", path, port);
+    if ((master = test_openpt(tty, sizeof(tty))) == -1) {
+        CHECK(!"openpt");
+        return;
+    }
+    CHECK(child_spawn(&c, args) == 0);
+    CHECK(child_expect(&c, "^C to exit.", 2000) == 0);
+    CHECK((fd[0] = test_connect(path, 0)) != -1);
+    CHECK((fd[1] = test_connect(NULL, atoi(port))) != -1);
+    CHECK(child_expect(&c, "2 client(s)", 2000) == 0);
+
+    for (i = 0; i < SERVE_RX_LINES; i++) {
+        snprintf(rx + i * 8, 9, "rx %04d\n", i);
+    }
+    CHECK(write(master, rx, SERVE_RX_LINES * 8) == SERVE_RX_LINES * 8);
+    for (k = 0; k < 2; k++) {
+        CHECK(test_read(fd[k], got, SERVE_RX_LINES * 8, 2000) == SERVE_RX_LINES * 8);
+        CHECK(!memcmp(got, rx, SERVE_RX_LINES * 8));
+    }
+
+    /* first halves from both, then the second halves */
+    for (i = 0; i < SERVE_TX_LINES; i++) {
+        for (k = 0; k < 2; k++) {
+            serve_tx_line(line, k, i);
+            CHECK(write(fd[k], line, SERVE_TX_LEN / 2) == SERVE_TX_LEN / 2);
+        }
+        usleep(200);
+        for (k = 0; k < 2; k++) {
+            serve_tx_line(line, k, i);
+            CHECK(write(fd[k], line + SERVE_TX_LEN / 2, SERVE_TX_LEN - SERVE_TX_LEN / 2) ==
+                  SERVE_TX_LEN - SERVE_TX_LEN / 2);
+        }
+    }
+    CHECK(test_read(master, tx, sizeof(tx), 2000) == sizeof(tx));
+    for (i = 0; i < 2 * SERVE_TX_LINES; i++) {
+        k = tx[i * SERVE_TX_LEN] - 'A';
+        if (k < 0 || k > 1 || next[k] == SERVE_TX_LINES) {
+            CHECK(!"TX line from no client");
+            break;
+        }
+        serve_tx_line(line, k, next[k]++);
+        CHECK(!memcmp(tx + i * SERVE_TX_LEN, line, SERVE_TX_LEN));
+    }
+    CHECK(next[0] == SERVE_TX_LINES && next[1] == SERVE_TX_LINES);
+
+    close(fd[0]);
+    close(fd[1]);
+    CHECK(child_wait(&c, 2000, 1) == 0);
+    close(master);
+}
+
+/* --reconnect: the pty goes away with its link, a new one comes back
+ * under the same link; the terminal keeps running and reads from it */
+static void test_reconnect(void)
+{
+    char dir[64], link[96], tmp[96], tty[64], buf[8];
+    const char *args[] = { "-d", link, "--reconnect", NULL };
+    struct child c;
+    int64_t start;
+    int master;
+
+    snprintf(dir, sizeof(dir), "/tmp/usbserial_test.%d.d", (int)getpid());
+    snprintf(link, sizeof(link), "%s/tty", dir);
+    snprintf(tmp, sizeof(tmp), "%s/tty.new", dir);
+    if (mkdir(dir, 0700) == -1 || (master = test_openpt(tty, sizeof(tty))) == -1 ||
+        symlink(tty, link) == -1) {
+        CHECK(!"setup");
+        return;
+    }
+    CHECK(child_spawn(&c, args) == 0);
+    CHECK(child_expect(&c, "to exit.", 2000) == 0);
+    CHECK(write(master, "one\n", 4) == 4);
+    CHECK(test_read(c.out, buf, 4, 2000) == 4 && !memcmp(buf, "one\n", 4));
+
+    /* unplugged: the node and the link are gone */
+    close(master);
+    unlink(link);
+    CHECK(child_expect(&c, "port lost", 2000) == 0);
+    /* past the 10+20+...+320 ms retries, the next one is 640 ms out and
+     * only the directory watch can be this quick */
+    usleep(700000);
+
+    /* plugged back in, the link appears in one rename */
+    if ((master = test_openpt(tty, sizeof(tty))) == -1 || symlink(tty, tmp) == -1) {
+        CHECK(!"replug");
+        child_wait(&c, 2000, 1);
+        return;
+    }
+    start = test_now_ms();
+    CHECK(rename(tmp, link) == 0);
+    CHECK(child_expect(&c, "reconnected after", 2000) == 0);
+    if (test_now_ms() - start > RECONNECT_WITHIN_MS) {
+        fprintf(stderr, "reconnected %lld ms after the node came back\n",
+                (long long)(test_now_ms() - start));
+        CHECK(!"reconnect time");
+    }
+    CHECK(write(master, "two\n", 4) == 4);
+    CHECK(test_read(c.out, buf, 4, 2000) == 4 && !memcmp(buf, "two\n", 4));
+
+    CHECK(child_wait(&c, 2000, 1) == 0);
+    CHECK(strstr(c.log, "recv: 2 lines") != NULL);
+    close(master);
+    unlink(link);
+    rmdir(dir);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) {
+        usbserial = argv[1];
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    test_replay();
+    test_serve();
+    test_reconnect();
+
+    printf("test_pty: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
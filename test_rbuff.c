@@ -0,0 +1,231 @@
+/*  test_rbuff.c - unit tests for the SPSC ring, run by make test.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "rbuff.h"
+
+#define STRESS_RING_SIZE    4096
+#define STRESS_BYTES        (64ULL << 20)
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static void test_init(void)
+{
+    rbuf_t b;
+
+    CHECK(rbuf_init(&b, 1000) == 0);
+    CHECK(b.size == 1024 && b.mask == 1023);
+    CHECK(rbuf_is_empty(&b) && rbuf_space(&b) == 1024);
+    rbuf_free(&b);
+
+    CHECK(rbuf_init(&b, 0) == 0 && b.size == 1);
+    rbuf_free(&b);
+
+    errno = 0;
+    CHECK(rbuf_init(&b, SIZE_MAX / 2 + 2) == -1 && errno == EINVAL);
+    CHECK(rbuf_init(&b, SIZE_MAX) == -1 && !b.buf);
+}
+
+/* byte API and bulk copies across the end of the buffer */
+static void test_wrap(void)
+{
+    char out[16], in[16];
+    rbuf_t b;
+    int i, j;
+
+    CHECK(rbuf_init(&b, 16) == 0);
+    for (i = 0; i < 100; i++) {
+        for (j = 0; j < 7; j++) {
+            in[j] = (char)(i * 7 + j);
+        }
+        CHECK(rbuf_write(&b, in, 7) == 7);
+        CHECK(rbuf_len(&b) == 7);
+        CHECK(rbuf_read(&b, out, 7) == 7);
+        CHECK(!memcmp(in, out, 7));
+    }
+
+    /* full and empty */
+    for (i = 0; i < 16; i++) {
+        CHECK(rbuf_put(&b, (char)i));
+    }
+    CHECK(rbuf_is_full(&b) && !rbuf_put(&b, 'x'));
+    CHECK(rbuf_write(&b, in, 1) == 0);
+    for (i = 0; i < 16; i++) {
+        char c;
+
+        CHECK(rbuf_get(&b, &c) && c == (char)i);
+    }
+    CHECK(rbuf_is_empty(&b) && rbuf_read(&b, out, 1) == 0);
+
+    /* short transfers: as much as fits, as much as there is */
+    CHECK(rbuf_write(&b, in, 10) == 10);
+    CHECK(rbuf_write(&b, in, 10) == 6);
+    CHECK(rbuf_read(&b, out, 16) == 16);
+    CHECK(!memcmp(out, in, 10) && !memcmp(out + 10, in, 6));
+    rbuf_free(&b);
+}
+
+/* head and tail are free running: they overflow size_t and keep going */
+static void test_index_wrap(void)
+{
+    char in[12] = "abcdefghijk", out[12];
+    rbuf_t b;
+    int i;
+
+    CHECK(rbuf_init(&b, 16) == 0);
+    b.head = b.tail = SIZE_MAX - 20;
+    for (i = 0; i < 8; i++) {
+        CHECK(rbuf_write(&b, in, 11) == 11);
+        CHECK(rbuf_len(&b) == 11 && rbuf_space(&b) == 5);
+        CHECK(rbuf_read(&b, out, 11) == 11);
+        CHECK(!memcmp(in, out, 11));
+    }
+    CHECK(b.head < 100 && b.head == b.tail);
+    rbuf_free(&b);
+}
+
+/* spans stop at the end of the buffer, the rest comes with the next one */
+static void test_spans(void)
+{
+    size_t len;
+    char *p;
+    rbuf_t b;
+
+    CHECK(rbuf_init(&b, 16) == 0);
+    CHECK(rbuf_write(&b, "0123456789", 10) == 10);
+    CHECK(rbuf_read(&b, (char[10]){ 0 }, 10) == 10);
+
+    p = rbuf_write_span(&b, &len);
+    CHECK(p == b.buf + 10 && len == 6);
+    memcpy(p, "ABCDEF", 6);
+    rbuf_write_commit(&b, 6);
+    p = rbuf_write_span(&b, &len);
+    CHECK(p == b.buf && len == 10);
+    memcpy(p, "GHIJ", 4);
+    rbuf_write_commit(&b, 4);
+    CHECK(rbuf_len(&b) == 10);
+
+    p = rbuf_read_span(&b, &len);
+    CHECK(p == b.buf + 10 && len == 6 && !memcmp(p, "ABCDEF", 6));
+    rbuf_read_commit(&b, 2);
+    p = rbuf_read_span(&b, &len);
+    CHECK(p == b.buf + 12 && len == 4 && !memcmp(p, "CDEF", 4));
+    rbuf_read_commit(&b, 4);
+    p = rbuf_read_span(&b, &len);
+    CHECK(p == b.buf && len == 4 && !memcmp(p, "GHIJ", 4));
+    rbuf_read_commit(&b, 4);
+
+    CHECK(rbuf_read_span(&b, &len) == NULL && len == 0);
+    rbuf_write_commit(&b, rbuf_space(&b));
+    CHECK(rbuf_write_span(&b, &len) == NULL && len == 0);
+    rbuf_free(&b);
+}
+
+struct stress {
+    rbuf_t ring;
+    uint64_t bad;
+    uint64_t got;
+};
+
+/* consumer: drains through read spans and checks the byte sequence */
+static void *stress_consumer(void *p)
+{
+    struct stress *s = p;
+    size_t len, i;
+    char *span;
+
+    while (s->got < STRESS_BYTES) {
+        if (!(span = rbuf_read_span(&s->ring, &len))) {
+            sched_yield();
+            continue;
+        }
+        for (i = 0; i < len; i++) {
+            if ((unsigned char)span[i] != (unsigned char)((s->got + i) * 7)) {
+                s->bad++;
+            }
+        }
+        rbuf_read_commit(&s->ring, len);
+        s->got += len;
+    }
+    return NULL;
+}
+
+/* one producer, one consumer, odd sized writes so every offset wraps */
+static void test_spsc(void)
+{
+    struct stress s;
+    pthread_t consumer;
+    uint64_t sent = 0;
+    size_t len, want = 1, i;
+    char *span;
+
+    memset(&s, 0, sizeof(s));
+    CHECK(rbuf_init(&s.ring, STRESS_RING_SIZE) == 0);
+    CHECK(pthread_create(&consumer, NULL, stress_consumer, &s) == 0);
+
+    while (sent < STRESS_BYTES) {
+        if (!(span = rbuf_write_span(&s.ring, &len))) {
+            sched_yield();
+            continue;
+        }
+        want = want % 1021 + 13;
+        if (len > want) {
+            len = want;
+        }
+        if (len > STRESS_BYTES - sent) {
+            len = STRESS_BYTES - sent;
+        }
+        for (i = 0; i < len; i++) {
+            span[i] = (char)((sent + i) * 7);
+        }
+        rbuf_write_commit(&s.ring, len);
+        sent += len;
+    }
+    pthread_join(consumer, NULL);
+
+    CHECK(s.got == STRESS_BYTES);
+    CHECK(s.bad == 0);
+    CHECK(rbuf_is_empty(&s.ring));
+    rbuf_free(&s.ring);
+}
+
+int main(void)
+{
+    test_init();
+    test_wrap();
+    test_index_wrap();
+    test_spans();
+    test_spsc();
+
+    printf("test_rbuff: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,185 @@
+/*  test_scan.c - SIMD scan kernels against the scalar ones, run by make test.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "scan.h"
+
+#define TEST_MAX_LEN        256
+#define TEST_MAX_SHIFT      64
+#define TEST_ROUNDS         4
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s [%s]: check failed: %s\n", __FILE__, __LINE__, \
+                    __func__, scan->name, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* the set the decoders scan for, plus bytes with the sign bit set */
+static const struct {
+    const char *set;
+    int n;
+} sets[] = {
+    { "\0", 1 },
+    { "\xC0\xDB", 2 },
+    { "\x7E\x7D\xFF", 3 },
+    { "\n\r\x80\0", 4 },
+};
+
+static uint32_t rnd_state = 12345;
+
+static unsigned int rnd(void)
+{
+    rnd_state = rnd_state * 1103515245 + 12345;
+    return rnd_state >> 16;
+}
+
+/* few distinct values so every length has hits, misses and repeats */
+static void fill(unsigned char *p, size_t len, int sparse)
+{
+    static const unsigned char alphabet[] = { 0x00, '\n', '\r', 'a', 0x7E, 0x7D, 0x80, 0xC0, 0xDB, 0xFF };
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        p[i] = sparse && rnd() % 64 ? 'a' : alphabet[rnd() % sizeof(alphabet)];
+    }
+}
+
+/* bytewise references, no tables */
+static uint32_t ref_crc32c(uint32_t crc, const unsigned char *p, size_t len)
+{
+    int i;
+
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (i = 0; i < 8; i++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+static uint16_t ref_crc16(uint16_t crc, const unsigned char *p, size_t len)
+{
+    int i;
+
+    while (len--) {
+        crc ^= *p++;
+        for (i = 0; i < 8; i++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+static void test_vectors(void)
+{
+    CHECK(scan->crc32c(0, "123456789", 9) == 0xE3069283);
+    CHECK((uint16_t)~scan->crc16(0xFFFF, "123456789", 9) == 0x906E);
+    CHECK(scan->crc32c(0, "", 0) == 0);
+}
+
+/* every length up to TEST_MAX_LEN at every start within a cache line */
+static void test_equivalence(const struct scan_impl *ref)
+{
+    static unsigned char mem[TEST_MAX_LEN + TEST_MAX_SHIFT + 64];
+    unsigned char *p;
+    size_t len, shift, split;
+    int round, s, nset;
+
+    for (round = 0; round < TEST_ROUNDS; round++) {
+        fill(mem, sizeof(mem), round & 1);
+        for (shift = 0; shift < TEST_MAX_SHIFT; shift++) {
+            p = mem + shift;
+            for (len = 0; len <= TEST_MAX_LEN; len++) {
+                const char *b = (const char *)p;
+
+                CHECK(scan->find(b, len, 0) == ref->find(b, len, 0));
+                CHECK(scan->find(b, len, (char)0xDB) == ref->find(b, len, (char)0xDB));
+                CHECK(scan->count(b, len, 'a') == ref->count(b, len, 'a'));
+                CHECK(scan->count(b, len, (char)0x80) == ref->count(b, len, (char)0x80));
+                for (s = 0; s < (int)(sizeof(sets) / sizeof(sets[0])); s++) {
+                    for (nset = 1; nset <= sets[s].n; nset++) {
+                        CHECK(scan->find_set(b, len, sets[s].set, nset) ==
+                              ref->find_set(b, len, sets[s].set, nset));
+                    }
+                }
+                CHECK(scan->crc32c(0, p, len) == ref_crc32c(0, p, len));
+                CHECK(scan->crc16(0xFFFF, p, len) == ref_crc16(0xFFFF, p, len));
+
+                /* continuing from a previous result */
+                split = len ? rnd() % len : 0;
+                CHECK(scan->crc32c(scan->crc32c(0, p, split), p + split, len - split) ==
+                      ref_crc32c(0, p, len));
+                CHECK(scan->crc16(scan->crc16(0xFFFF, p, split), p + split, len - split) ==
+                      ref_crc16(0xFFFF, p, len));
+            }
+        }
+    }
+}
+
+/* the per-lane byte counters fold every 255 rounds */
+static void test_count_long(const struct scan_impl *ref)
+{
+    size_t len = 255 * 32 * 3 + 37;
+    char *buf = malloc(len + 1);
+    size_t i;
+
+    CHECK(buf != NULL);
+    if (!buf) {
+        return;
+    }
+    memset(buf, 'x', len);
+    CHECK(scan->count(buf, len, 'x') == len);
+    CHECK(scan->count(buf + 1, len - 1, 'x') == len - 1);
+    for (i = 0; i < len; i += 7) {
+        buf[i] = 'y';
+    }
+    CHECK(scan->count(buf, len, 'y') == ref->count(buf, len, 'y'));
+    CHECK(scan->find_set(buf + 1, len - 1, "yz", 2) == 6);
+    free(buf);
+}
+
+int main(void)
+{
+    const struct scan_impl *ref = scan_impl_at(0), *impl;
+    int i;
+
+    scan_init();
+    for (i = 0; (impl = scan_impl_at(i)) != NULL; i++) {
+        if (!impl->supported()) {
+            printf("test_scan: %s not supported here, skipped\n", impl->name);
+            continue;
+        }
+        scan = impl;
+        test_vectors();
+        test_equivalence(ref);
+        test_count_long(ref);
+    }
+
+    printf("test_scan: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,204 @@
+/*  test_trigger.c - unit tests for the --on/--on-re matcher, run by make test.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "scan.h"
+#include "trigger.h"
+
+#define TEST_MAX_HITS       32
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* the hits in the order they were reported */
+struct hits {
+    const char *pattern[TEST_MAX_HITS];
+    uint64_t offset[TEST_MAX_HITS];
+    int n;
+    int stop_at;                /* callback returns 1 on this hit, 0 = never */
+};
+
+struct expect {
+    const char *pattern;
+    uint64_t offset;
+};
+
+static int test_cb(struct trigger *t, uint64_t offset, void *arg)
+{
+    struct hits *h = arg;
+
+    if (h->n < TEST_MAX_HITS) {
+        h->pattern[h->n] = t->pattern;
+        h->offset[h->n] = offset;
+    }
+    h->n++;
+    return h->stop_at && h->n == h->stop_at;
+}
+
+/* patterns starting with '/' are regexes */
+static void build(struct trigger_set *ts, const char *const *patterns)
+{
+    memset(ts, 0, sizeof(*ts));
+    for (; *patterns; patterns++) {
+        int regex = **patterns == '/';
+
+        CHECK(trigger_add(ts, *patterns + regex, regex) == 0);
+    }
+    CHECK(trigger_compile(ts) == 0);
+}
+
+static void check_hits(const struct hits *h, const struct expect *e, int n, size_t chunk)
+{
+    int i;
+
+    if (h->n != n) {
+        fprintf(stderr, "chunk %zu: %d hits, expected %d\n", chunk, h->n, n);
+    }
+    CHECK(h->n == n);
+    for (i = 0; i < n && i < h->n; i++) {
+        if (strcmp(h->pattern[i], e[i].pattern) || h->offset[i] != e[i].offset) {
+            fprintf(stderr, "chunk %zu: hit %d is \"%s\" at %llu, expected \"%s\" at %llu\n",
+                    chunk, i, h->pattern[i], (unsigned long long)h->offset[i],
+                    e[i].pattern, (unsigned long long)e[i].offset);
+            failures++;
+        }
+    }
+}
+
+/* the same hits whether the input comes in one span or cut into pieces */
+static void run(const char *const *patterns, const char *input,
+                const struct expect *e, int n)
+{
+    size_t len = strlen(input), chunk, pos, k;
+    struct trigger_set ts;
+    struct hits h;
+
+    for (chunk = 1; chunk <= len; chunk++) {
+        build(&ts, patterns);
+        memset(&h, 0, sizeof(h));
+        for (pos = 0; pos < len; pos += k) {
+            k = len - pos < chunk ? len - pos : chunk;
+            CHECK(trigger_feed(&ts, input + pos, k, test_cb, &h) == 0);
+        }
+        CHECK(ts.pos == len);
+        check_hits(&h, e, n, chunk);
+        trigger_free(&ts);
+    }
+}
+
+/* literals that are prefixes, suffixes and substrings of each other */
+static void test_overlap(void)
+{
+    static const char *const patterns[] = { "he", "she", "his", "hers", NULL };
+    static const struct expect e[] = {
+        { "she", 4 }, { "he", 4 }, { "hers", 6 }, { "his", 11 }, { "she", 14 }, { "he", 14 },
+    };
+
+    run(patterns, "ushers, hisshe", e, sizeof(e) / sizeof(e[0]));
+}
+
+/* repeats and self overlap: "aa" in "aaa" ends at 2 and 3 */
+static void test_repeat(void)
+{
+    static const char *const patterns[] = { "aa", "a", "aa", NULL };
+    static const struct expect e[] = {
+        { "a", 1 }, { "aa", 2 }, { "aa", 2 }, { "a", 2 }, { "aa", 3 }, { "aa", 3 }, { "a", 3 },
+    };
+
+    run(patterns, "aaa", e, sizeof(e) / sizeof(e[0]));
+}
+
+/* a regex hit is at the end of its line, after the literals before it */
+static void test_order(void)
+{
+    static const char *const patterns[] = { "/ERR", "boot", "/^ok$", "\n", NULL };
+    static const struct expect e[] = {
+        { "boot", 4 }, { "\n", 9 }, { "ERR", 9 },
+        { "\n", 13 }, { "^ok$", 13 },
+        { "boot", 17 }, { "\n", 18 },
+        { "\n", 24 }, { "ERR", 24 },
+    };
+
+    run(patterns, "boot ERR\nok\r\nboot\nx ERR\n", e, sizeof(e) / sizeof(e[0]));
+}
+
+/* a stop leaves the state and offset right behind the stopping hit */
+static void test_stop(void)
+{
+    static const char *const patterns[] = { "ab", "/x", NULL };
+    struct trigger_set ts;
+    struct hits h;
+
+    build(&ts, patterns);
+    memset(&h, 0, sizeof(h));
+    h.stop_at = 2;
+    CHECK(trigger_feed(&ts, "ab x\nab", 7, test_cb, &h) == 1);
+    CHECK(h.n == 2 && ts.pos == 5);
+    CHECK(ts.trig[0].hits == 1 && ts.trig[1].hits == 1);
+    h.stop_at = 0;
+    CHECK(trigger_feed(&ts, "ab", 2, test_cb, &h) == 0);
+    CHECK(h.n == 3 && h.offset[2] == 7 && ts.pos == 7);
+    trigger_free(&ts);
+}
+
+/* one long line: cut at the buffer size, still reported once */
+static void test_long_line(void)
+{
+    static const char *const patterns[] = { "/^y+$", "yyyy", NULL };
+    size_t len = TRIGGER_LINE_MAX * 2;
+    char *buf = malloc(len + 1);
+    struct trigger_set ts;
+    struct hits h;
+
+    CHECK(buf != NULL);
+    if (!buf) {
+        return;
+    }
+    memset(buf, 'y', len);
+    buf[len] = '\n';
+    build(&ts, patterns);
+    memset(&h, 0, sizeof(h));
+    CHECK(trigger_feed(&ts, buf, len + 1, test_cb, &h) == 0);
+    CHECK(ts.trig[0].hits == 1 && ts.trig[1].hits == len - 3);
+    CHECK(h.n == (int)len - 3 + 1);
+    trigger_free(&ts);
+    free(buf);
+}
+
+int main(void)
+{
+    scan_init();
+    test_overlap();
+    test_repeat();
+    test_order();
+    test_stop();
+    test_long_line();
+
+    printf("test_trigger: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
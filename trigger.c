@@ -0,0 +1,280 @@
+/*  trigger.c - literal and regex triggers on the RX stream.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "scan.h"
+#include "trigger.h"
+
+int trigger_add(struct trigger_set *ts, const char *pattern, int regex)
+{
+    struct trigger *t;
+
+    if (!*pattern) {
+        return -1;
+    }
+    t = realloc(ts->trig, (ts->n + 1) * sizeof(*t));
+    if (!t) {
+        return -1;
+    }
+    ts->trig = t;
+    t += ts->n;
+    memset(t, 0, sizeof(*t));
+    t->pattern = strdup(pattern);
+    t->regex = regex;
+    t->action = TRIGGER_MARK;
+    t->next = -1;
+    if (regex) {
+        if (regcomp(&t->re, pattern, REG_EXTENDED | REG_NOSUB) != 0) {
+            free(t->pattern);
+            return -1;
+        }
+        ts->nregex++;
+    }
+    ts->n++;
+    return 0;
+}
+
+/* applies to the trigger added last */
+int trigger_set_action(struct trigger_set *ts, int action, const char *arg)
+{
+    struct trigger *t;
+    char *end;
+
+    if (!ts->n) {
+        return -1;
+    }
+    t = &ts->trig[ts->n - 1];
+    t->action = action;
+    free(t->arg);
+    t->arg = NULL;
+    t->arglen = 0;
+    switch (action) {
+    case TRIGGER_EXIT:
+        t->code = (int)strtol(arg, &end, 0);
+        if (*end || t->code < 0 || t->code > 255) {
+            return -1;
+        }
+        break;
+    case TRIGGER_SEND:
+        t->arg = strdup(arg);
+        t->arglen = strlen(arg);
+        break;
+    }
+    return 0;
+}
+
+/* builds the full Aho-Corasick DFA: the failure links are folded into
+ * delta so matching costs one table lookup per byte */
+int trigger_compile(struct trigger_set *ts)
+{
+    int32_t *fail, *queue, s, t, f;
+    int i, c, max = 1, head = 0, tail = 0;
+    const unsigned char *p;
+
+    for (i = 0; i < ts->n; i++) {
+        if (!ts->trig[i].regex) {
+            max += strlen(ts->trig[i].pattern);
+        }
+    }
+    ts->delta = malloc((size_t)max * 256 * sizeof(int32_t));
+    ts->out = malloc(max * sizeof(int32_t));
+    ts->report = malloc(max * sizeof(int32_t));
+    ts->link = malloc(max * sizeof(int32_t));
+    fail = malloc(max * sizeof(int32_t));
+    queue = malloc(max * sizeof(int32_t));
+    if (ts->nregex) {
+        ts->line = malloc(TRIGGER_LINE_MAX);
+    }
+    if (!ts->delta || !ts->out || !ts->report || !ts->link || !fail || !queue ||
+            (ts->nregex && !ts->line)) {
+        free(fail);
+        free(queue);
+        return -1;
+    }
+    memset(ts->delta, 0xFF, (size_t)max * 256 * sizeof(int32_t));
+    memset(ts->out, 0xFF, max * sizeof(int32_t));
+    memset(ts->link, 0xFF, max * sizeof(int32_t));
+    ts->nstates = 1;
+
+    /* the trie, triggers on the same literal are chained */
+    for (i = ts->n - 1; i >= 0; i--) {
+        if (ts->trig[i].regex) {
+            continue;
+        }
+        for (s = 0, p = (const unsigned char *)ts->trig[i].pattern; *p; p++) {
+            if (ts->delta[s * 256 + *p] < 0) {
+                ts->delta[s * 256 + *p] = ts->nstates++;
+            }
+            s = ts->delta[s * 256 + *p];
+        }
+        ts->trig[i].next = ts->out[s];
+        ts->out[s] = i;
+    }
+
+    /* breadth first, a state's failure target is always done before it */
+    fail[0] = 0;
+    for (c = 0; c < 256; c++) {
+        if ((t = ts->delta[c]) < 0) {
+            ts->delta[c] = 0;
+        } else {
+            fail[t] = 0;
+            queue[tail++] = t;
+        }
+    }
+    while (head < tail) {
+        s = queue[head++];
+        for (c = 0; c < 256; c++) {
+            f = ts->delta[fail[s] * 256 + c];
+            if ((t = ts->delta[s * 256 + c]) < 0) {
+                ts->delta[s * 256 + c] = f;
+                continue;
+            }
+            fail[t] = f;
+            ts->link[t] = ts->out[f] >= 0 ? f : ts->link[f];
+            queue[tail++] = t;
+        }
+    }
+    for (s = 0; s < ts->nstates; s++) {
+        ts->report[s] = ts->out[s] >= 0 ? s : ts->link[s];
+    }
+    free(fail);
+    free(queue);
+    return 0;
+}
+
+static int trigger_hit(struct trigger *t, uint64_t offset, trigger_cb cb, void *arg)
+{
+    t->hits++;
+    return cb(t, offset, arg);
+}
+
+/* every literal ending in state s, longest first */
+static int trigger_report(struct trigger_set *ts, int32_t s, uint64_t offset, trigger_cb cb, void *arg)
+{
+    int i;
+
+    for (; s >= 0; s = ts->link[s]) {
+        for (i = ts->out[s]; i >= 0; i = ts->trig[i].next) {
+            if (trigger_hit(&ts->trig[i], offset, cb, arg)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* every literal ending in the n bytes at p, offsets are past the match */
+static int trigger_literals(struct trigger_set *ts, const unsigned char *p, size_t n,
+                            trigger_cb cb, void *arg)
+{
+    const int32_t *delta = ts->delta, *report = ts->report;
+    int32_t s = ts->state;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        s = delta[s * 256 + p[i]];
+        if (report[s] >= 0 && trigger_report(ts, report[s], ts->pos + i + 1, cb, arg)) {
+            ts->state = s;
+            ts->pos += i + 1;
+            return 1;
+        }
+    }
+    ts->state = s;
+    ts->pos += n;
+    return 0;
+}
+
+/* regexes see whole lines, a line longer than the buffer is cut; buf is
+ * a piece of a line, up to and including its newline */
+static int trigger_lines(struct trigger_set *ts, const char *buf, size_t n, trigger_cb cb, void *arg)
+{
+    size_t room = TRIGGER_LINE_MAX - 1 - ts->linelen;
+    int eol = n && buf[n - 1] == '\n';
+    int j;
+
+    if (eol) {
+        n--;
+    }
+    memcpy(ts->line + ts->linelen, buf, n < room ? n : room);
+    ts->linelen += n < room ? n : room;
+    if (!eol) {
+        return 0;
+    }
+    if (ts->linelen && ts->line[ts->linelen - 1] == '\r') {
+        ts->linelen--;
+    }
+    ts->line[ts->linelen] = '\0';
+    ts->linelen = 0;
+    for (j = 0; j < ts->n; j++) {
+        if (ts->trig[j].regex && regexec(&ts->trig[j].re, ts->line, 0, NULL, 0) == 0 &&
+                trigger_hit(&ts->trig[j], ts->pos, cb, arg)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* feeds one span, state carries over to the next call; returns nonzero
+ * when cb asked to stop. Hits come in stream order: the literals of a
+ * line, then the regexes at its newline */
+int trigger_feed(struct trigger_set *ts, const char *buf, size_t len, trigger_cb cb, void *arg)
+{
+    size_t n;
+
+    while (len) {
+        n = ts->nregex ? scan->find(buf, len, '\n') : len;
+        if (n < len) {
+            n++;
+        }
+        if (ts->nstates > 1) {
+            if (trigger_literals(ts, (const unsigned char *)buf, n, cb, arg)) {
+                return 1;
+            }
+        } else {
+            ts->pos += n;
+        }
+        if (ts->nregex && trigger_lines(ts, buf, n, cb, arg)) {
+            return 1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+void trigger_free(struct trigger_set *ts)
+{
+    int i;
+
+    for (i = 0; i < ts->n; i++) {
+        free(ts->trig[i].pattern);
+        free(ts->trig[i].arg);
+        if (ts->trig[i].regex) {
+            regfree(&ts->trig[i].re);
+        }
+    }
+    free(ts->trig);
+    free(ts->delta);
+    free(ts->out);
+    free(ts->report);
+    free(ts->link);
+    free(ts->line);
+    memset(ts, 0, sizeof(*ts));
+}
@@ -0,0 +1,52 @@
+#ifndef _TRIGGER_H
+#define _TRIGGER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <regex.h>
+
+enum {
+    TRIGGER_MARK = 0,       /* timestamped marker on stderr */
+    TRIGGER_SEND,           /* write arg to the port */
+    TRIGGER_EXIT,           /* stop and exit with code */
+};
+
+#define TRIGGER_LINE_MAX    4096
+
+struct trigger {
+    char *pattern;
+    int regex;
+    regex_t re;
+    int action;
+    char *arg;
+    size_t arglen;
+    int code;
+    int next;               /* next trigger with the same literal, -1 */
+    unsigned long hits;
+};
+
+/* literals run through one Aho-Corasick automaton, regexes per line */
+struct trigger_set {
+    struct trigger *trig;
+    int n;
+    int nregex;
+    int32_t *delta;         /* nstates x 256 transitions */
+    int32_t *out;           /* first trigger ending in a state, -1 */
+    int32_t *report;        /* state whose output to report, -1 */
+    int32_t *link;          /* next state on the output chain, -1 */
+    int nstates;
+    int32_t state;
+    uint64_t pos;           /* stream offset of the next byte */
+    char *line;
+    size_t linelen;
+};
+
+/* nonzero stops feeding right after this match */
+typedef int (*trigger_cb)(struct trigger *t, uint64_t offset, void *arg);
+
+int trigger_add(struct trigger_set *ts, const char *pattern, int regex);
+int trigger_set_action(struct trigger_set *ts, int action, const char *arg);
+int trigger_compile(struct trigger_set *ts);
+int trigger_feed(struct trigger_set *ts, const char *buf, size_t len, trigger_cb cb, void *arg);
+void trigger_free(struct trigger_set *ts);
+#endif
@@ -0,0 +1,182 @@
+/*  uring.c - minimal io_uring setup, submission and completion helpers.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+#ifndef SYS_io_uring_setup
+#define SYS_io_uring_setup      425
+#define SYS_io_uring_enter      426
+#define SYS_io_uring_register   427
+#endif
+
+/* ENOSYS or EPERM (io_uring_disabled, seccomp) tell the caller to use
+ * the epoll loop instead */
+int uring_init(struct uring *u, unsigned entries)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    if ((u->fd = syscall(SYS_io_uring_setup, entries, &p)) == -1) {
+        return -1;
+    }
+
+    u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->sq_len = u->cq_len = u->sq_len > u->cq_len ? u->sq_len : u->cq_len;
+    }
+    u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED) {
+        goto fail;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ptr = u->sq_ptr;
+    } else if ((u->cq_ptr = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                 u->fd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+        munmap(u->sq_ptr, u->sq_len);
+        goto fail;
+    }
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        if (u->cq_ptr != u->sq_ptr) {
+            munmap(u->cq_ptr, u->cq_len);
+        }
+        munmap(u->sq_ptr, u->sq_len);
+        goto fail;
+    }
+
+    sq = u->sq_ptr;
+    cq = u->cq_ptr;
+    u->sq_head = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->sq_entries = p.sq_entries;
+    u->cq_head = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+
+fail:
+    close(u->fd);
+    u->fd = -1;
+    return -1;
+}
+
+void uring_exit(struct uring *u)
+{
+    if (u->fd == -1) {
+        return;
+    }
+    munmap(u->sqes, u->sqes_len);
+    if (u->cq_ptr != u->sq_ptr) {
+        munmap(u->cq_ptr, u->cq_len);
+    }
+    munmap(u->sq_ptr, u->sq_len);
+    close(u->fd);
+    u->fd = -1;
+}
+
+/* pins the pages once, READ_FIXED/WRITE_FIXED then skip the per-op
+ * page lookup */
+int uring_register_buffers(struct uring *u, const struct iovec *iov, unsigned n)
+{
+    return syscall(SYS_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, iov, n);
+}
+
+/* NULL when the SQ is full, submit first */
+struct io_uring_sqe *uring_get_sqe(struct uring *u)
+{
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *u->sq_tail + u->sq_queued;
+    struct io_uring_sqe *sqe;
+
+    if (tail - head >= u->sq_entries) {
+        return NULL;
+    }
+    sqe = &u->sqes[tail & *u->sq_mask];
+    u->sq_array[tail & *u->sq_mask] = tail & *u->sq_mask;
+    u->sq_queued++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/* one io_uring_enter: hands over everything queued and waits for wait_nr
+ * completions; returns the number submitted */
+int uring_submit_and_wait(struct uring *u, unsigned wait_nr)
+{
+    unsigned n = u->sq_queued;
+    int res;
+
+    __atomic_store_n(u->sq_tail, *u->sq_tail + n, __ATOMIC_RELEASE);
+    u->sq_queued = 0;
+    do {
+        res = syscall(SYS_io_uring_enter, u->fd, n, wait_nr,
+                      wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        u->enters++;
+    } while (res == -1 && errno == EINTR);
+    return res;
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *u)
+{
+    unsigned head = *u->cq_head;
+
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &u->cqes[head & *u->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *u)
+{
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+void uring_prep_rw(struct io_uring_sqe *sqe, int op, int fd, const void *buf,
+                   unsigned len, uint64_t off, uint64_t user_data)
+{
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_poll(struct io_uring_sqe *sqe, int fd, unsigned events, uint64_t user_data)
+{
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = user_data;
+}
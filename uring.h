@@ -0,0 +1,42 @@
+#ifndef _URING_H
+#define _URING_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* just enough io_uring for the capture loop, straight on the syscalls */
+struct uring {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_entries;
+    unsigned sq_queued;         /* tail not yet published to the kernel */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+    unsigned long long enters;
+};
+
+int uring_init(struct uring *u, unsigned entries);
+void uring_exit(struct uring *u);
+int uring_register_buffers(struct uring *u, const struct iovec *iov, unsigned n);
+struct io_uring_sqe *uring_get_sqe(struct uring *u);
+int uring_submit_and_wait(struct uring *u, unsigned wait_nr);
+struct io_uring_cqe *uring_peek_cqe(struct uring *u);
+void uring_cqe_seen(struct uring *u);
+
+void uring_prep_rw(struct io_uring_sqe *sqe, int op, int fd, const void *buf,
+                   unsigned len, uint64_t off, uint64_t user_data);
+void uring_prep_poll(struct io_uring_sqe *sqe, int fd, unsigned events, uint64_t user_data);
+
+#endif
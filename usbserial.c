@@ -23,42 +23,199 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <ctype.h>
 
 #ifndef _WIN32
+#include <time.h>
+#include <poll.h>
+#include <getopt.h>
+#include <sys/uio.h>
+#include <sys/inotify.h>
+#include <libgen.h>
 #include "usbserial_linux.h"
+#include "evloop.h"
+#include "multiport.h"
+#include "capture.h"
+#include "replay.h"
+#include "script.h"
+#include "trigger.h"
+#include "fanout.h"
+#include "shmexport.h"
 #else
 #include "usbserial_win32.h"
 #endif
 
 #include "usbserial.h"
 #include "rbuff.h"
+#include "stats.h"
+#include "frame.h"
+#include "scan.h"
+#include "hexdump.h"
 
-#define DEFAULT_TIMEO   5
+#define DEFAULT_TIMEO   5000
 #define MAX_BUF_LENGTH  256
+#define TX_RBUF_SIZE    65536
+#define RECONNECT_MIN_MS    10
+#define RECONNECT_MAX_MS    1000
 
 struct serial_buf {
    int len;
    char buf[MAX_BUF_LENGTH];
 };
 
+#ifndef _WIN32
+/* modes that take over the whole run instead of the terminal */
+struct serial_modes {
+    char *devices;
+    char *outdir;
+    char *outfile;
+    int cflags;
+    unsigned long long rotate_size;
+    long rotate_secs;
+    char *dump;
+    double from;
+    double to;
+    char *replay;
+    double speed;
+    int port;
+    struct script_opt script;
+    char *serve;
+    char *shm;
+    int io;
+    int zmethod;
+    int zlevel;
+    int slow;
+};
+
+enum {
+    OPT_DUMP = 256,
+    OPT_FROM,
+    OPT_TO,
+    OPT_REPLAY,
+    OPT_SPEED,
+    OPT_PORT,
+    OPT_INFLIGHT,
+    OPT_EXPECT,
+    OPT_TERM,
+    OPT_STATS,
+    OPT_STATS_FILE,
+    OPT_ON,
+    OPT_ON_RE,
+    OPT_SEND,
+    OPT_EXIT,
+    OPT_MARK,
+    OPT_SERVE,
+    OPT_SLOW,
+    OPT_RECONNECT,
+    OPT_LOW_LATENCY,
+    OPT_RT,
+    OPT_CPU,
+    OPT_KEEP,
+    OPT_SHM,
+    OPT_IO,
+    OPT_COMPRESS,
+};
+
+static const struct option long_opts[] = {
+    { "dump",   required_argument, NULL, OPT_DUMP },
+    { "from",   required_argument, NULL, OPT_FROM },
+    { "to",     required_argument, NULL, OPT_TO },
+    { "replay", required_argument, NULL, OPT_REPLAY },
+    { "speed",  required_argument, NULL, OPT_SPEED },
+    { "port",   required_argument, NULL, OPT_PORT },
+    { "inflight", required_argument, NULL, OPT_INFLIGHT },
+    { "expect", required_argument, NULL, OPT_EXPECT },
+    { "term",   required_argument, NULL, OPT_TERM },
+    { "stats",  optional_argument, NULL, OPT_STATS },
+    { "stats-file", required_argument, NULL, OPT_STATS_FILE },
+    { "on",     required_argument, NULL, OPT_ON },
+    { "on-re",  required_argument, NULL, OPT_ON_RE },
+    { "send",   required_argument, NULL, OPT_SEND },
+    { "exit",   required_argument, NULL, OPT_EXIT },
+    { "mark",   no_argument,       NULL, OPT_MARK },
+    { "serve",  required_argument, NULL, OPT_SERVE },
+    { "slow",   required_argument, NULL, OPT_SLOW },
+    { "reconnect", no_argument,    NULL, OPT_RECONNECT },
+    { "low-latency", optional_argument, NULL, OPT_LOW_LATENCY },
+    { "rt",     optional_argument, NULL, OPT_RT },
+    { "cpu",    required_argument, NULL, OPT_CPU },
+    { "keep-settings", no_argument, NULL, OPT_KEEP },
+    { "shm",    required_argument, NULL, OPT_SHM },
+    { "io",     required_argument, NULL, OPT_IO },
+    { "compress", optional_argument, NULL, OPT_COMPRESS },
+    { NULL, 0, NULL, 0 }
+};
+#define GETOPT(argc, argv, opts) getopt_long(argc, argv, opts, long_opts, NULL)
+#else
+#define GETOPT(argc, argv, opts) getopt(argc, argv, opts)
+#endif
+
+static tcflag_t parse_baudrate(int requested);
+#ifdef _WIN32
 static int serial_get_input(char *buf, int len);
 static void sigint_handler(int sig);
-static tcflag_t parse_baudrate(int requested);
-static int serial_wait_fd(int fd, short stimeout);
+static int serial_wait_fd(int fd, int msec);
 static void serial_output(void *p);
+static void serial_reader(struct serial_opt *serial);
+#else
+static void serial_event_loop(struct serial_opt *serial, int interactive);
+static int serial_run_mode(struct serial_opt *serial, struct serial_modes *modes);
+static void serial_stats_report(int dump);
+static void serial_trigger_opt(int opt, const char *arg);
+#endif
+static void serial_finish(struct serial_opt *serial);
+static void serial_sink(void *p);
+static int serial_on_frame(char *frame, size_t len, void *arg);
+static size_t serial_count_lines(const char *buf, size_t len, int *lines, int max);
 static int serial_term_init(struct serial_opt *serial, const char* outbuf);
-static int serial_write_buf(struct serial_opt *serial, const char * buf);
-static int serial_port_read_rbuff(struct serial_opt *serial);
 
 /*globals*/
 static rbuf_t rbuff;
-static int signal_exit = 0;
+static rbuf_t txbuff;
 static usbserial_ops *pusbserial_ops;
+#ifdef _WIN32
+static int signal_exit = 0;
+#endif
+
+/* reader -> sink pipeline state, guarded by rx_cond */
+static serial_cond_t rx_cond;
+static int reader_done = 0;
+static int sink_done = 0;
+static int sink_msgs = 0;
+static int sink_err = 0;
+static struct frame_dec framer;   /* -F, type FRAME_NONE for text lines */
+static struct hexdump hexer;      /* -x/-X, out is NULL when off */
+#ifndef _WIN32
+static int rx_stalled = 0;
+static int loop_efd = -1;
+
+/* --stats line every stats_ms, --stats-file rewritten as often */
+static long stats_ms = 0;
+static int stats_line = 0;
+static const char *stats_path = NULL;
+static int stats_usr1fd = -1;
+static int stats_timerfd = -1;
+
+/* --on/--on-re, matched on the event loop thread as bytes arrive */
+static struct trigger_set triggers;
+static int trigger_code = -1;
+
+/* --reconnect: a lost port is reopened, the pipeline keeps running */
+static int reconnect = 0;
+
+/* --low-latency spin window after port activity, --rt/--cpu for the loop */
+static uint64_t busy_ns = 0;
+static int rt_prio = 0;
+static int rt_cpu = -1;
+#endif
 
 int main(int argc, char **argv)
 {
     int opt;
     char *pbuf = NULL;
+#ifndef _WIN32
+    struct serial_modes modes;
+#endif
     struct serial_opt serial =
 #ifdef _WIN32
     { DEFAULT_USB_DEV, -1, B9600, DEFAULT_TIMEO, 0, 1};
@@ -70,20 +227,47 @@ int main(int argc, char **argv)
       .max_msgs = 0,
       .endl = 1,
     };
+    memset(&modes, 0, sizeof(modes));
+    modes.to = -1;
+    modes.speed = 1;
+    modes.script.inflight = 1;
 #endif
 
-    while ((opt = getopt(argc, argv, "dwb:t:c:n")) != -1) {
+    serial.rate = 9600;
+    serial.data_bits = 8;
+    serial.parity = 'N';
+    serial.stop_bits = 1;
+
+    scan_init();
+    if (rbuf_init(&txbuff, TX_RBUF_SIZE) == -1) {
+        fprintf(stderr, "Unable to allocate ring buffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while ((opt = GETOPT(argc, argv, "dwb:m:t:c:nWF:xXM:O:o:r:R:DBf:")) != -1) {
         switch (opt) {
         case 'd':
             serial.name = argv[optind];
             break;
         case 'b':
-            serial.baud = parse_baudrate(atoi(optarg));
+            serial.rate = atoi(optarg);
+            serial.baud = parse_baudrate(serial.rate);
+#ifdef _WIN32
             if (!serial.baud) {
+#else
+            /* any other rate goes through termios2/BOTHER */
+            if (serial.rate <= 0) {
+#endif
                 fprintf(stderr,"Unknown baud rate!");
                 exit(EXIT_FAILURE);
             }
             break;
+        case 'm':
+            if (serial_parse_mode(&serial, optarg) == -1) {
+                fprintf(stderr, "Bad line mode %s (like 8N1, 7E1, 8N2,rtscts, 8N1,xonxoff)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'w':
             if (strlen(argv[optind]) < MAX_BUF_LENGTH) {
                 pbuf =argv[optind];
@@ -93,7 +277,7 @@ int main(int argc, char **argv)
             }
             break;
         case 't':
-            serial.timeout = atoi(optarg);
+            serial.timeout = (atof(optarg) < 0) ? -1 : (int)(atof(optarg) * 1000);
             break;
         case 'c':
             serial.max_msgs = atoi(optarg);
@@ -101,37 +285,316 @@ int main(int argc, char **argv)
         case 'n':
             serial.endl = 0;
             break;
+        case 'W':
+            serial.drain = 1;
+            break;
+        case 'F':
+            if (frame_init(&framer, frame_parse_type(optarg), FRAME_MAX_DEFAULT) == -1 ||
+                framer.type == -1) {
+                fprintf(stderr, "Unknown framing %s (cobs, slip, hdlc, len)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'x':
+        case 'X':
+            hexdump_free(&hexer);
+            if (hexdump_init(&hexer, opt == 'X') == -1) {
+                fprintf(stderr, "Unable to allocate hexdump buffer\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+#ifndef _WIN32
+        case 'M':
+            modes.devices = optarg;
+            break;
+        case 'O':
+            modes.outdir = optarg;
+            break;
+        case 'o':
+            modes.outfile = optarg;
+            break;
+        case 'r':
+            modes.rotate_size = capture_parse_size(optarg);
+            break;
+        case 'R':
+            modes.rotate_secs = atol(optarg);
+            break;
+        case 'D':
+            modes.cflags |= CAPTURE_DIRECT | CAPTURE_SYNC;
+            break;
+        case 'B':
+            modes.cflags |= CAPTURE_RECORDS;
+            break;
+        case OPT_DUMP:
+            modes.dump = optarg;
+            break;
+        case OPT_FROM:
+            modes.from = atof(optarg);
+            break;
+        case OPT_TO:
+            modes.to = atof(optarg);
+            break;
+        case OPT_REPLAY:
+            modes.replay = optarg;
+            break;
+        case OPT_SPEED:
+            modes.speed = strcmp(optarg, "max") ? atof(optarg) : 0;
+            break;
+        case OPT_PORT:
+            modes.port = atoi(optarg);
+            break;
+        case 'f':
+            modes.script.path = optarg;
+            break;
+        case OPT_INFLIGHT:
+            modes.script.inflight = atoi(optarg);
+            break;
+        case OPT_EXPECT:
+            modes.script.expect = optarg;
+            break;
+        case OPT_TERM:
+            modes.script.term = optarg;
+            break;
+        case OPT_STATS:
+            stats_line = 1;
+            stats_ms = optarg ? (long)(atof(optarg) * 1000) : 1000;
+            break;
+        case OPT_STATS_FILE:
+            stats_path = optarg;
+            break;
+        case OPT_ON:
+        case OPT_ON_RE:
+        case OPT_SEND:
+        case OPT_EXIT:
+        case OPT_MARK:
+            serial_trigger_opt(opt, optarg);
+            break;
+        case OPT_SERVE:
+            modes.serve = optarg;
+            break;
+        case OPT_SHM:
+            modes.shm = optarg;
+            break;
+        case OPT_IO:
+            if ((modes.io = multi_parse_io(optarg)) == -1) {
+                fprintf(stderr, "Unknown --io %s (epoll, uring)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_COMPRESS:
+            if (capz_parse(optarg, &modes.zmethod, &modes.zlevel) == -1) {
+                fprintf(stderr, "Unknown --compress %s (lz4%s)\n", optarg,
+#ifdef HAVE_ZSTD
+                        ", zstd"
+#else
+                        ", zstd needs a HAVE_ZSTD build"
+#endif
+                        );
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_RECONNECT:
+            reconnect = 1;
+            break;
+        case OPT_LOW_LATENCY:
+            serial.low_latency = 1;
+            busy_ns = (uint64_t)((optarg ? atof(optarg) : 50) * 1000);
+            break;
+        case OPT_RT:
+            rt_prio = optarg ? atoi(optarg) : 50;
+            break;
+        case OPT_CPU:
+            rt_cpu = atoi(optarg);
+            break;
+        case OPT_KEEP:
+            serial.keep = 1;
+            break;
+        case OPT_SLOW:
+            if ((modes.slow = fanout_parse_slow(optarg)) == -1) {
+                fprintf(stderr, "Unknown --slow %s (drop, skip)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+#endif
         default: /* '?' */
             fprintf(stderr, "USB2Serial terminal %s, %s\n\n", VERSION, __DATE__);
-            fprintf(stderr, "Usage: %s [-d name] device [-b baud] rate [-t sec] timeout [-w string] write command [-c num] count lines [-n] don't add <CR>\n\n", argv[0]);
+            fprintf(stderr, "Usage: %s [-d name] device [-b baud] rate [-m 8N1[,rtscts|,xonxoff]] line mode [-t sec] timeout [-w string] write command [-c num] count lines [-n] don't add <CR> [-W] wait for TX drain [-F cobs|slip|hdlc|len] decode frames, -c counts them [-x] hex dump [-X] with chunk times\n"
+                            "       %s -M dev,glob... capture many ports [-O dir] one file per port [--io epoll|uring] event loop\n"
+                            "       %s [-d name] device -o file capture [-r size] rotate [-R sec] rotate [-D] O_DIRECT+fdatasync [-B] timestamped\n"
+                            "       %s ... -o file [--compress[=lz4[,accel]|zstd[,level]]] independent frames on a thread, lz4 -d / zstd -d read them\n"
+                            "       %s --dump file [--from sec] [--to sec] export a -B capture as text\n"
+                            "       %s [-d name] device --replay file [--speed x|max] [--port n] send a capture at its pacing,\n"
+                            "            --port n picks the n-th port of a -M -B file\n"
+                            "       %s [-d name] device -f script [--inflight n] [--expect regex|--term str] [-t sec] per command\n"
+                            "       %s [-d name] device --serve unix:path|tcp:[host:]port,... [--slow drop|skip] share the port\n"
+                            "       %s [-d name] device --shm name[,bytes] publish RX in /dev/shm/name for shmring.h readers\n"
+                            "       any mode: [--stats[=sec]] print RX/TX stats [--stats-file file.json|file.prom], SIGUSR1 dumps them\n"
+                            "       any mode: [--keep-settings] use the port as configured, ignore -b and -m\n"
+                            "       any mode: -d sim://rate=3M,pattern=lines|counter|random|none,len=80,frame=cobs,bytes=N,echo=1,reply=OK,delay=500us simulated device\n"
+                            "       terminal: [--on str|--on-re regex] then [--send str|--exit code|--mark] act on RX matches\n"
+                            "       terminal: [--reconnect] reopen the device when it goes away\n"
+                            "       terminal: [--low-latency[=busy_us]] wake per byte, spin before sleeping [--rt[=prio]] SCHED_FIFO [--cpu n] pin the port thread\n\n",
+                            argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
             exit(EXIT_FAILURE);
         }
     }
 
+#ifndef _WIN32
+    if (stats_path && !stats_ms) {
+        stats_ms = 1000;
+    }
+    /* before any thread starts, so none of them takes SIGUSR1 */
+    stats_usr1fd = evloop_signalfd(SIGUSR1);
+    if (stats_ms > 0) {
+        stats_timerfd = evloop_timerfd();
+    }
+    if (triggers.n && trigger_compile(&triggers) == -1) {
+        fprintf(stderr, "Unable to build triggers\n");
+        exit(EXIT_FAILURE);
+    }
+    if (modes.devices || modes.outfile || modes.dump || modes.replay || modes.script.path ||
+        modes.serve || modes.shm) {
+        int res;
+
+        stats_init(0, -1);
+        res = serial_run_mode(&serial, &modes);
+        if (stats_line || stats_path) {
+            serial_stats_report(stats_line);
+        }
+        return res == -1 ? EXIT_FAILURE : 0;
+    }
+#endif
     serial_term_init(&serial, pbuf);
     return 0;
 }
 
+#ifndef _WIN32
+/* --on/--on-re add a trigger, the action options set its action */
+static void serial_trigger_opt(int opt, const char *arg)
+{
+    int res;
+
+    switch (opt) {
+    case OPT_ON:
+    case OPT_ON_RE:
+        res = trigger_add(&triggers, arg, opt == OPT_ON_RE);
+        break;
+    case OPT_SEND:
+        res = trigger_set_action(&triggers, TRIGGER_SEND, arg);
+        break;
+    case OPT_EXIT:
+        res = trigger_set_action(&triggers, TRIGGER_EXIT, arg);
+        break;
+    default:
+        res = trigger_set_action(&triggers, TRIGGER_MARK, NULL);
+        break;
+    }
+    if (res == -1) {
+        fprintf(stderr, "Bad trigger option %s%s\n", arg ? arg : "--mark",
+                triggers.n ? "" : " (needs --on or --on-re first)");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static int serial_run_mode(struct serial_opt *serial, struct serial_modes *modes)
+{
+    struct capture c;
+    int res;
+
+    if (modes->dump) {
+        res = capfmt_dump(modes->dump, modes->from, modes->to, _fileno(stdout));
+        if (res == -1) {
+            fprintf(stderr, "Unable to dump %s : %s\n", modes->dump, strerror(errno));
+        }
+        return res;
+    }
+
+    pusbserial_ops = serial_initialize(serial);
+
+    if (modes->replay || modes->script.path || modes->serve || modes->shm) {
+        if (serial_port_open(serial) == -1) {
+            fprintf(stderr, "Unable to open %s : %s\n", serial->name, strerror(errno));
+            return -1;
+        }
+        if (modes->serve) {
+            res = serial_serve(serial, modes->serve, modes->slow);
+        } else if (modes->shm) {
+            res = serial_shm_export(serial, modes->shm);
+        } else if (modes->replay) {
+            res = serial_replay(serial, modes->replay, modes->speed, modes->port);
+        } else {
+            res = serial_script(serial, &modes->script);
+        }
+        serial_port_close(serial);
+        return res;
+    }
+
+    if (modes->outfile) {
+        if (modes->devices) {
+            /* one file for many ports needs the port ids of the records */
+            modes->cflags |= CAPTURE_RECORDS;
+        }
+        if (capture_open(&c, modes->outfile, modes->cflags,
+                         modes->rotate_size, modes->rotate_secs) == -1) {
+            fprintf(stderr, "Unable to open %s : %s\n", modes->outfile, strerror(errno));
+            return -1;
+        }
+        if (modes->zmethod && capture_compress(&c, modes->zmethod, modes->zlevel) == -1) {
+            fprintf(stderr, "Unable to compress %s : %s\n", modes->outfile, strerror(errno));
+            capture_close(&c);
+            return -1;
+        }
+    }
+
+    if (modes->devices) {
+        res = serial_multi_capture(serial, modes->devices, modes->outdir,
+                                   modes->outfile ? &c : NULL, modes->io);
+    } else if (serial_port_open(serial) == -1) {
+        fprintf(stderr, "Unable to open %s : %s\n", serial->name, strerror(errno));
+        res = -1;
+    } else {
+        res = serial_capture(serial, &c);
+        serial_port_close(serial);
+    }
+
+    if (modes->outfile && capture_close(&c) == -1) {
+        res = -1;
+    }
+    return res;
+}
+#endif
+
 static int serial_term_init(struct serial_opt *serial, const char* outbuf)
 {
+#ifdef _WIN32
     struct serial_buf sb = { 0, {0} };
+#endif
     pusbserial_ops = serial_initialize(serial);
 
-    rbuf_init(&rbuff);
+    if (rbuf_init(&rbuff, RBUF_DEFAULT_SIZE) == -1) {
+        fprintf(stderr, "Unable to allocate ring buffer\n");
+        exit(EXIT_FAILURE);
+    }
+    COND_INIT(&rx_cond);
 
     if (pusbserial_ops->serial_port_open(serial) == -1) {
         printf("Unable to open %s : %s\n", serial->name , strerror(errno));
         exit(EXIT_FAILURE);
     }
+    stats_init(rbuff.size, serial->handler);
 
     fprintf(stderr, "**************************************************\n");
     fprintf(stderr, "* Serial open: %20s              *\n", serial->name);
     fprintf(stderr, "**************************************************\n");
 
     if (outbuf) {
-        if (serial_write_buf(serial, outbuf)) {
-            serial->timeout = (serial->timeout == -1) ? 2 : serial->timeout;
+        if (serial_write_buf(serial, outbuf, strlen(outbuf)) != -1) {
+            serial->timeout = (serial->timeout == -1) ? 2000 : serial->timeout;
+#ifndef _WIN32
+            serial_event_loop(serial, 0);
+#else
             serial_output((void*) serial);
+#endif
         } else {
             printf("Write to %s failed\n", serial->name);
             pusbserial_ops->serial_port_close(serial);
@@ -141,61 +604,826 @@ static int serial_term_init(struct serial_opt *serial, const char* outbuf)
 
     if (!serial->max_msgs) {
         fprintf(stderr, "Type quit, bye or ^C to exit.\n");
+#ifdef _WIN32
         signal (SIGINT, (void*)sigint_handler);
+#endif
     }
 
+#ifndef _WIN32
+    serial_event_loop(serial, 1);
+#else
     SPAWN_THREAD(serial_output, (void*) serial);
     
     while(1) {
         memset(&sb.buf, 0, sizeof(sb.buf));
-        serial_get_input(sb.buf, sizeof(sb.buf));
+        sb.len = serial_get_input(sb.buf, sizeof(sb.buf));
     
         if (!strncmp("bye", sb.buf, 3) || !strncmp(sb.buf, "quit", 4)) {
             break;
         }
         
-    serial_write_buf(serial, sb.buf);        
+        if (sb.len > 0) {
+            serial_write_buf(serial, sb.buf, sb.len);
+        }
     }
+#endif
     fprintf(stderr, "Bye!\n");
     pusbserial_ops->serial_port_close(serial);
     return 0;
 }
 
-static int serial_write_buf(struct serial_opt *serial, const char * buf)
+/* queues buf (and the line ending) as one unit and writes what the port
+ * takes now; the event loop sends the rest when the fd is writable.
+ * Returns the bytes still queued or -1 on a port error. */
+int serial_write_buf(struct serial_opt *serial, const char * buf, size_t len)
 {
-    int res = pusbserial_ops->serial_port_write(serial->handler, buf);
+    size_t need = len + (serial->endl ? 2 : 0);
+
+    if (need > txbuff.size) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    while (rbuf_space(&txbuff) < need) {
+        if (serial_tx_flush(serial) == -1) {
+            return -1;
+        }
+#ifndef _WIN32
+        if (serial->handler == -1) {
+            errno = ENODEV;
+            return -1;
+        }
+        if (rbuf_space(&txbuff) < need) {
+            struct pollfd pfd = { serial->handler, POLLOUT, 0 };
 
-    fflush(stdout);
+            poll(&pfd, 1, -1);
+        }
+#endif
+    }
 
+    rbuf_write(&txbuff, buf, len);
     if (serial->endl) {
-        res = pusbserial_ops->serial_port_write(serial->handler, "\r\n");
+        rbuf_write(&txbuff, "\r\n", 2);
     }
-    return res;
+    stats_tx_queued();
+    return serial_tx_flush(serial);
+}
+
+/* one write per contiguous span of the TX queue, stops on EAGAIN;
+ * returns the bytes left in the queue or -1 on a port error */
+int serial_tx_flush(struct serial_opt *serial)
+{
+    size_t len;
+    char *span;
+    int res;
+
+    /* port gone, the queue waits for the reconnect */
+    if (serial->handler == -1) {
+        return rbuf_len(&txbuff);
+    }
+    while ((span = rbuf_read_span(&txbuff, &len)) != NULL) {
+        res = pusbserial_ops->serial_port_write(serial->handler, span, len);
+        if (res < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                break;
+            }
+            return -1;
+        }
+        rbuf_read_commit(&txbuff, res);
+        stats_tx_write(res);
+        if ((size_t)res < len) {
+            break;
+        }
+    }
+
+    len = rbuf_len(&txbuff);
+    if (!len) {
+        if (serial->drain) {
+            pusbserial_ops->serial_port_drain(serial);
+        }
+        stats_tx_done();
+    }
+    return len;
+}
+
+size_t serial_tx_pending(void)
+{
+    return rbuf_len(&txbuff);
+}
+
+size_t serial_tx_space(void)
+{
+    return rbuf_space(&txbuff);
+}
+
+
+/* stops the producer side, lets the sink drain the ring and exits */
+static void serial_finish(struct serial_opt *serial)
+{
+    COND_NOTIFY(&rx_cond, reader_done = 1);
+    COND_WAIT(&rx_cond, sink_done);
+
+    if (framer.type != FRAME_NONE) {
+        fprintf(stderr, "\nrecv: %d frames, %lu bad!\n", sink_msgs, framer.errors);
+    } else {
+        fprintf(stderr, "\nrecv: %d lines!\n", sink_msgs);
+    }
+    fprintf(stderr, "ring high-water: %lu/%lu bytes, %lu backpressure stalls\n",
+            (unsigned long)stats_rx_high_water(), (unsigned long)rbuff.size, stats_rx_stalls());
+#ifndef _WIN32
+    if (stats_line || stats_path) {
+        serial_stats_report(stats_line);
+    }
+#endif
+    pusbserial_ops->serial_port_close(serial);
+#ifndef _WIN32
+    if (trigger_code >= 0) {
+        exit(trigger_code);
+    }
+#endif
+    exit(EXIT_SUCCESS);
+}
+
+#ifndef _WIN32
+struct serial_loop {
+    struct evloop *ev;
+    struct serial_opt *serial;
+    int timerfd;
+    int quit;
+    struct timespec last_rx;
+    int inofd;              /* --reconnect: device directory watch */
+    int retryfd;            /* --reconnect: backoff timer */
+    long backoff_ms;
+    uint64_t lost_ns;
+    uint64_t busy_until;    /* --low-latency: poll without sleeping until */
+};
+
+/* full dump (SIGUSR1, end of run) or the --stats line, then the file */
+static void serial_stats_report(int dump)
+{
+    if (dump) {
+        stats_dump(stderr);
+    } else if (stats_line) {
+        stats_print_line(stderr);
+    }
+    if (stats_path && stats_write_file(stats_path) == -1) {
+        fprintf(stderr, "Unable to write %s : %s\n", stats_path, strerror(errno));
+    }
+}
+
+static long serial_elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000L + (now.tv_nsec - since->tv_nsec) / 1000000L;
+}
+
+/* read unless RX is stalled on a full ring, write while TX is queued */
+static void serial_on_port(int fd, int events, void *arg);
+
+static void serial_update_events(struct serial_loop *l)
+{
+    if (l->serial->handler == -1) {
+        return;
+    }
+    evloop_mod(l->ev, l->serial->handler,
+               (rx_stalled ? 0 : EV_READ) | (rbuf_is_empty(&txbuff) ? 0 : EV_WRITE));
+}
+
+/* runs on the bytes just read, so a --send response goes out from this
+ * thread right away without a hop through the sink */
+static int serial_on_trigger(struct trigger *t, uint64_t offset, void *arg)
+{
+    struct serial_loop *l = arg;
+    struct timespec now;
+
+    switch (t->action) {
+    case TRIGGER_SEND:
+        if (serial_write_buf(l->serial, t->arg, t->arglen) == -1) {
+            perror("write()");
+        }
+        return 0;
+    case TRIGGER_EXIT:
+        fprintf(stderr, "\ntrigger \"%s\" at byte %llu, exit %d\n",
+                t->pattern, (unsigned long long)offset, t->code);
+        trigger_code = t->code;
+        evloop_stop(l->ev);
+        return 1;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    fprintf(stderr, "\n[mark %ld.%06ld] \"%s\" at byte %llu\n", (long)now.tv_sec,
+            now.tv_nsec / 1000, t->pattern, (unsigned long long)offset);
+    return 0;
+}
+
+/* feeds the bytes committed from pos on, up to two spans */
+static void serial_run_triggers(struct serial_loop *l, size_t pos)
+{
+    size_t len;
+    char *span;
+
+    while ((span = rbuf_peek(&rbuff, pos, &len)) != NULL) {
+        if (trigger_feed(&triggers, span, len, serial_on_trigger, l)) {
+            break;
+        }
+        pos += len;
+    }
+}
+
+/* the device went away (EIO, HUP): close it and wait for it to come back,
+ * the ring, the sink and the counters stay as they are */
+static void serial_port_lost(struct serial_loop *l)
+{
+    struct serial_opt *serial = l->serial;
+
+    fprintf(stderr, "\n%s: port lost, waiting for it to come back\n", serial->name);
+    evloop_del(l->ev, serial->handler);
+    stats_port_lost();
+    pusbserial_ops->serial_port_close(serial);
+    serial->handler = -1;
+    l->lost_ns = stats_now();
+    l->backoff_ms = RECONNECT_MIN_MS;
+    evloop_timer_set(l->retryfd, l->backoff_ms);
+}
+
+static int serial_port_found(struct serial_loop *l)
+{
+    struct serial_opt *serial = l->serial;
+    uint64_t down = stats_now() - l->lost_ns;
+
+    if (pusbserial_ops->serial_port_reopen(serial) == -1) {
+        return -1;
+    }
+    evloop_add(l->ev, serial->handler, EV_READ, serial_on_port, l);
+    serial_update_events(l);
+    evloop_timer_set(l->retryfd, 0);
+    stats_port_found(serial->handler, down);
+    clock_gettime(CLOCK_MONOTONIC, &l->last_rx);
+    fprintf(stderr, "%s: reconnected after %.1f ms\n", serial->name, down / 1e6);
+    return 0;
+}
+
+/* the node (or a by-id link to it) appeared or changed permissions */
+static void serial_on_devdir(int fd, int events, void *arg)
+{
+    struct serial_loop *l = arg;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev;
+    char *name = strdup(l->serial->name);
+    const char *base = name ? basename(name) : "";
+    int hit = 0;
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        for (ev = (const struct inotify_event *)buf; (const char *)ev < buf + n;
+             ev = (const struct inotify_event *)((const char *)ev + sizeof(*ev) + ev->len)) {
+            hit |= ev->len && !strcmp(ev->name, base);
+        }
+    }
+    free(name);
+    if (hit && l->serial->handler == -1) {
+        serial_port_found(l);
+    }
+}
+
+/* backoff retry, covers directories inotify can't see into */
+static void serial_on_retry(int fd, int events, void *arg)
+{
+    struct serial_loop *l = arg;
+
+    evloop_timer_ack(fd);
+    if (l->serial->handler != -1 || serial_port_found(l) == 0) {
+        return;
+    }
+    l->backoff_ms = l->backoff_ms * 2 < RECONNECT_MAX_MS ? l->backoff_ms * 2 : RECONNECT_MAX_MS;
+    evloop_timer_set(fd, l->backoff_ms);
+}
+
+/* producer: moves bytes from the port into the ring, stops watching the
+ * port while the ring is full so the data waits in the tty */
+/* read error or hangup: wait for the node under --reconnect, else stop */
+static void serial_port_gone(struct serial_loop *l)
+{
+    if (reconnect) {
+        serial_port_lost(l);
+    } else {
+        evloop_stop(l->ev);
+    }
+}
+
+static void serial_on_port(int fd, int events, void *arg)
+{
+    struct serial_loop *l = arg;
+    size_t head = rbuf_head(&rbuff);
+    int res;
+
+    if ((events & EV_WRITE) && serial_tx_flush(l->serial) == -1) {
+        if (reconnect) {
+            serial_port_lost(l);
+            return;
+        }
+        perror("write()");
+        evloop_stop(l->ev);
+        return;
+    }
+    if (!(events & (EV_READ | EV_HUP | EV_ERR))) {
+        serial_update_events(l);
+        return;
+    }
+
+    if (rbuf_is_full(&rbuff)) {
+        COND_NOTIFY(&rx_cond, rx_stalled = 1);
+        if (rbuf_is_full(&rbuff)) {
+            /* epoll reports a hangup even with no events armed, it
+             * would wake this up again right away */
+            if (events & (EV_HUP | EV_ERR)) {
+                serial_port_gone(l);
+                return;
+            }
+            stats_rx_stall();
+            serial_update_events(l);
+            return;
+        }
+        COND_NOTIFY(&rx_cond, rx_stalled = 0);
+    }
+
+    res = serial_port_read_rbuff(l->serial, &rbuff);
+
+    if (res > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &l->last_rx);
+        if (busy_ns) {
+            l->busy_until = stats_now() + busy_ns;
+        }
+        stats_rx_queued(rbuf_len(&rbuff));
+        COND_NOTIFY(&rx_cond, (void)0);
+        if (triggers.n) {
+            serial_run_triggers(l, head);
+        }
+    } else if (res == -1 || (events & (EV_HUP | EV_ERR))) {
+        serial_port_gone(l);
+        return;
+    }
+    serial_update_events(l);
+}
+
+/* sink progress: finished, or room again after a stall */
+static void serial_on_wake(int fd, int events, void *arg)
+{
+    struct serial_loop *l = arg;
+    int resume = 0;
+
+    evloop_event_ack(fd);
+
+    if (sink_done) {
+        evloop_stop(l->ev);
+        return;
+    }
+    COND_NOTIFY(&rx_cond, if (rx_stalled && !rbuf_is_full(&rbuff)) { rx_stalled = 0; resume = 1; });
+    if (resume) {
+        serial_update_events(l);
+    }
+}
+
+static void serial_on_signal(int fd, int events, void *arg)
+{
+    struct serial_loop *l = arg;
+
+    if (evloop_signal_ack(fd) > 0) {
+        evloop_stop(l->ev);
+    }
+}
+
+/* SIGUSR1 dumps everything, the --stats timer prints the line */
+void serial_on_stats(int fd, int events, void *arg)
+{
+    if (fd == stats_usr1fd) {
+        if (evloop_signal_ack(fd) == SIGUSR1) {
+            serial_stats_report(1);
+        }
+        return;
+    }
+    evloop_timer_ack(fd);
+    serial_stats_report(0);
+    evloop_timer_set(fd, stats_ms);
+}
+
+/* arms the --stats timer; the descriptors serial_on_stats serves, for
+ * loops not built on evloop */
+int serial_stats_fds(int fds[2])
+{
+    int n = 0;
+
+    if (stats_usr1fd != -1) {
+        fds[n++] = stats_usr1fd;
+    }
+    if (stats_timerfd != -1) {
+        evloop_timer_set(stats_timerfd, stats_ms);
+        fds[n++] = stats_timerfd;
+    }
+    return n;
+}
+
+void serial_stats_watch(struct evloop *ev)
+{
+    int fds[2], i, n = serial_stats_fds(fds);
+
+    for (i = 0; i < n; i++) {
+        evloop_add(ev, fds[i], EV_READ, serial_on_stats, NULL);
+    }
+}
+
+/* idle timeout: no data from the port for serial->timeout ms */
+static void serial_on_timer(int fd, int events, void *arg)
+{
+    struct serial_loop *l = arg;
+    long idle;
+
+    evloop_timer_ack(fd);
+
+    idle = serial_elapsed_ms(&l->last_rx);
+    if (idle >= l->serial->timeout) {
+        evloop_stop(l->ev);
+    } else {
+        evloop_timer_set(fd, l->serial->timeout - idle);
+    }
+}
+
+static void serial_on_stdin(int fd, int events, void *arg)
+{
+    struct serial_loop *l = arg;
+    struct serial_buf sb = { 0, {0} };
+
+    sb.len = read(fd, sb.buf, sizeof(sb.buf) - 1);
+    if (sb.len <= 0) {
+        evloop_del(l->ev, fd);
+        if (fd != _fileno(stdin)) {
+            close(fd);
+        }
+        return;
+    }
+
+    if (!strncmp("bye", sb.buf, 3) || !strncmp(sb.buf, "quit", 4)) {
+        l->quit = 1;
+        evloop_stop(l->ev);
+        return;
+    }
+
+    if (serial_write_buf(l->serial, sb.buf, sb.len) == -1) {
+        perror("write()");
+    }
+    if (busy_ns) {
+        /* a response is likely on its way */
+        l->busy_until = stats_now() + busy_ns;
+    }
+    serial_update_events(l);
 }
 
+/* stdin epoll refuses (a regular file, /dev/null): a thread copies it
+ * into a pipe the loop can watch, blocking reads are fine there */
+static void serial_stdin_pump(void *p)
+{
+    int out = *(int *)p;
+    char buf[MAX_BUF_LENGTH];
+    ssize_t n;
 
+    free(p);
+    while ((n = read(_fileno(stdin), buf, sizeof(buf))) > 0) {
+        if (serial_write_out(out, buf, n) == -1) {
+            break;
+        }
+    }
+    close(out);
+    END_TREAD();
+}
+
+static int serial_add_stdin(struct serial_loop *l)
+{
+    int fds[2], *out;
+
+    if (evloop_add(l->ev, _fileno(stdin), EV_READ, serial_on_stdin, l) == 0) {
+        return 0;
+    }
+    if (errno != EPERM || pipe(fds) == -1) {
+        return -1;
+    }
+    if (!(out = malloc(sizeof(*out))) ||
+        evloop_add(l->ev, fds[0], EV_READ, serial_on_stdin, l) == -1) {
+        free(out);
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    *out = fds[1];
+    SPAWN_THREAD(serial_stdin_pump, out);
+    return 0;
+}
+
+/* one thread waits on the port, stdin, SIGINT, the idle timer and the
+ * sink; only the stdout rendering runs on its own thread */
+static void serial_event_loop(struct serial_opt *serial, int interactive)
+{
+    struct serial_loop l;
+    int sigfd;
+
+    memset(&l, 0, sizeof(l));
+    l.serial = serial;
+    l.timerfd = -1;
+    l.inofd = -1;
+    l.retryfd = -1;
+    clock_gettime(CLOCK_MONOTONIC, &l.last_rx);
+
+    sigfd = evloop_signalfd(SIGINT);
+    loop_efd = evloop_eventfd();
+
+    if (!(l.ev = evloop_create()) || sigfd == -1 || loop_efd == -1) {
+        perror("event loop");
+        exit(EXIT_FAILURE);
+    }
+
+    evloop_add(l.ev, serial->handler, EV_READ, serial_on_port, &l);
+    serial_update_events(&l);
+    evloop_add(l.ev, loop_efd, EV_READ, serial_on_wake, &l);
+    evloop_add(l.ev, sigfd, EV_READ, serial_on_signal, &l);
+    serial_stats_watch(l.ev);
+
+    if (reconnect) {
+        char *dir = strdup(serial->name);
+
+        l.retryfd = evloop_timerfd();
+        l.inofd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (l.retryfd == -1 || !dir) {
+            perror("reconnect");
+            exit(EXIT_FAILURE);
+        }
+        evloop_add(l.ev, l.retryfd, EV_READ, serial_on_retry, &l);
+        if (l.inofd != -1 &&
+            inotify_add_watch(l.inofd, dirname(dir), IN_CREATE | IN_ATTRIB | IN_MOVED_TO) != -1) {
+            evloop_add(l.ev, l.inofd, EV_READ, serial_on_devdir, &l);
+        }
+        free(dir);
+    }
+
+    if (interactive) {
+        if (serial_add_stdin(&l) == -1) {
+            perror("stdin");
+            exit(EXIT_FAILURE);
+        }
+    } else if (serial->timeout > 0) {
+        l.timerfd = evloop_timerfd();
+        evloop_timer_set(l.timerfd, serial->timeout);
+        evloop_add(l.ev, l.timerfd, EV_READ, serial_on_timer, &l);
+    }
+
+    /* spinning on the only CPU would keep the peer and the sink off it */
+    if (busy_ns && sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        fprintf(stderr, "--low-latency: single CPU, not busy polling\n");
+        busy_ns = 0;
+    }
+
+    SPAWN_THREAD(serial_sink, (void*) serial);
+    /* after the spawn: the sink keeps the normal policy and mask */
+    if (rt_prio || rt_cpu >= 0) {
+        linux_serial_rt_thread(rt_prio, rt_cpu);
+    }
+
+    while (evloop_running(l.ev)) {
+        int spin = busy_ns && stats_now() < l.busy_until;
+        int n = evloop_run_once(l.ev, spin ? 0 : -1);
+
+        if (n == -1) {
+            perror("epoll_wait()");
+            break;
+        }
+        if (!spin || n > 0) {
+            stats_rx_wakeup(evloop_last_wait(l.ev));
+        }
+    }
+
+    if (!l.quit) {
+        serial_finish(serial);
+    }
+}
+#else
+/* runs the RX pipeline: this thread drains the port, serial_sink renders */
 static void serial_output(void *p)
 {
     struct serial_opt *serial = (struct serial_opt *)p;
-    char ch;
-    int msgs = 0;
-    while (!signal_exit && serial_port_read_rbuff(serial) != -1) {
 
-        while(rbuf_get(&rbuff, &ch)) {
-            
-            putc(ch, stdout);
+    SPAWN_THREAD(serial_sink, p);
+    serial_reader(serial);
+    serial_finish(serial);
+}
 
-            if (ch == '\n' && (++msgs == serial->max_msgs)) {
-                break;
+/* producer: only moves bytes from the port into the ring */
+static void serial_reader(struct serial_opt *serial)
+{
+    size_t len;
+    uint64_t start;
+
+    while (!signal_exit && !sink_done) {
+
+        if (rbuf_is_full(&rbuff)) {
+            /* leave the data in the tty until the sink catches up */
+            stats_rx_stall();
+            COND_WAIT(&rx_cond, !rbuf_is_full(&rbuff) || sink_done);
+            continue;
+        }
+
+        start = stats_now();
+        if (serial_wait_fd(serial->handler, serial->timeout) == -1) {
+            perror("select()");
+            break;
+        }
+        stats_rx_wakeup(stats_now() - start);
+
+        if (serial_port_read_rbuff(serial, &rbuff) == -1) {
+            break;
+        }
+
+        len = rbuf_len(&rbuff);
+        if (len) {
+            stats_rx_queued(len);
+            COND_NOTIFY(&rx_cond, (void)0);
+        }
+    }
+}
+#endif
+
+/* -x: rendered a block at a time into the preallocated buffer, one
+ * write() per block */
+static int serial_hex_out(const char *buf, size_t len)
+{
+    uint64_t now = hexer.stamps ? stats_now() : 0;
+    size_t n;
+
+    for (; len; buf += n, len -= n) {
+        n = len < HEX_CHUNK ? len : HEX_CHUNK;
+        if (serial_write_out(_fileno(stdout), hexer.out,
+                             hexdump_render(&hexer, buf, n, now, hexer.out)) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* one write() per decoded frame, terminated by a newline; hex dumped
+ * frames count their offsets from the frame start */
+static int serial_on_frame(char *frame, size_t len, void *arg)
+{
+    struct serial_opt *serial = (struct serial_opt *)arg;
+    int res;
+
+    if (hexer.out) {
+        hexer.offset = 0;
+        res = serial_hex_out(frame, len);
+    } else {
+        frame[len] = '\n';
+        res = serial_write_out(_fileno(stdout), frame, len + 1);
+    }
+    if (res == -1) {
+        sink_err = 1;
+        return -1;
+    }
+    return ++sink_msgs == serial->max_msgs;
+}
+
+/* consumer: only writes ring contents to stdout, one write() per span,
+ * or per frame when a decoder is set */
+static void serial_sink(void *p)
+{
+    struct serial_opt *serial = (struct serial_opt *)p;
+    size_t len, n;
+    char *span;
+#ifndef _WIN32
+    int wake;
+#endif
+
+    while (1) {
+        COND_WAIT(&rx_cond, !rbuf_is_empty(&rbuff) || reader_done);
+
+        if ((span = rbuf_read_span(&rbuff, &len)) == NULL) {
+            break;
+        }
+
+        if (framer.type != FRAME_NONE) {
+            n = frame_decode(&framer, span, len, serial_on_frame, serial);
+        } else {
+            n = serial_count_lines(span, len, &sink_msgs, serial->max_msgs);
+            if (hexer.out) {
+                sink_err = serial_hex_out(span, n) == -1;
+            } else {
+                sink_err = serial_write_out(_fileno(stdout), span, n) == -1;
+            }
+        }
+        if (sink_err) {
+            perror("write()");
+            break;
+        }
+        rbuf_read_commit(&rbuff, n);
+        stats_out_write(n);
+#ifndef _WIN32
+        COND_NOTIFY(&rx_cond, wake = rx_stalled);
+        if (wake) {
+            evloop_event_notify(loop_efd);
+        }
+#else
+        COND_NOTIFY(&rx_cond, (void)0);
+#endif
+
+        if (serial->max_msgs && sink_msgs == serial->max_msgs) {
+            break;
+        }
+    }
+
+    COND_NOTIFY(&rx_cond, sink_done = 1);
+#ifndef _WIN32
+    evloop_event_notify(loop_efd);
+#endif
+    END_TREAD();
+}
+
+/* counts '\n' in buf, returns the span length up to and including the
+ * newline that brings *lines to max (whole buf when max is not reached) */
+static size_t serial_count_lines(const char *buf, size_t len, int *lines, int max)
+{
+    size_t i = 0;
+
+    if (!max) {
+        *lines += (int)scan->count(buf, len, '\n');
+        return len;
+    }
+    while ((i += scan->find(buf + i, len - i, '\n')) < len) {
+        i++;
+        if (++(*lines) == max) {
+            return i;
+        }
+    }
+    return len;
+}
+
+int serial_write_out(int fd, const char *buf, size_t len)
+{
+    int res;
+
+    while (len) {
+        res = _write(fd, buf, len);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += res;
+        len -= res;
+    }
+    return 0;
+}
+
+#ifndef _WIN32
+/* writev until every iovec is out, iov is advanced in place */
+int serial_write_outv(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t res;
+
+    while (iovcnt) {
+        res = writev(fd, iov, iovcnt);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            return -1;
+        }
+        while (iovcnt && (size_t)res >= iov->iov_len) {
+            res -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt) {
+            iov->iov_base = (char *)iov->iov_base + res;
+            iov->iov_len -= res;
         }
     }
+    return 0;
+}
+#endif
+
+int serial_port_open(struct serial_opt *serial)
+{
+    return pusbserial_ops->serial_port_open(serial);
+}
 
-    fprintf(stderr, "\nrecv: %d lines!\n", msgs);
+void serial_port_close(struct serial_opt *serial)
+{
     pusbserial_ops->serial_port_close(serial);
-    exit(EXIT_SUCCESS);
 }
 
+int serial_port_drain(struct serial_opt *serial)
+{
+    return pusbserial_ops->serial_port_drain(serial);
+}
+
+#ifdef _WIN32
 static int serial_get_input(char *buf, int len)
 {
     return pusbserial_ops->serial_port_read(_fileno(stdin), buf, len);
@@ -205,153 +1433,151 @@ void  sigint_handler(int sig)
 {
     signal_exit = 1;
 }
+#endif
 
-static int serial_port_read_rbuff(struct serial_opt *serial)
+/* bytes read into buf, 0 when there are none right now, -1 on error */
+int serial_port_read(struct serial_opt *serial, char *buf, size_t len)
 {
-    int retval = 0;
-    char chr;
+    int retval = pusbserial_ops->serial_port_read(serial->handler, buf, len);
+
+    if (retval > 0) {
+        stats_rx_read(retval);
+        return retval;
+    } else if (retval == 0 || errno == EAGAIN) {
+        return 0;
+    }
+    fprintf(stderr, "%s() failed: %s\n", __func__, strerror(errno));
+    return -1;
+}
 
-    retval = serial_wait_fd(serial->handler, serial->timeout);
+/* bytes the port took, 0 when it has no room right now, -1 on error */
+int serial_port_write(struct serial_opt *serial, const char *buf, size_t len)
+{
+    int retval = pusbserial_ops->serial_port_write(serial->handler, buf, len);
 
-    if (retval == -1 && errno != 0) {
-        perror("select()");
-        exit(-1);
-    } else if (retval == 0) {
-        return -2;
+    if (retval > 0) {
+        stats_tx_write(retval);
+        return retval;
+    } else if (retval == 0 || errno == EAGAIN) {
+        return 0;
     }
+    fprintf(stderr, "%s() failed: %s\n", __func__, strerror(errno));
+    return -1;
+}
 
-    int bytes = pusbserial_ops->serial_port_bytes_available(serial);
-    while (bytes--) {
+/* returns the number of bytes moved into rb, -1 on port error */
+int serial_port_read_rbuff(struct serial_opt *serial, rbuf_t *rb)
+{
+    int retval = 0, total = 0;
+    size_t span;
+    char *pspan;
 
-        if (rbuf_is_full(&rbuff)) { break; }
+    /* read straight into the free region(s) of the ring, one call per span */
+    while ((pspan = rbuf_write_span(rb, &span)) != NULL) {
 
-        retval = pusbserial_ops->serial_port_read(serial->handler, &chr, 1);
-        
-        switch (retval) {
-        case 1:
-            rbuf_put(&rbuff, chr);
-            break;
-        default:
-            if (errno != EAGAIN) {
-                fprintf(stderr, "%s() failed: %s\n", __func__, strerror(errno));
-                return -1;
-            }
+        if ((retval = serial_port_read(serial, pspan, span)) <= 0) {
+            return retval == -1 ? -1 : total;
+        }
+        rbuf_write_commit(rb, retval);
+        total += retval;
+        if ((size_t)retval < span) {
+            break;
         }
     }
 
-    return retval;
+    return total;
 }
 
-int serial_wait_fd(int fd, short stimeout)
+#ifdef _WIN32
+int serial_wait_fd(int fd, int msec)
 {
     fd_set rfds;
-    struct timeval tv = {stimeout, 0};
+    struct timeval tv = {msec / 1000, (msec % 1000) * 1000};
 
     FD_ZERO(&rfds);
     FD_SET(fd, &rfds);
     /* > 0 if descriptor is readable, 0 timeo, -1 err*/
-    return  select(fd + 1, &rfds, NULL, NULL, stimeout == -1 ? NULL : &tv);
+    return  select(fd + 1, &rfds, NULL, NULL, msec == -1 ? NULL : &tv);
 }
+#endif
+
+static const struct {
+    int rate;
+    tcflag_t baud;
+} baud_table[] = {
+    { 50,      B50 },
+    { 75,      B75 },
+    { 110,     B110 },
+    { 134,     B134 },
+    { 150,     B150 },
+    { 200,     B200 },
+    { 300,     B300 },
+    { 600,     B600 },
+    { 1200,    B1200 },
+    { 1800,    B1800 },
+    { 2400,    B2400 },
+    { 4800,    B4800 },
+    { 9600,    B9600 },
+    { 19200,   B19200 },
+    { 38400,   B38400 },
+    { 57600,   B57600 },
+    { 115200,  B115200 },
+    { 230400,  B230400 },
+    { 460800,  B460800 },
+    { 500000,  B500000 },
+    { 576000,  B576000 },
+    { 921600,  B921600 },
+    { 1000000, B1000000 },
+    { 1152000, B1152000 },
+    { 1500000, B1500000 },
+    { 2000000, B2000000 },
+    { 2500000, B2500000 },
+    { 3000000, B3000000 },
+    { 3500000, B3500000 },
+    { 4000000, B4000000 },
+};
 
 static tcflag_t parse_baudrate(int requested)
 {
-    int baudrate;
+    size_t i;
 
-    switch (requested) {
-    case 50:
-        baudrate = B50;
-        break;
-    case 75:
-        baudrate = B75;
-        break;
-    case 110:
-        baudrate = B110;
-        break;
-    case 134:
-        baudrate = B134;
-        break;
-    case 150:
-        baudrate = B150;
-        break;
-    case 200:
-        baudrate = B200;
-        break;
-    case 300:
-        baudrate = B300;
-        break;
-    case 600:
-        baudrate = B600;
-        break;
-    case 1200:
-        baudrate = B1200;
-        break;
-    case 1800:
-        baudrate = B1800;
-        break;
-    case 2400:
-        baudrate = B2400;
-        break;
-    case 4800:
-        baudrate = B4800;
-        break;
-    case 9600:
-        baudrate = B9600;
-        break;
-    case 19200:
-        baudrate = B19200;
-        break;
-    case 38400:
-        baudrate = B38400;
-        break;
-    case 57600:
-        baudrate = B57600;
-        break;
-    case 115200:
-        baudrate = B115200;
-        break;
-    case 230400:
-        baudrate = B230400;
-        break;
-    case 460800:
-        baudrate = B460800;
-        break;
-    case 500000:
-        baudrate = B500000;
-        break;
-    case 576000:
-        baudrate = B576000;
-        break;
-    case 921600:
-        baudrate = B921600;
-        break;
-    case 1000000:
-        baudrate = B1000000;
-        break;
-    case 1152000:
-        baudrate = B1152000;
-        break;
-    case 1500000:
-        baudrate = B1500000;
-        break;
-    case 2000000:
-        baudrate = B2000000;
-        break;
-    case 2500000:
-        baudrate = B2500000;
-        break;
-    case 3000000:
-        baudrate = B3000000;
-        break;
-    case 3500000:
-        baudrate = B3500000;
-        break;
-    case 4000000:
-        baudrate = B4000000;
-        break;
-    default:
-        baudrate = 0;
+    for (i = 0; i < sizeof(baud_table) / sizeof(baud_table[0]); i++) {
+        if (baud_table[i].rate == requested) {
+            return baud_table[i].baud;
+        }
     }
+    return 0;
+}
 
-    return baudrate;
+/* -m: data bits, parity and stop bits as in 8N1 or 7E2, then optionally
+ * ,rtscts or ,xonxoff */
+int serial_parse_mode(struct serial_opt *serial, const char *mode)
+{
+    const char *parities = "NEOMS", *p;
+
+    if (strlen(mode) < 3 || mode[0] < '5' || mode[0] > '8' ||
+        !(p = strchr(parities, toupper((unsigned char)mode[1]))) || !*p ||
+        (mode[2] != '1' && mode[2] != '2')) {
+        return -1;
+    }
+    serial->data_bits = mode[0] - '0';
+    serial->parity = *p;
+    serial->stop_bits = mode[2] - '0';
+
+    if (mode[3] == '\0' || !strcmp(mode + 3, ",none")) {
+        serial->flow = SERIAL_FLOW_NONE;
+    } else if (!strcmp(mode + 3, ",rtscts")) {
+        serial->flow = SERIAL_FLOW_RTSCTS;
+    } else if (!strcmp(mode + 3, ",xonxoff")) {
+        serial->flow = SERIAL_FLOW_XONXOFF;
+    } else {
+        return -1;
+    }
+    return 0;
 }
 
+/* line bits per character: start, data, parity, stop */
+int serial_char_bits(const struct serial_opt *serial)
+{
+    return 1 + serial->data_bits + (serial->parity != 'N') + serial->stop_bits;
+}
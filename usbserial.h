@@ -5,16 +5,31 @@
 
 #define  VERSION "0.1.1"
 
+enum {
+    SERIAL_FLOW_NONE = 0,
+    SERIAL_FLOW_RTSCTS,
+    SERIAL_FLOW_XONXOFF,
+};
+
 struct serial_opt {
     char *name;
     int handler;
-    tcflag_t baud;
+    tcflag_t baud;              /* B* constant of rate, 0 when non-standard */
 #ifndef _WIN32
     struct termios options;
+    struct termios active;      /* what open applied, a reopen reuses it */
 #endif
     int timeout;
     int max_msgs;
     int endl;
+    int drain;
+    int low_latency;
+    int rate;                   /* bits per second, any value where the driver can */
+    int data_bits;              /* 5..8 */
+    char parity;                /* N, E, O, M(ark) or S(pace) */
+    int stop_bits;              /* 1 or 2 */
+    int flow;
+    int keep;                   /* use the port as it is configured */
 };
 
 typedef struct s_usbserial_ops {
@@ -22,10 +37,39 @@ typedef struct s_usbserial_ops {
     void (*serial_port_close)(struct serial_opt *serial);
     int (*serial_port_open)(struct serial_opt *serial);
     int (*serial_port_read)(int fd, char *read_buffer, size_t max_chars_to_read);
-    int (*serial_port_write)(int fd, const char *write_buffer);
+    int (*serial_port_write)(int fd, const char *write_buffer, size_t len);
     int (*serial_port_bytes_available)(struct serial_opt *serial);
+    int (*serial_port_drain)(struct serial_opt *serial);
+    /* --reconnect: open again with what the first open applied, NULL
+     * when the backend can't */
+    int (*serial_port_reopen)(struct serial_opt *serial);
 } usbserial_ops;
 
 usbserial_ops * serial_initialize(struct serial_opt * options);
 
+/* helpers shared by the capture modes, usbserial.c */
+struct _rbuf;
+int serial_port_open(struct serial_opt *serial);
+void serial_port_close(struct serial_opt *serial);
+int serial_port_drain(struct serial_opt *serial);
+int serial_port_read(struct serial_opt *serial, char *buf, size_t len);
+int serial_port_write(struct serial_opt *serial, const char *buf, size_t len);
+int serial_port_read_rbuff(struct serial_opt *serial, struct _rbuf *rb);
+int serial_write_out(int fd, const char *buf, size_t len);
+int serial_write_buf(struct serial_opt *serial, const char *buf, size_t len);
+int serial_tx_flush(struct serial_opt *serial);
+size_t serial_tx_pending(void);
+size_t serial_tx_space(void);
+int serial_parse_mode(struct serial_opt *serial, const char *mode);
+int serial_char_bits(const struct serial_opt *serial);
+#ifndef _WIN32
+struct iovec;
+int serial_write_outv(int fd, struct iovec *iov, int iovcnt);
+/* SIGUSR1 dump and the --stats timer, served by every mode's loop */
+struct evloop;
+void serial_stats_watch(struct evloop *ev);
+int serial_stats_fds(int fds[2]);
+void serial_on_stats(int fd, int events, void *arg);
+#endif
+
 #endif
\ No newline at end of file
@@ -16,6 +16,9 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>
  *
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
@@ -24,15 +27,21 @@
 #include <termios.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
+#include <linux/serial.h>
 
 #include "usbserial.h"
+#include "usbserial_sim.h"
 
 static void linux_serial_port_close(struct serial_opt *serial);
 static int linux_serial_port_open(struct serial_opt *serial);
 static int linux_serial_port_read(int fd, char *read_buffer, size_t max_chars_to_read);
-static int linux_serial_port_write(int fd, const char *write_buffer);
+static int linux_serial_port_write(int fd, const char *write_buffer, size_t len);
 static int linux_serial_port_bytes_available(struct serial_opt *serial);
+static int linux_serial_port_drain(struct serial_opt *serial);
+static int linux_serial_port_reopen(struct serial_opt *serial);
 
 usbserial_ops linux_opts = {
 
@@ -41,10 +50,15 @@ usbserial_ops linux_opts = {
     .serial_port_read = linux_serial_port_read,
     .serial_port_write = linux_serial_port_write,
     .serial_port_bytes_available = linux_serial_port_bytes_available,
+    .serial_port_drain = linux_serial_port_drain,
+    .serial_port_reopen = linux_serial_port_reopen,
 };
 
 usbserial_ops * serial_initialize(struct serial_opt * options)
 {
+    if (options && sim_is_device(options->name)) {
+        return &sim_opts;
+    }
     return &linux_opts;
 }
 
@@ -55,44 +69,206 @@ void linux_serial_port_close(struct serial_opt *serial)
         close(serial->handler);
 }
 
+/* asks the driver to push received bytes to the tty at once instead of
+ * batching them (8250, ftdi_sio latency timer); ptys have no such knob */
+static void linux_serial_low_latency(int fd)
+{
+#ifdef TIOCGSERIAL
+    struct serial_struct ss;
+
+    if (ioctl(fd, TIOCGSERIAL, &ss) == 0 && !(ss.flags & ASYNC_LOW_LATENCY)) {
+        ss.flags |= ASYNC_LOW_LATENCY;
+        ioctl(fd, TIOCSSERIAL, &ss);
+    }
+#endif
+}
+
+/* the kernel's struct termios2 (asm/termbits.h clashes with termios.h),
+ * it carries the speed as a plain number next to BOTHER in c_cflag */
+#define LINUX_NCCS      19
+#define LINUX_BOTHER    0010000
+
+struct linux_termios2 {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[LINUX_NCCS];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+
+#ifdef TCGETS2
+#define LINUX_TCGETS2   _IOR('T', 0x2A, struct linux_termios2)
+#define LINUX_TCSETS2   _IOW('T', 0x2B, struct linux_termios2)
+
+/* same settings, whatever B* code or BOTHER the speed is spelled with */
+static int linux_termios2_same(const struct linux_termios2 *a, const struct linux_termios2 *b)
+{
+    return a->c_iflag == b->c_iflag && a->c_oflag == b->c_oflag && a->c_lflag == b->c_lflag &&
+           (a->c_cflag & ~(CBAUD | CIBAUD)) == (b->c_cflag & ~(CBAUD | CIBAUD)) &&
+           a->c_ispeed == b->c_ispeed && a->c_ospeed == b->c_ospeed &&
+           !memcmp(a->c_cc, b->c_cc, LINUX_NCCS);
+}
+#endif
+
+/* applies t and rate in one TCSETS2, so flags and speed change together
+ * and any integer rate works; skipped when the port is set up like that
+ * already, e.g. on a reopen. Without termios2 only B* rates work. */
+static int linux_serial_set(int fd, const struct termios *t, int rate)
+{
+#ifdef TCGETS2
+    struct linux_termios2 cur, want;
+
+    memset(&want, 0, sizeof(want));
+    want.c_iflag = t->c_iflag;
+    want.c_oflag = t->c_oflag;
+    want.c_cflag = (t->c_cflag & ~(CBAUD | CIBAUD)) | LINUX_BOTHER;
+    want.c_lflag = t->c_lflag;
+    want.c_line = t->c_line;
+    memcpy(want.c_cc, t->c_cc, LINUX_NCCS);
+    want.c_ispeed = rate;
+    want.c_ospeed = rate;
+
+    if (ioctl(fd, LINUX_TCGETS2, &cur) == 0) {
+        if (linux_termios2_same(&cur, &want)) {
+            return 0;
+        }
+        if (ioctl(fd, LINUX_TCSETS2, &want) == -1) {
+            return -1;
+        }
+        /* the driver rounds to what its divisor can do */
+        if (ioctl(fd, LINUX_TCGETS2, &cur) == 0 && cur.c_ospeed != (speed_t)rate) {
+            fprintf(stderr, "asked for %d baud, the port runs at %u\n", rate, (unsigned)cur.c_ospeed);
+        }
+        return 0;
+    }
+#endif
+    if (cfgetospeed(t) == B0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return tcsetattr(fd, TCSANOW, t);
+}
+
+/* the port's own rate, for --keep-settings */
+static int linux_serial_rate(int fd)
+{
+#ifdef TCGETS2
+    struct linux_termios2 cur;
+
+    if (ioctl(fd, LINUX_TCGETS2, &cur) == 0) {
+        return (int)cur.c_ospeed;
+    }
+#endif
+    return 0;
+}
+
+/* data bits, parity, stop bits and flow control from -m */
+static void linux_serial_mode(struct termios *t, const struct serial_opt *serial)
+{
+    static const tcflag_t sizes[] = { CS5, CS6, CS7, CS8 };
+
+    t->c_cflag &= ~(CSIZE | PARENB | PARODD | CMSPAR | CSTOPB | CRTSCTS);
+    t->c_cflag |= sizes[serial->data_bits - 5];
+    switch (serial->parity) {
+    case 'E':
+        t->c_cflag |= PARENB;
+        break;
+    case 'O':
+        t->c_cflag |= PARENB | PARODD;
+        break;
+    case 'M':
+        t->c_cflag |= PARENB | CMSPAR | PARODD;
+        break;
+    case 'S':
+        t->c_cflag |= PARENB | CMSPAR;
+        break;
+    }
+    if (serial->parity != 'N') {
+        t->c_iflag |= INPCK;
+    }
+    if (serial->stop_bits == 2) {
+        t->c_cflag |= CSTOPB;
+    }
+
+    t->c_iflag &= ~(IXON | IXOFF | IXANY);
+    if (serial->flow == SERIAL_FLOW_RTSCTS) {
+        t->c_cflag |= CRTSCTS;
+    } else if (serial->flow == SERIAL_FLOW_XONXOFF) {
+        t->c_iflag |= IXON | IXOFF;
+    }
+}
+
 int linux_serial_port_open(struct serial_opt *serial)
 {
     struct termios options;
 
-    serial->handler = open(serial->name,  O_RDWR | O_NOCTTY | O_NONBLOCK );
+    serial->handler = open(serial->name,  O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
 
     if (serial->handler != -1) {
         fcntl(serial->handler, F_SETFL, FNDELAY);
 
         tcgetattr(serial->handler, &(serial)->options);
+        if (serial->keep) {
+            serial->active = serial->options;
+            serial->rate = linux_serial_rate(serial->handler);
+            return serial->handler;
+        }
         tcgetattr(serial->handler, &options);
-        cfsetispeed(&options, serial->baud);
-        cfsetospeed(&options, serial->baud);
+        if (serial->baud) {
+            cfsetispeed(&options, serial->baud);
+            cfsetospeed(&options, serial->baud);
+        }
         //options.c_cflag |= (CLOCAL | CREAD);
         //options.c_lflag |= ICANON;
         //http://stackoverflow.com/questions/6947413/how-to-open-read-and-write-from-serial-port-in-c
         options.c_cflag |= (CLOCAL | CREAD);    /* ignore modem controls */
-        options.c_cflag &= ~CSIZE;
-        options.c_cflag |= CS8;         /* 8-bit characters */
-        options.c_cflag &= ~PARENB;     /* no parity bit */
-        options.c_cflag &= ~CSTOPB;     /* only need 1 stop bit */
-        options.c_cflag &= ~CRTSCTS;    /* no hardware flowcontrol */
 
         /* setup for non-canonical mode */
         options.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
         options.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
         options.c_oflag &= ~OPOST;
+        linux_serial_mode(&options, serial);
 
         /* fetch bytes as they become available */
         options.c_cc[VMIN] = 0;
         options.c_cc[VTIME] = 10;
+        if (serial->low_latency) {
+            linux_serial_low_latency(serial->handler);
+        }
 
-        tcsetattr(serial->handler, TCSANOW, &options);
+        if (linux_serial_set(serial->handler, &options, serial->rate) == -1) {
+            fprintf(stderr, "%s: unable to set %d baud %d%c%d : %s\n", serial->name, serial->rate,
+                    serial->data_bits, serial->parity, serial->stop_bits, strerror(errno));
+            close(serial->handler);
+            return serial->handler = -1;
+        }
+        serial->active = options;
     }
 
     return (serial->handler);
 }
 
+/* the device came back (same or new node): restore the settings the
+ * first open applied instead of deriving them again */
+static int linux_serial_port_reopen(struct serial_opt *serial)
+{
+    serial->handler = open(serial->name, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+
+    if (serial->handler != -1) {
+        tcgetattr(serial->handler, &serial->options);
+        if (!serial->keep) {
+            if (serial->low_latency) {
+                linux_serial_low_latency(serial->handler);
+            }
+            linux_serial_set(serial->handler, &serial->active, serial->rate);
+        }
+    }
+    return serial->handler;
+}
+
 int linux_serial_port_read(int fd, char *read_buffer, size_t max_chars_to_read)
 {
     int chars_read = read(fd, read_buffer, max_chars_to_read);
@@ -100,12 +276,16 @@ int linux_serial_port_read(int fd, char *read_buffer, size_t max_chars_to_read)
     return chars_read;
 }
 
-int linux_serial_port_write(int fd, const char *write_buffer)
+/* one write(), may be short or fail with EAGAIN on the non-blocking fd */
+int linux_serial_port_write(int fd, const char *write_buffer, size_t len)
+{
+    return write(fd, write_buffer, len);
+}
+
+/* blocks until the UART has shifted out everything written */
+static int linux_serial_port_drain(struct serial_opt *serial)
 {
-    size_t len = strlen(write_buffer);
-    size_t bytes_written = write(fd, write_buffer, len);
-    tcdrain(fd);
-    return (bytes_written == len);
+    return tcdrain(serial->handler);
 }
 
 static int linux_serial_port_bytes_available(struct serial_opt *serial)
@@ -116,4 +296,30 @@ static int linux_serial_port_bytes_available(struct serial_opt *serial)
         return -1;
     }
     return n;
-}
\ No newline at end of file
+}
+/* SCHED_FIFO at prio (0 keeps the policy) and pinning to cpu (-1 keeps
+ * the mask) for the calling thread; threads it spawns later inherit both */
+int linux_serial_rt_thread(int prio, int cpu)
+{
+    struct sched_param sp;
+    cpu_set_t set;
+    int res = 0;
+
+    if (prio > 0) {
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = prio;
+        if ((errno = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp)) != 0) {
+            fprintf(stderr, "SCHED_FIFO %d: %s\n", prio, strerror(errno));
+            res = -1;
+        }
+    }
+    if (cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+            fprintf(stderr, "CPU affinity %d: %s\n", cpu, strerror(errno));
+            res = -1;
+        }
+    }
+    return res;
+}
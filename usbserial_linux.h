@@ -7,13 +7,42 @@
 
 #define DEFAULT_USB_DEV "/dev/ttyUSB0"
 #define _fileno fileno
+#define _write write
 
 #define END_TREAD() pthread_exit(NULL)
 #define SPAWN_THREAD(threadfn, params)\
     {\
     pthread_t   thread;\
-    pthread_create(&thread, NULL, (void*)serial_output, params);\
+    pthread_create(&thread, NULL, (void*)threadfn, params);\
     pthread_detach(thread);\
     }
 
+/* mutex + condition pair, pred is re-checked under the lock */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} serial_cond_t;
+
+#define COND_INIT(c)\
+    {\
+    pthread_mutex_init(&(c)->lock, NULL);\
+    pthread_cond_init(&(c)->cond, NULL);\
+    }
+#define COND_WAIT(c, pred)\
+    {\
+    pthread_mutex_lock(&(c)->lock);\
+    while (!(pred)) pthread_cond_wait(&(c)->cond, &(c)->lock);\
+    pthread_mutex_unlock(&(c)->lock);\
+    }
+#define COND_NOTIFY(c, stmt)\
+    {\
+    pthread_mutex_lock(&(c)->lock);\
+    stmt;\
+    pthread_cond_broadcast(&(c)->cond);\
+    pthread_mutex_unlock(&(c)->lock);\
+    }
+
+struct serial_opt;
+int linux_serial_rt_thread(int prio, int cpu);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,617 @@
+/*  usbserial_sim.c - simulated device: paced traffic and TX responses on a pty.
+ *
+ *  Copyright (C) 2026  Borislav Sapundzhiev <bsapundjiev_AT_gmail.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+
+#include "usbserial_linux.h"
+#include "usbserial.h"
+#include "usbserial_sim.h"
+#include "rbuff.h"
+#include "frame.h"
+#include "scan.h"
+#include "stats.h"
+
+#define SIM_CHUNK       4096        /* most bytes generated per write() */
+#define SIM_UNIT_MAX    (2 * 65536 + 8)
+#define SIM_RESP_SIZE   (1 << 16)   /* echo/reply bytes waiting for their time */
+#define SIM_MARKS       1024
+#define SIM_TICK_NS     1000000ULL  /* paced output goes out in 1 ms slices */
+
+enum {
+    SIM_LINES = 0,      /* "<seq> abcd...\n", len bytes with the newline */
+    SIM_COUNTER,        /* bytes 0, 1, .. 255, 0, .. */
+    SIM_RANDOM,         /* xorshift64 from seed */
+    SIM_NONE,           /* only answers TX */
+};
+
+static const char *sim_patterns[] = { "lines", "counter", "random", "none" };
+
+/* a response becomes due at ns, it ends at offset end of the queue */
+struct sim_mark {
+    uint64_t ns;
+    uint64_t end;
+};
+
+struct sim_dev {
+    struct sim_dev *next;
+    int master;
+    int slave;
+    int wakefd;
+    int stop;
+    pthread_t thread;
+
+    /* sim:// keys */
+    uint64_t rate;          /* bytes per second, 0 flat out */
+    int pattern;
+    size_t len;             /* payload size */
+    int frame;              /* FRAME_NONE or the framing around each payload */
+    uint64_t limit;         /* hang up after this many bytes, 0 never */
+    uint64_t rng;
+    int echo;
+    char *reply;            /* sent back for every non-empty TX line */
+    size_t replylen;
+    size_t txline;          /* bytes of the TX line so far */
+    uint64_t delay_ns;
+
+    /* generator */
+    uint64_t sent;
+    uint64_t seq;
+    char *payload;
+    char *unit;             /* the payload as it goes on the wire */
+    size_t unitlen;
+    size_t unitpos;
+    char out[SIM_CHUNK];    /* generated, not yet taken by the pty */
+    size_t outlen;
+    size_t outpos;
+
+    /* responses */
+    rbuf_t resp;
+    uint64_t resp_in;
+    uint64_t resp_out;
+    struct sim_mark marks[SIM_MARKS];
+    unsigned mark_head;
+    unsigned mark_tail;
+    uint64_t tx_bytes;
+    uint64_t responses;
+    uint64_t dropped;
+};
+
+static struct sim_dev *sim_devs;
+
+extern usbserial_ops linux_opts;    /* the pty slave is driven like any tty */
+
+int sim_is_device(const char *name)
+{
+    return name && !strncmp(name, SIM_PREFIX, strlen(SIM_PREFIX));
+}
+
+/* 3M, 64k, 10000 */
+static uint64_t sim_parse_size(const char *s, int *err)
+{
+    char *end;
+    double v = strtod(s, &end);
+
+    switch (*end) {
+    case 'k':
+    case 'K':
+        v *= 1e3;
+        end++;
+        break;
+    case 'M':
+        v *= 1e6;
+        end++;
+        break;
+    case 'G':
+        v *= 1e9;
+        end++;
+        break;
+    }
+    *err |= end == s || *end || v < 0;
+    return (uint64_t)v;
+}
+
+/* 500us, 2ms, 1s; a bare number is microseconds */
+static uint64_t sim_parse_time(const char *s, int *err)
+{
+    char *end;
+    double v = strtod(s, &end);
+
+    if (!strcmp(end, "ns")) {
+        return v;
+    } else if (!strcmp(end, "ms")) {
+        return v * 1e6;
+    } else if (!strcmp(end, "s")) {
+        return v * 1e9;
+    }
+    *err |= end == s || (*end && strcmp(end, "us")) || v < 0;
+    return v * 1e3;
+}
+
+/* rate=3M,pattern=lines|counter|random|none,len=80,frame=cobs|slip|hdlc|len,
+ * bytes=10M,seed=1,echo=1,reply=OK,delay=500us */
+static int sim_parse(struct sim_dev *d, const char *name)
+{
+    char *spec = strdup(name + strlen(SIM_PREFIX)), *tok, *save = NULL, *val;
+    size_t i;
+    int err = 0;
+
+    d->len = 80;
+    d->rng = 1;
+    for (tok = strtok_r(spec, ",", &save); tok && !err; tok = strtok_r(NULL, ",", &save)) {
+        if (!(val = strchr(tok, '='))) {
+            err = 1;
+            break;
+        }
+        *val++ = '\0';
+        if (!strcmp(tok, "rate")) {
+            d->rate = sim_parse_size(val, &err);
+        } else if (!strcmp(tok, "len")) {
+            d->len = sim_parse_size(val, &err);
+            err |= d->len < 1 || d->len > 65536;
+        } else if (!strcmp(tok, "bytes")) {
+            d->limit = sim_parse_size(val, &err);
+        } else if (!strcmp(tok, "seed")) {
+            d->rng = sim_parse_size(val, &err) | 1;
+        } else if (!strcmp(tok, "echo")) {
+            d->echo = atoi(val);
+        } else if (!strcmp(tok, "delay")) {
+            d->delay_ns = sim_parse_time(val, &err);
+        } else if (!strcmp(tok, "reply")) {
+            free(d->reply);
+            d->replylen = strlen(val) + 2;
+            if ((d->reply = malloc(d->replylen + 1)) != NULL) {
+                sprintf(d->reply, "%s\r\n", val);
+            }
+        } else if (!strcmp(tok, "frame")) {
+            err |= (d->frame = frame_parse_type(val)) == -1;
+        } else if (!strcmp(tok, "pattern")) {
+            for (i = 0; i < sizeof(sim_patterns) / sizeof(sim_patterns[0]); i++) {
+                if (!strcmp(val, sim_patterns[i])) {
+                    break;
+                }
+            }
+            d->pattern = i;
+            err |= i == sizeof(sim_patterns) / sizeof(sim_patterns[0]);
+        } else {
+            err = 1;
+        }
+    }
+    if (err) {
+        fprintf(stderr, "sim: bad %s%s%s in %s\n", tok ? tok : "", tok && val ? "=" : "",
+                tok && val ? val : "", name);
+    }
+    free(spec);
+    return err ? -1 : 0;
+}
+
+static uint64_t sim_now(void)
+{
+    return stats_now();
+}
+
+static size_t sim_cobs(char *dst, const unsigned char *src, size_t len)
+{
+    size_t code_at = 0, n = 1, i;
+    unsigned char code = 1;
+
+    for (i = 0; i < len; i++) {
+        if (src[i]) {
+            dst[n++] = src[i];
+            code++;
+        }
+        if (!src[i] || code == 0xFF) {
+            dst[code_at] = code;
+            code_at = n++;
+            code = 1;
+        }
+    }
+    dst[code_at] = code;
+    dst[n++] = 0;
+    return n;
+}
+
+static size_t sim_escape(char *dst, size_t n, unsigned char c, int type)
+{
+    if (type == FRAME_SLIP && (c == 0xC0 || c == 0xDB)) {
+        dst[n++] = (char)0xDB;
+        dst[n++] = c == 0xC0 ? (char)0xDC : (char)0xDD;
+    } else if (type == FRAME_HDLC && (c == 0x7E || c == 0x7D)) {
+        dst[n++] = 0x7D;
+        dst[n++] = c ^ 0x20;
+    } else {
+        dst[n++] = c;
+    }
+    return n;
+}
+
+/* the next payload, framed like a device using -F would send it */
+static void sim_next_unit(struct sim_dev *d)
+{
+    unsigned char *p = (unsigned char *)d->payload;
+    uint16_t fcs;
+    size_t i, n = 0;
+    int head;
+
+    switch (d->pattern) {
+    case SIM_LINES:
+        head = snprintf(d->payload, d->len, "%llu ", (unsigned long long)d->seq);
+        head = head < (int)d->len ? head : 0;
+        for (i = head; i < d->len; i++) {
+            p[i] = 'a' + (i - head) % 26;
+        }
+        p[d->len - 1] = '\n';
+        break;
+    case SIM_COUNTER:
+        for (i = 0; i < d->len; i++) {
+            p[i] = (unsigned char)(d->seq * d->len + i);
+        }
+        break;
+    default:
+        for (i = 0; i < d->len; i++) {
+            d->rng ^= d->rng << 13;
+            d->rng ^= d->rng >> 7;
+            d->rng ^= d->rng << 17;
+            p[i] = (unsigned char)d->rng;
+        }
+        break;
+    }
+    d->seq++;
+
+    switch (d->frame) {
+    case FRAME_COBS:
+        n = sim_cobs(d->unit, p, d->len);
+        break;
+    case FRAME_SLIP:
+        d->unit[n++] = (char)0xC0;
+        for (i = 0; i < d->len; i++) {
+            n = sim_escape(d->unit, n, p[i], FRAME_SLIP);
+        }
+        d->unit[n++] = (char)0xC0;
+        break;
+    case FRAME_HDLC:
+        fcs = ~scan->crc16(0xFFFF, p, d->len);
+        d->unit[n++] = 0x7E;
+        for (i = 0; i < d->len; i++) {
+            n = sim_escape(d->unit, n, p[i], FRAME_HDLC);
+        }
+        n = sim_escape(d->unit, n, fcs & 0xFF, FRAME_HDLC);
+        n = sim_escape(d->unit, n, fcs >> 8, FRAME_HDLC);
+        d->unit[n++] = 0x7E;
+        break;
+    case FRAME_LEN:
+        d->unit[n++] = (char)(d->len >> 8);
+        d->unit[n++] = (char)d->len;
+        /* fall through */
+    default:
+        memcpy(d->unit + n, p, d->len);
+        n += d->len;
+        break;
+    }
+    d->unitlen = n;
+    d->unitpos = 0;
+}
+
+/* tops up out[] with at most want bytes of the stream */
+static void sim_generate(struct sim_dev *d, size_t want)
+{
+    size_t take;
+
+    if (d->outpos == d->outlen) {
+        d->outpos = d->outlen = 0;
+    }
+    if (want > sizeof(d->out) - d->outlen) {
+        want = sizeof(d->out) - d->outlen;
+    }
+    while (want) {
+        if (d->unitpos == d->unitlen) {
+            sim_next_unit(d);
+        }
+        take = d->unitlen - d->unitpos < want ? d->unitlen - d->unitpos : want;
+        memcpy(d->out + d->outlen, d->unit + d->unitpos, take);
+        d->unitpos += take;
+        d->outlen += take;
+        want -= take;
+    }
+}
+
+/* what came from the port's TX side: echo it and/or answer every line */
+static void sim_on_tx(struct sim_dev *d, const char *buf, size_t len, uint64_t now)
+{
+    struct sim_mark *m;
+    size_t i;
+
+    d->tx_bytes += len;
+    if (d->echo) {
+        if (rbuf_space(&d->resp) < len || d->mark_tail - d->mark_head == SIM_MARKS) {
+            d->dropped += len;
+        } else {
+            d->resp_in += rbuf_write(&d->resp, buf, len);
+            m = &d->marks[d->mark_tail++ % SIM_MARKS];
+            m->ns = now + d->delay_ns;
+            m->end = d->resp_in;
+        }
+    }
+    for (i = 0; d->reply && i < len; i++) {
+        if (buf[i] != '\n' && buf[i] != '\r') {
+            d->txline++;
+            continue;
+        }
+        if (!d->txline) {
+            continue;
+        }
+        d->txline = 0;
+        if (rbuf_space(&d->resp) < d->replylen || d->mark_tail - d->mark_head == SIM_MARKS) {
+            d->dropped += d->replylen;
+            continue;
+        }
+        d->resp_in += rbuf_write(&d->resp, d->reply, d->replylen);
+        m = &d->marks[d->mark_tail++ % SIM_MARKS];
+        m->ns = now + d->delay_ns;
+        m->end = d->resp_in;
+        d->responses++;
+    }
+}
+
+/* sends every response that is due; 0 when the pty is full */
+static int sim_respond(struct sim_dev *d, uint64_t now)
+{
+    struct sim_mark *m;
+    size_t len;
+    char *span;
+    ssize_t n;
+
+    while (d->mark_head != d->mark_tail) {
+        m = &d->marks[d->mark_head % SIM_MARKS];
+        if (m->ns > now) {
+            break;
+        }
+        while (d->resp_out < m->end && (span = rbuf_read_span(&d->resp, &len)) != NULL) {
+            if (len > m->end - d->resp_out) {
+                len = m->end - d->resp_out;
+            }
+            if ((n = write(d->master, span, len)) <= 0) {
+                return 0;
+            }
+            rbuf_read_commit(&d->resp, n);
+            d->resp_out += n;
+        }
+        d->mark_head++;
+    }
+    return 1;
+}
+
+/* the device: paced generation against absolute deadlines (start + sent
+ * / rate), so the average rate holds however late a slice goes out */
+static void *sim_thread(void *arg)
+{
+    struct sim_dev *d = arg;
+    struct pollfd pfd[2];
+    struct timespec ts;
+    uint64_t start = sim_now(), now, next, gen_at;
+    size_t want;
+    ssize_t n;
+    int done = d->pattern == SIM_NONE, blocked = 0, inq, idle = 0;
+    char buf[SIM_CHUNK];
+
+    pfd[0].fd = d->master;
+    pfd[1].fd = d->wakefd;
+    pfd[1].events = POLLIN;
+    while (!__atomic_load_n(&d->stop, __ATOMIC_ACQUIRE)) {
+        now = sim_now();
+        gen_at = done ? UINT64_MAX : d->rate ? start + d->sent * 1000000000ULL / d->rate : now;
+        next = d->mark_head != d->mark_tail ? d->marks[d->mark_head % SIM_MARKS].ns : UINT64_MAX;
+        next = gen_at < next ? gen_at : next;
+        if (blocked) {
+            next = UINT64_MAX;
+        }
+        /* done: hang up once usbserial has read everything; FIONREAD
+         * misses what the tty layer has yet to push, so it must stay 0
+         * for a tick */
+        if (done && d->limit && d->mark_head == d->mark_tail) {
+            idle = ioctl(d->slave, FIONREAD, &inq) == 0 && inq == 0 ? idle + 1 : 0;
+            if (idle > 1) {
+                break;
+            }
+            next = now + SIM_TICK_NS;
+        }
+        ts.tv_sec = next > now ? (next - now) / 1000000000ULL : 0;
+        ts.tv_nsec = next > now ? (next - now) % 1000000000ULL : 0;
+        pfd[0].events = POLLIN | (blocked ? POLLOUT : 0);
+        if (ppoll(pfd, 2, next == UINT64_MAX ? NULL : &ts, NULL) == -1 && errno != EINTR) {
+            break;
+        }
+
+        now = sim_now();
+        if (pfd[0].revents & POLLIN) {
+            while ((n = read(d->master, buf, sizeof(buf))) > 0) {
+                sim_on_tx(d, buf, n, now);
+            }
+        }
+        blocked = !sim_respond(d, now);
+
+        if (!done && !blocked && now >= gen_at) {
+            /* one slice: a millisecond's worth at the rate, or a chunk */
+            want = d->rate ? (now - gen_at) * d->rate / 1000000000ULL + d->rate / 1000 : SIM_CHUNK;
+            want = want < 1 ? 1 : want;
+            /* what a short write left in out[] counts against the limit */
+            if (d->limit && want > d->limit - d->sent - (d->outlen - d->outpos)) {
+                want = d->limit - d->sent - (d->outlen - d->outpos);
+            }
+            sim_generate(d, want);
+        }
+        if (d->outpos < d->outlen) {
+            n = write(d->master, d->out + d->outpos, d->outlen - d->outpos);
+            if (n > 0) {
+                d->outpos += n;
+                d->sent += n;
+            }
+            blocked |= d->outpos < d->outlen;
+        }
+        done |= d->limit && d->sent >= d->limit;
+    }
+    /* closing the master hangs the port up: usbserial sees a lost device */
+    close(d->master);
+    d->master = -1;
+    return NULL;
+}
+
+/* the device thread takes no signals, SIGINT stays with the signalfd of
+ * the event loop */
+static int sim_start(struct sim_dev *d)
+{
+    sigset_t all, old;
+    int res;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    res = pthread_create(&d->thread, NULL, sim_thread, d);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return res;
+}
+
+static int sim_serial_port_open(struct serial_opt *serial)
+{
+    struct sim_dev *d = calloc(1, sizeof(*d));
+    char slave[64], *name = serial->name;
+
+    if (!d) {
+        return serial->handler = -1;
+    }
+    d->master = d->wakefd = -1;
+    if (sim_parse(d, name) == -1) {
+        errno = EINVAL;
+        goto fail;
+    }
+    d->payload = malloc(d->len);
+    d->unit = malloc(SIM_UNIT_MAX);
+    if (!d->payload || !d->unit || rbuf_init(&d->resp, SIM_RESP_SIZE) == -1 ||
+        (d->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1 ||
+        (d->master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC)) == -1 ||
+        grantpt(d->master) == -1 || unlockpt(d->master) == -1 ||
+        ptsname_r(d->master, slave, sizeof(slave)) != 0) {
+        goto fail;
+    }
+
+    /* the port side is a real tty: termios, epoll and TIOCOUTQ all work */
+    serial->name = slave;
+    d->slave = linux_opts.serial_port_open(serial);
+    serial->name = name;
+    if (d->slave == -1 || sim_start(d) != 0) {
+        goto fail;
+    }
+    d->next = sim_devs;
+    sim_devs = d;
+    return serial->handler;
+
+fail:
+    if (d->master != -1) {
+        close(d->master);
+    }
+    if (d->wakefd != -1) {
+        close(d->wakefd);
+    }
+    if (d->resp.buf) {
+        rbuf_free(&d->resp);
+    }
+    free(d->payload);
+    free(d->unit);
+    free(d->reply);
+    free(d);
+    return serial->handler = -1;
+}
+
+static void sim_serial_port_close(struct serial_opt *serial)
+{
+    struct sim_dev **pd, *d;
+    uint64_t one = 1;
+
+    for (pd = &sim_devs; *pd && (*pd)->slave != serial->handler; pd = &(*pd)->next) {
+    }
+    if ((d = *pd) != NULL) {
+        *pd = d->next;
+        __atomic_store_n(&d->stop, 1, __ATOMIC_RELEASE);
+        if (write(d->wakefd, &one, sizeof(one)) != sizeof(one)) {
+            perror("sim");
+        }
+        pthread_join(d->thread, NULL);
+        fprintf(stderr, "sim: %llu bytes generated, %llu TX bytes, %llu replies%s\n",
+                (unsigned long long)d->sent, (unsigned long long)d->tx_bytes,
+                (unsigned long long)d->responses, d->dropped ? ", responses dropped" : "");
+        close(d->wakefd);
+        rbuf_free(&d->resp);
+        free(d->payload);
+        free(d->unit);
+        free(d->reply);
+        free(d);
+    }
+    linux_opts.serial_port_close(serial);
+}
+
+/* a lost sim device is a hang-up after bytes=: coming back starts a
+ * fresh device from the same spec */
+static int sim_serial_port_reopen(struct serial_opt *serial)
+{
+    return sim_serial_port_open(serial);
+}
+
+/* everything but open and close is the tty's */
+static int sim_serial_port_read(int fd, char *buf, size_t len)
+{
+    return linux_opts.serial_port_read(fd, buf, len);
+}
+
+static int sim_serial_port_write(int fd, const char *buf, size_t len)
+{
+    return linux_opts.serial_port_write(fd, buf, len);
+}
+
+static int sim_serial_port_bytes_available(struct serial_opt *serial)
+{
+    return linux_opts.serial_port_bytes_available(serial);
+}
+
+static int sim_serial_port_drain(struct serial_opt *serial)
+{
+    return linux_opts.serial_port_drain(serial);
+}
+
+usbserial_ops sim_opts = {
+
+    .serial_port_close = sim_serial_port_close,
+    .serial_port_open = sim_serial_port_open,
+    .serial_port_read = sim_serial_port_read,
+    .serial_port_write = sim_serial_port_write,
+    .serial_port_bytes_available = sim_serial_port_bytes_available,
+    .serial_port_drain = sim_serial_port_drain,
+    .serial_port_reopen = sim_serial_port_reopen,
+};
@@ -0,0 +1,14 @@
+#ifndef _USBSERIAL_SIM
+#define _USBSERIAL_SIM
+
+#include "usbserial.h"
+
+/* -d sim://key=value,... : a virtual device on a pty pair, see
+ * usbserial_sim.c for the keys */
+#define SIM_PREFIX  "sim://"
+
+extern usbserial_ops sim_opts;
+
+int sim_is_device(const char *name);
+
+#endif
@@ -25,8 +25,9 @@
 static void win32_serial_port_close(struct serial_opt *serial);
 static int win32_serial_port_open(struct serial_opt *serial);
 static int win32_serial_port_read(int fd, char *read_buffer, size_t max_chars_to_read);
-static int win32_serial_port_write(int fd, const char *write_buffer);
+static int win32_serial_port_write(int fd, const char *write_buffer, size_t len);
 static int win32_serial_port_bytes_available(struct serial_opt *serial);
+static int win32_serial_port_drain(struct serial_opt *serial);
 
 usbserial_ops win32_opts = {
     
@@ -35,6 +36,8 @@ usbserial_ops win32_opts = {
      win32_serial_port_read,
      win32_serial_port_write,
      win32_serial_port_bytes_available,
+     win32_serial_port_drain,
+     NULL,
 };
 
 usbserial_ops * serial_initialize(struct serial_opt * options)
@@ -47,9 +50,30 @@ static void win32_serial_port_close(struct serial_opt *serial)
     _close( serial->handler );
 }
 
+/* rate, data bits, parity, stop bits and flow control from -b and -m */
+static void win32_serial_mode(DCB *dcb, const struct serial_opt *serial)
+{
+    dcb->BaudRate = serial->rate;
+    dcb->ByteSize = serial->data_bits;
+    switch (serial->parity) {
+    case 'E': dcb->Parity = EVENPARITY; break;
+    case 'O': dcb->Parity = ODDPARITY; break;
+    case 'M': dcb->Parity = MARKPARITY; break;
+    case 'S': dcb->Parity = SPACEPARITY; break;
+    default: dcb->Parity = NOPARITY; break;
+    }
+    dcb->fParity = serial->parity != 'N';
+    dcb->StopBits = serial->stop_bits == 2 ? TWOSTOPBITS : ONESTOPBIT;
+
+    dcb->fOutxCtsFlow = serial->flow == SERIAL_FLOW_RTSCTS;
+    dcb->fRtsControl = serial->flow == SERIAL_FLOW_RTSCTS ? RTS_CONTROL_HANDSHAKE : RTS_CONTROL_ENABLE;
+    dcb->fOutX = dcb->fInX = serial->flow == SERIAL_FLOW_XONXOFF;
+}
+
 static int win32_serial_port_open(struct serial_opt *serial)
 {
     static DCB dcb = {0};
+    COMMTIMEOUTS timeouts = {0};
     HANDLE hComm = CreateFile(
         serial->name,
         GENERIC_WRITE | GENERIC_READ,
@@ -66,10 +90,9 @@ static int win32_serial_port_open(struct serial_opt *serial)
      
     if (GetCommState(hComm, &dcb))
     {
-        dcb.BaudRate = serial->baud;
-        dcb.ByteSize = 8; 
-        dcb.Parity = NOPARITY; 
-        dcb.StopBits = ONESTOPBIT; 
+        if (!serial->keep) {
+            win32_serial_mode(&dcb, serial);
+        }
     } 
     else {
         printf("Failed to get the comm state - Error: %d\n", GetLastError());
@@ -81,6 +104,12 @@ static int win32_serial_port_open(struct serial_opt *serial)
         CloseHandle(hComm);
     }
 
+    /* return from ReadFile as soon as any bytes are available */
+    timeouts.ReadIntervalTimeout = MAXDWORD;
+    timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+    timeouts.ReadTotalTimeoutConstant = 1000;
+    SetCommTimeouts(hComm, &timeouts);
+
     serial->handler = _open_osfhandle((intptr_t)hComm, O_TEXT);
     if(serial->handler == -1) {
         printf("Error in _open_osfhandle\n");
@@ -97,15 +126,17 @@ static int win32_serial_port_read(int fd, char *read_buffer, size_t max_chars_to
     return chars_read;
 }
     
-static int win32_serial_port_write(int fd, const char *write_buffer)
+static int win32_serial_port_write(int fd, const char *write_buffer, size_t len)
 {
-    size_t len = strlen(write_buffer);
-    size_t bytes_written = _write(fd, write_buffer, len);
-
-    return (bytes_written == len);
+    return _write(fd, write_buffer, len);
 }
 
 static int win32_serial_port_bytes_available(struct serial_opt *serial)
 {
     return 1;
 }
+
+static int win32_serial_port_drain(struct serial_opt *serial)
+{
+    return FlushFileBuffers((HANDLE)_get_osfhandle(serial->handler)) ? 0 : -1;
+}
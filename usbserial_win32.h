@@ -2,6 +2,7 @@
 #define _USBSERIAL_WIN32
 
 #include <process.h>
+#include <io.h>
 #include <Winsock2.h>
 
 #define __func__ __FUNCTION__
@@ -15,6 +16,31 @@ typedef int tcflag_t;
         _beginthread( threadfn, 0, params );\
     }\
 
+//mutex + condition pair, pred is re-checked under the lock
+typedef struct {
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE cond;
+} serial_cond_t;
+
+#define COND_INIT(c)\
+    {\
+        InitializeCriticalSection(&(c)->lock);\
+        InitializeConditionVariable(&(c)->cond);\
+    }
+#define COND_WAIT(c, pred)\
+    {\
+        EnterCriticalSection(&(c)->lock);\
+        while (!(pred)) SleepConditionVariableCS(&(c)->cond, &(c)->lock, INFINITE);\
+        LeaveCriticalSection(&(c)->lock);\
+    }
+#define COND_NOTIFY(c, stmt)\
+    {\
+        EnterCriticalSection(&(c)->lock);\
+        stmt;\
+        WakeAllConditionVariable(&(c)->cond);\
+        LeaveCriticalSection(&(c)->lock);\
+    }
+
 extern int      optind;
 extern char    *optarg;
 extern int getopt(int nargc, char * const nargv[], const char *ostr);